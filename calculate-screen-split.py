@@ -5,22 +5,32 @@ WIDTH = 1920
 HEIGHT = 1080
 NUM_SERVERS = 16
 
-assert NUM_SERVERS < WIDTH, "For this script there must be less servers than the screen width! In theory you can have more servers (up to one server per pixel), but this script was build such that servers get whole vertical slices"
-
 NETWORK = ipaddress.ip_network("2000:42::/64")
 assert NETWORK.prefixlen == 64, "NETWORK needs to be /64!"
 
-subnet_bits = math.log2(NUM_SERVERS)
-assert subnet_bits.is_integer(), "NUM_SERVERS need to be a power of two!"
-subnets = list(NETWORK.subnets(prefixlen_diff=int(subnet_bits)))
-assert len(subnets) == NUM_SERVERS
+# The x coordinate follows the /64 directly (and y only after it), so the routed prefixes split the screen into
+# vertical slices of 65536 >> (prefix length - 64) pixels. Splitting the rows as well would need a prefix covering all
+# 16 bits of x, i.e. a route per column and server, so we only split into vertical slices.
+assert NUM_SERVERS <= WIDTH, "For this script there must be at most as many servers as the screen is wide"
 
-chunk_width = WIDTH / NUM_SERVERS
-assert chunk_width.is_integer(), "The screen width needs to be a multiple of the resulting chunk width of {chunk_width}. This script was build such that servers get whole vertical slices"
-chunk_width = int(chunk_width)
+# The number of servers doesn't need to be a power of two, every server simply gets a run of consecutive slices, which
+# are routed as (aggregated) prefixes. In case the screen can be split evenly, the slices are the widest power of two
+# dividing the width of a server, otherwise the widest that still give every server at least one of them.
+chunk_width = WIDTH // NUM_SERVERS
+slice_width = chunk_width & -chunk_width if WIDTH % NUM_SERVERS == 0 else 1 << int(math.log2(chunk_width))
+slice_bits = 16 - int(math.log2(slice_width))
+num_slices = math.ceil(WIDTH / slice_width)
+prefix_len = NETWORK.prefixlen + slice_bits
+print(f"Splitting the screen into {num_slices} slices of {slice_width} pixels (/{prefix_len} prefixes)")
+if slice_width % 64 != 0:
+    print("Warning: The slices are not a multiple of 64 pixels wide, so the pixel-fluter sends unchanged pixels")
 
+slices = list(NETWORK.subnets(new_prefix=prefix_len))[:num_slices]
 for server in range(NUM_SERVERS):
-    subnet = NETWORK
-    startX = server * chunk_width
-    endX = (server + 1) * chunk_width - 1
-    print(f"Server {server} has subnet {subnets[server]} with x ranging from {startX} to {endX}")
+    first = server * num_slices // NUM_SERVERS
+    last = (server + 1) * num_slices // NUM_SERVERS
+    startX = first * slice_width
+    endX = min(last * slice_width, WIDTH) - 1
+    routes = ", ".join(str(route) for route in ipaddress.collapse_addresses(slices[first:last]))
+    print(f"Server {server} has the subnets {routes} with x ranging from {startX} to {endX}, "
+          f"start it with --shard-prefix-len {prefix_len} --region {endX - startX + 1}x{HEIGHT}+{startX}+0")
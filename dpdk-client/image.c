@@ -4,6 +4,9 @@
     #include <MagickWand/MagickWand.h>
 #endif
 
+#include <string.h>
+#include <errno.h>
+
 #include "image.h"
 
 int load_image(struct fluter_image** ret, char* file_name) {
@@ -46,3 +49,81 @@ int load_image(struct fluter_image** ret, char* file_name) {
     *ret = fluter_image;
     return 0;
 }
+
+int open_frame_source(struct frame_source** ret, char* file_name, unsigned int width, unsigned int height) {
+    struct frame_source* source = calloc(1, sizeof(struct frame_source));
+    if (!source)
+        return -ENOMEM;
+
+    if (strcmp(file_name, "-") == 0) {
+        if (width == 0 || height == 0) {
+            fprintf(stderr, "The size of raw frames on stdin needs to be given\n");
+            return -EINVAL;
+        }
+        source->width = width;
+        source->height = height;
+        source->stream = stdin;
+        printf("Reading raw RGBA frames with (%u, %u) pixels from stdin\n", width, height);
+
+        *ret = source;
+        return 0;
+    }
+
+    MagickWandGenesis();
+
+    MagickWand* m_wand = NewMagickWand();
+    // ImageMagick expands wildcards itself, so image sequences end up as multiple images in the same wand
+    if (MagickReadImage(m_wand, file_name) == MagickFalse) {
+        return -ENOENT;
+    }
+
+    // Frames of GIFs usually only contain the part that changed, coalescing turns them into full frames
+    MagickWand* coalesced = MagickCoalesceImages(m_wand);
+    DestroyMagickWand(m_wand);
+    if (!coalesced) {
+        fprintf(stderr, "Failed to coalesce the frames of %s\n", file_name);
+        return -1;
+    }
+
+    MagickSetIteratorIndex(coalesced, 0);
+    source->width = MagickGetImageWidth(coalesced);
+    source->height = MagickGetImageHeight(coalesced);
+    source->nb_frames = MagickGetNumberImages(coalesced);
+    source->wand = coalesced;
+    printf("Loaded animation with %u frames of (%u, %u) pixels\n", source->nb_frames, source->width, source->height);
+
+    *ret = source;
+    return 0;
+}
+
+int read_frame(struct frame_source* source, uint32_t* pixels, unsigned int* delay_ms) {
+    size_t nb_pixels = (size_t)source->width * source->height;
+    *delay_ms = 0;
+
+    if (source->stream) {
+        if (fread(pixels, sizeof(uint32_t), nb_pixels, source->stream) == nb_pixels)
+            return 1;
+        if (feof(source->stream))
+            return 0;
+        return -EIO;
+    }
+
+    MagickWand* m_wand = source->wand;
+    MagickSetIteratorIndex(m_wand, source->next_frame);
+    if (MagickGetImageWidth(m_wand) != source->width || MagickGetImageHeight(m_wand) != source->height) {
+        fprintf(stderr, "Frame %u has a different size than the first one\n", source->next_frame);
+        return -EINVAL;
+    }
+    if (MagickExportImagePixels(m_wand, 0, 0, source->width, source->height, "RGBA", CharPixel, pixels) == MagickFalse) {
+        fprintf(stderr, "Failed to export pixels from frame %u\n", source->next_frame);
+        return -1;
+    }
+
+    // The delay is given in ticks, which are usually 1/100 s for GIFs
+    size_t ticks_per_second = MagickGetImageTicksPerSecond(m_wand);
+    if (ticks_per_second > 0)
+        *delay_ms = MagickGetImageDelay(m_wand) * 1000 / ticks_per_second;
+
+    source->next_frame = (source->next_frame + 1) % source->nb_frames;
+    return 1;
+}
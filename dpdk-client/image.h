@@ -1,6 +1,9 @@
 #ifndef _IMAGE_H_
 #define _IMAGE_H_
 
+#include <stdio.h>
+#include <stdint.h>
+
 struct fluter_image {
     unsigned int width;
     unsigned int height;
@@ -10,4 +13,24 @@ struct fluter_image {
 
 int load_image(struct fluter_image** fluter_image, char* file_name);
 
+// Multiple frames of the same size: All frames of an image file (e.g. a GIF), an image sequence matched by a wildcard
+// (e.g. "frames/*.png") or a stream of raw RGBA frames read from stdin (file name "-")
+struct frame_source {
+    unsigned int width;
+    unsigned int height;
+    // 0 for streams, as we don't know how many frames are going to come
+    unsigned int nb_frames;
+
+    void* wand;
+    FILE* stream;
+    unsigned int next_frame;
+};
+
+// width and height are only needed for raw streams, as they don't contain them
+int open_frame_source(struct frame_source** source, char* file_name, unsigned int width, unsigned int height);
+// Exports the next frame into pixels (width * height RGBA values), files start again at the first frame after the
+// last one. delay_ms is the time the frame should be shown according to the file (0 in case it doesn't say).
+// Returns 1 in case a frame was read, 0 at the end of a stream and a negative errno on failure.
+int read_frame(struct frame_source* source, uint32_t* pixels, unsigned int* delay_ms);
+
 #endif
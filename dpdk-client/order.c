@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "order.h"
+
+static const char* order_names[] = {
+    [ORDER_RASTER] = "raster",
+    [ORDER_SHARD] = "shard",
+    [ORDER_RANDOM] = "random",
+    [ORDER_HILBERT] = "hilbert",
+    [ORDER_MORTON] = "morton",
+};
+
+int parse_emission_order(const char* name, enum emission_order* order) {
+    for (unsigned int i = 0; i < sizeof(order_names) / sizeof(order_names[0]); i++) {
+        if (strcmp(name, order_names[i]) == 0) {
+            *order = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char* emission_order_name(enum emission_order order) {
+    if ((unsigned int)order >= sizeof(order_names) / sizeof(order_names[0]))
+        return "unknown";
+    return order_names[order];
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int shard_order(uint32_t* table, unsigned int width, unsigned int height, uint32_t shard_mask) {
+    uint32_t nb_pixels = width * height;
+
+    // Sorting (shard << 32 | index) groups the pixels by shard, keeping the raster order within every shard
+    uint64_t* keys = malloc(nb_pixels * sizeof(uint64_t));
+    if (!keys)
+        return -ENOMEM;
+    for (uint32_t i = 0; i < nb_pixels; i++) {
+        uint32_t x = i % width, y = i / width;
+        keys[i] = (uint64_t)((x << 16 | y) & shard_mask) << 32 | i;
+    }
+    qsort(keys, nb_pixels, sizeof(uint64_t), compare_u64);
+
+    // Every shard is a range [next, end) of keys, which we take one pixel of per round
+    uint32_t* next = malloc(nb_pixels * sizeof(uint32_t));
+    uint32_t* end = malloc(nb_pixels * sizeof(uint32_t));
+    if (!next || !end) {
+        free(keys);
+        free(next);
+        free(end);
+        return -ENOMEM;
+    }
+    uint32_t nb_shards = 0;
+    for (uint32_t i = 0; i < nb_pixels; i++) {
+        if (i == 0 || keys[i] >> 32 != keys[i - 1] >> 32) {
+            next[nb_shards] = i;
+            nb_shards++;
+        }
+        end[nb_shards - 1] = i + 1;
+    }
+    printf("Sending round-robin across %u shards\n", nb_shards);
+
+    uint32_t pos = 0;
+    uint32_t active = nb_shards;
+    while (active > 0) {
+        uint32_t still_active = 0;
+        for (uint32_t shard = 0; shard < active; shard++) {
+            table[pos++] = (uint32_t)keys[next[shard]++];
+            // Drop the shards without pixels left, so that the rounds don't get slower than needed
+            if (next[shard] < end[shard]) {
+                next[still_active] = next[shard];
+                end[still_active] = end[shard];
+                still_active++;
+            }
+        }
+        active = still_active;
+    }
+
+    free(keys);
+    free(next);
+    free(end);
+    return 0;
+}
+
+// Fisher-Yates shuffle using splitmix64 with a fixed seed, so that every run sends the same order
+static void random_order(uint32_t* table, uint32_t nb_pixels) {
+    uint64_t state = 0x706978656c666c75; // "pixelflu"
+    for (uint32_t i = 0; i < nb_pixels; i++)
+        table[i] = i;
+    for (uint32_t i = nb_pixels - 1; i > 0; i--) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        z ^= z >> 31;
+        uint32_t j = z % (i + 1);
+        uint32_t tmp = table[i];
+        table[i] = table[j];
+        table[j] = tmp;
+    }
+}
+
+// Converts the distance d along the Hilbert curve covering a n * n square into coordinates
+static void hilbert_d2xy(uint32_t n, uint64_t d, uint32_t* x, uint32_t* y) {
+    uint32_t rx, ry, tmp;
+    *x = *y = 0;
+    for (uint32_t s = 1; s < n; s *= 2, d /= 4) {
+        rx = 1 & (d / 2);
+        ry = 1 & (d ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                *x = s - 1 - *x;
+                *y = s - 1 - *y;
+            }
+            tmp = *x;
+            *x = *y;
+            *y = tmp;
+        }
+        *x += s * rx;
+        *y += s * ry;
+    }
+}
+
+// Every other bit of v
+static uint32_t compact_bits(uint64_t v) {
+    v &= 0x5555555555555555;
+    v = (v | (v >> 1)) & 0x3333333333333333;
+    v = (v | (v >> 2)) & 0x0f0f0f0f0f0f0f0f;
+    v = (v | (v >> 4)) & 0x00ff00ff00ff00ff;
+    v = (v | (v >> 8)) & 0x0000ffff0000ffff;
+    v = (v | (v >> 16)) & 0x00000000ffffffff;
+    return v;
+}
+
+// Walks the curve over the smallest power of two square covering the image and skips the points outside of it
+static void curve_order(uint32_t* table, enum emission_order order, unsigned int width, unsigned int height) {
+    uint32_t n = 1;
+    while (n < width || n < height)
+        n *= 2;
+
+    uint32_t pos = 0;
+    uint32_t x, y;
+    for (uint64_t d = 0; d < (uint64_t)n * n; d++) {
+        if (order == ORDER_HILBERT) {
+            hilbert_d2xy(n, d, &x, &y);
+        } else {
+            x = compact_bits(d);
+            y = compact_bits(d >> 1);
+        }
+        if (x < width && y < height)
+            table[pos++] = y * width + x;
+    }
+}
+
+int create_emission_order(uint32_t** ret, enum emission_order order, unsigned int width, unsigned int height,
+    uint32_t shard_mask) {
+    uint32_t nb_pixels = width * height;
+    uint32_t* table = malloc(nb_pixels * sizeof(uint32_t));
+    if (!table)
+        return -ENOMEM;
+
+    int err = 0;
+    switch (order) {
+        case ORDER_RASTER:
+            for (uint32_t i = 0; i < nb_pixels; i++)
+                table[i] = i;
+            break;
+        case ORDER_SHARD:
+            err = shard_order(table, width, height, shard_mask);
+            break;
+        case ORDER_RANDOM:
+            random_order(table, nb_pixels);
+            break;
+        case ORDER_HILBERT:
+        case ORDER_MORTON:
+            curve_order(table, order, width, height);
+            break;
+    }
+    if (err) {
+        free(table);
+        return err;
+    }
+
+    *ret = table;
+    return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef _ORDER_H_
+#define _ORDER_H_
+
+#include <stdint.h>
+
+// Order in which the client sends the pixels of the image
+enum emission_order {
+    ORDER_RASTER,
+    // Round-robin across the shards (pixels sharing the bits of (x << 16 | y) given by the shard mask), so that
+    // consecutive packets go to different servers
+    ORDER_SHARD,
+    // A fixed random permutation of all pixels
+    ORDER_RANDOM,
+    // Space-filling curves, consecutive pixels are still close to each other
+    ORDER_HILBERT,
+    ORDER_MORTON,
+};
+
+// Returns -1 for unknown names
+int parse_emission_order(const char* name, enum emission_order* order);
+const char* emission_order_name(enum emission_order order);
+
+// Creates a table with the indices (y * width + x) of all pixels in the order they should be sent
+int create_emission_order(uint32_t** ret, enum emission_order order, unsigned int width, unsigned int height,
+    uint32_t shard_mask);
+
+#endif
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "packet-stream.h"
+
+int open_packet_stream(struct packet_stream** ret, const char* file_name) {
+    int fd = open(file_name, O_RDONLY);
+    if (fd == -1)
+        return -errno;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -errno;
+    }
+    if ((size_t)st.st_size < sizeof(struct packet_stream_header)) {
+        fprintf(stderr, "%s is too small to be a packet stream\n", file_name);
+        close(fd);
+        return -EINVAL;
+    }
+
+    uint8_t* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -errno;
+
+    const struct packet_stream_header* header = (const struct packet_stream_header*)data;
+    if (header->magic != PACKET_STREAM_MAGIC || header->version != PACKET_STREAM_VERSION) {
+        fprintf(stderr, "%s is no packet stream of version %u\n", file_name, PACKET_STREAM_VERSION);
+        munmap(data, st.st_size);
+        return -EINVAL;
+    }
+    if (header->index_offset + header->nb_index * sizeof(uint64_t) > (uint64_t)st.st_size || header->nb_index == 0
+            || header->records_end > header->index_offset) {
+        fprintf(stderr, "%s is truncated\n", file_name);
+        munmap(data, st.st_size);
+        return -EINVAL;
+    }
+    // The TX lcores walk the records over and over again
+    madvise(data, st.st_size, MADV_WILLNEED);
+
+    struct packet_stream* stream = malloc(sizeof(struct packet_stream));
+    if (!stream) {
+        munmap(data, st.st_size);
+        return -ENOMEM;
+    }
+    stream->header = header;
+    stream->data = data;
+    stream->length = st.st_size;
+    stream->index = (const uint64_t*)(data + header->index_offset);
+
+    *ret = stream;
+    return 0;
+}
+
+int packet_stream_writer_open(struct packet_stream_writer* writer, const char* file_name,
+    const struct packet_stream_header* header) {
+    memset(writer, 0, sizeof(*writer));
+    writer->file = fopen(file_name, "wb");
+    if (!writer->file)
+        return -errno;
+
+    writer->header = *header;
+    writer->header.magic = PACKET_STREAM_MAGIC;
+    writer->header.version = PACKET_STREAM_VERSION;
+    writer->header.nb_packets = 0;
+    writer->header.nb_pixels = 0;
+    writer->header.nb_index = 0;
+
+    // The header is written once we know the number of packets
+    writer->offset = sizeof(struct packet_stream_header);
+    if (fseek(writer->file, writer->offset, SEEK_SET) != 0)
+        return -errno;
+    return 0;
+}
+
+int packet_stream_append(struct packet_stream_writer* writer, const uint8_t* first_pixel, const uint8_t* tuples,
+    uint8_t nb_tuples, uint16_t tuple_size) {
+    if (writer->header.nb_packets % PACKET_STREAM_INDEX_INTERVAL == 0) {
+        if (writer->header.nb_index == writer->index_capacity) {
+            writer->index_capacity = writer->index_capacity ? writer->index_capacity * 2 : 1024;
+            uint64_t* index = realloc(writer->index, writer->index_capacity * sizeof(uint64_t));
+            if (!index)
+                return -ENOMEM;
+            writer->index = index;
+        }
+        writer->index[writer->header.nb_index++] = writer->offset;
+    }
+
+    if (fwrite(&nb_tuples, 1, 1, writer->file) != 1
+            || fwrite(first_pixel, PACKET_STREAM_PIXEL_SIZE, 1, writer->file) != 1
+            || (nb_tuples > 0 && fwrite(tuples, tuple_size, nb_tuples, writer->file) != nb_tuples))
+        return -EIO;
+
+    writer->offset += 1 + PACKET_STREAM_PIXEL_SIZE + nb_tuples * tuple_size;
+    writer->header.nb_packets++;
+    writer->header.nb_pixels += 1 + nb_tuples;
+    return 0;
+}
+
+int packet_stream_writer_close(struct packet_stream_writer* writer) {
+    int err = 0;
+    // Align the index
+    static const uint8_t padding[sizeof(uint64_t)];
+    size_t padding_size = (sizeof(uint64_t) - writer->offset % sizeof(uint64_t)) % sizeof(uint64_t);
+    writer->header.records_end = writer->offset;
+    writer->header.index_offset = writer->offset + padding_size;
+    if (fwrite(padding, 1, padding_size, writer->file) != padding_size
+            || fwrite(writer->index, sizeof(uint64_t), writer->header.nb_index, writer->file) != writer->header.nb_index
+            || fseek(writer->file, 0, SEEK_SET) != 0
+            || fwrite(&writer->header, sizeof(writer->header), 1, writer->file) != 1)
+        err = -EIO;
+    if (fclose(writer->file) != 0 && !err)
+        err = -errno;
+    free(writer->index);
+    return err;
+}
@@ -0,0 +1,65 @@
+#ifndef _PACKET_STREAM_H_
+#define _PACKET_STREAM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define PACKET_STREAM_MAGIC 0x53504c50 // "PLPS"
+#define PACKET_STREAM_VERSION 1
+// Every this many packets the index contains the offset of the packet
+#define PACKET_STREAM_INDEX_INTERVAL 1024
+// Size of the first pixel of a packet: x, y (both big endian), r, g, b and a
+#define PACKET_STREAM_PIXEL_SIZE 8
+
+// A packet stream contains all packets of an image as records of
+//   uint8_t number of additional pixels
+//   the first pixel as (x, y, r, g, b, a)
+//   the additional pixels as (x, y, r, g, b) tuples
+// exactly as they go on the wire, followed by the index.
+struct packet_stream_header {
+    uint32_t magic;
+    uint32_t version;
+    uint16_t width;
+    uint16_t height;
+    // The settings the packets were compiled with
+    uint16_t multi_pixel;
+    uint8_t order;
+    uint8_t reserved;
+    uint32_t shard_mask;
+
+    uint64_t nb_packets;
+    uint64_t nb_pixels;
+    // Byte offsets within the file, the records start right after the header
+    uint64_t records_end;
+    uint64_t index_offset;
+    uint64_t nb_index;
+};
+
+struct packet_stream {
+    const struct packet_stream_header* header;
+    // The whole mapped file, the offsets are relative to it
+    const uint8_t* data;
+    size_t length;
+    const uint64_t* index;
+};
+
+// Maps the file read-only
+int open_packet_stream(struct packet_stream** stream, const char* file_name);
+
+struct packet_stream_writer {
+    FILE* file;
+    struct packet_stream_header header;
+    uint64_t offset;
+    uint64_t* index;
+    uint64_t index_capacity;
+};
+
+// The header only needs the fields describing the image and settings, the rest is filled by the writer
+int packet_stream_writer_open(struct packet_stream_writer* writer, const char* file_name,
+    const struct packet_stream_header* header);
+int packet_stream_append(struct packet_stream_writer* writer, const uint8_t* first_pixel, const uint8_t* tuples,
+    uint8_t nb_tuples, uint16_t tuple_size);
+int packet_stream_writer_close(struct packet_stream_writer* writer);
+
+#endif
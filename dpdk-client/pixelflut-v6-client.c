@@ -10,8 +10,12 @@
 #include <rte_cycles.h>
 #include <rte_lcore.h>
 #include <rte_mbuf.h>
+#include <rte_launch.h>
+#include <rte_malloc.h>
 
 #include "image.h"
+#include "order.h"
+#include "packet-stream.h"
 
 #define RX_RING_SIZE 1024
 #define TX_RING_SIZE 1024
@@ -20,19 +24,72 @@
 #define MBUF_CACHE_SIZE 250
 #define BURST_SIZE 32
 
+#define MAX_PORTS 32
+#define MAX_CORES_PER_PORT 16
+
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 
 #define STATS_INTERVAL_MS 1000
 
+// Number of decoded frames of an animation that can be in flight between the decode lcore and the TX lcores
+#define FRAME_SLOTS 8
+// Browsers show GIF frames without a delay for 100ms as well
+#define DEFAULT_FRAME_DELAY_MS 100
+
+#define MAX_RAMP_STEPS 32
+// When pacing, a burst should not take longer than this at the target rate, so low rates use smaller bursts
+#define PACING_BURST_NS 20000
+// Preamble, start of frame delimiter, FCS and inter-frame gap, which are not part of the packet but still use the wire
+#define ETHER_WIRE_OVERHEAD 24
+
+// Large enough for the headers of all protocols
+#define HEADER_TEMPLATE_SIZE 64
+
+// Multi-pixel extension of pixelflut v6, needs to match the server: Packets to this UDP port carry additional
+// (x, y, r, g, b) tuples in their payload
+#define PIXELFLUT_V6_MULTI_PIXEL_PORT 0x7078
+#define MULTI_PIXEL_TUPLE_SIZE 7
+// As many tuples as fit into a 1500 byte IPv6 packet
+#define MAX_MULTI_PIXELS ((RTE_ETHER_MTU - sizeof(struct rte_ipv6_hdr) - sizeof(struct rte_udp_hdr)) / MULTI_PIXEL_TUPLE_SIZE)
+
 static struct argp_option options[] = {
     {"image", 'i', "<image-file>", 0,  "Path to image to flut"},
     {"pingxelflut", 'p', "<ipv6-target>", 0, "Use pingxelflut protocol instead of pixelflut v6, fluting to the target IPv6 address. IPv4 is currently not supported"},
+    {"multi-pixel", 'm', "<pixels>", 0, "Append up to this many additional pixels to every pixelflut v6 packet, the server needs to run with --multi-pixel (at most 207)"},
+    {"shard-prefix-len", 'S', "<bits>", 0, "Only append pixels within the same IPv6 prefix of this length as the first pixel of the packet, in case the screen is split across servers by routing (64 to 96, default 64)"},
+    {"order", 'o', "<order>", 0, "Order in which the pixels are sent: raster (default), shard (round-robin across the shards given by --shard-prefix-len), random (a fixed random permutation), hilbert or morton (space-filling curves). Every lcore sends a consecutive part of the order"},
+    {"prerender", 'r', 0, 0, "Render all packets of the image once at startup and only hand them to the NIC afterwards (using reference counting), instead of building every packet while sending. Needs one mbuf per packet, so use --multi-pixel or enough huge pages for large images"},
+    {"animation", 'a', 0, 0, "Treat --image as animation: All frames of e.g. a GIF, an image sequence (e.g. 'frames/*.png', quoted so that the shell doesn't expand it) or '-' to read raw RGBA frames from stdin (needs --frame-size). Only the pixels that changed from the previous frame are sent"},
+    {"frame-size", 's', "<width>x<height>", 0, "Size of the raw frames read from stdin"},
+    {"fps", 'f', "<fps>", 0, "Frames per second of the animation (default the delays stored in the file, 10 fps otherwise)"},
+    {"full-refresh", 'R', "<ms>", 0, "Resend the whole frame of the animation every this many milliseconds, in case packets got lost (default 1000, 0 disables it)"},
+    {"decode-lcore", 'd', "<lcore>", 0, "The lcore decoding the frames of the animation, it can't send as well (default the main lcore)"},
+    {"rate", 'P', "<rate>", 0, "Limit the send rate of the whole client to this many packets/s, or bits/s on the wire when followed by 'bit' (e.g. 10M or 40Gbit). It is split evenly across the TX lcores"},
+    {"ramp", 'A', "<profile>", 0, "Change the rate over time, given as comma separated <rate>:<seconds> steps (e.g. '5M:10,10M:10,20M:10'). The rate of the last step is kept afterwards, so its seconds can be omitted"},
+    {"compile", 'C', "<file>", 0, "Don't send anything, but write all packets of the image (using the given --order, --multi-pixel and --shard-prefix-len) into a packet stream file for --packet-stream"},
+    {"packet-stream", 'F', "<file>", 0, "Send the packets of a file written by --compile instead of an --image. Starts instantly, as there is no image to decode, and the packets are only copied from the mapped file"},
+    {"port-core-mapping", 'c', "<mapping>", 0, "Mapping of NIC ports to the lcores sending on them, every lcore gets its own TX queue and a slice of the image. Format is '<port1>:<core1> <port2>:<core2>,<core3>', e.g. '0:1' or '0:1,2,3,4 1:5,6,7,8' (default all lcores on port 0)"},
     {0}
 };
 struct arguments {
     char *image_file;
+    char *port_core_mapping;
+    bool prerender;
+    enum emission_order order;
+    bool animation;
+    unsigned int frame_width;
+    unsigned int frame_height;
+    unsigned int fps;
+    unsigned int full_refresh_ms;
+    int decode_lcore;
+    char *rate;
+    char *ramp;
+    char *compile_file;
+    char *packet_stream_file;
     bool use_pingxelflut;
     struct in6_addr pingxelflut_target;
+    uint16_t multi_pixel;
+    uint8_t shard_prefix_len;
 };
 
 static struct rte_ether_addr parse_mac(char *mac_str) {
@@ -71,12 +128,71 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
       arguments->use_pingxelflut = true;
       arguments->pingxelflut_target = parse_ipv6(arg);
       break;
+    case 'm':
+      arguments->multi_pixel = (uint16_t) strtol(arg, NULL, 10);
+      if (arguments->multi_pixel > MAX_MULTI_PIXELS)
+          argp_error(state, "At most %zu additional pixels fit into a packet", MAX_MULTI_PIXELS);
+      break;
+    case 'S':
+      arguments->shard_prefix_len = (uint8_t) strtol(arg, NULL, 10);
+      if (arguments->shard_prefix_len < 64 || arguments->shard_prefix_len > 96)
+          argp_error(state, "The shard prefix length needs to be between 64 and 96");
+      break;
+    case 'c':
+      arguments->port_core_mapping = arg;
+      break;
+    case 'r':
+      arguments->prerender = true;
+      break;
+    case 'o':
+      if (parse_emission_order(arg, &arguments->order) != 0)
+          argp_error(state, "Unknown order %s", arg);
+      break;
+    case 'a':
+      arguments->animation = true;
+      break;
+    case 's':
+      if (sscanf(arg, "%ux%u", &arguments->frame_width, &arguments->frame_height) != 2)
+          argp_error(state, "The frame size needs to be given as <width>x<height>");
+      break;
+    case 'f':
+      arguments->fps = (unsigned int) strtoul(arg, NULL, 10);
+      break;
+    case 'R':
+      arguments->full_refresh_ms = (unsigned int) strtoul(arg, NULL, 10);
+      break;
+    case 'd':
+      arguments->decode_lcore = (int) strtol(arg, NULL, 10);
+      break;
+    case 'P':
+      arguments->rate = arg;
+      break;
+    case 'A':
+      arguments->ramp = arg;
+      break;
+    case 'C':
+      arguments->compile_file = arg;
+      break;
+    case 'F':
+      arguments->packet_stream_file = arg;
+      break;
 
     case ARGP_KEY_END:
+        if (arguments->packet_stream_file) {
+            if (arguments->image_file || arguments->animation || arguments->compile_file)
+                argp_error(state, "--packet-stream can't be combined with --image, --animation or --compile");
+            break;
+        }
+        if (arguments->compile_file && arguments->animation)
+            argp_error(state, "Animations can't be compiled");
         if (arguments->image_file == NULL) {
             argp_failure(state, 1, 0, "--image required. See --help for more information");
             exit(ARGP_ERR_UNKNOWN);
       }
+      if (arguments->animation && arguments->prerender)
+          argp_error(state, "--prerender can't be combined with --animation, as the packets change with every frame");
+      if (arguments->animation && arguments->order != ORDER_RASTER)
+          argp_error(state, "Animations are always sent in raster order");
 
     default:
       return ARGP_ERR_UNKNOWN;
@@ -86,13 +202,14 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 
 const char *argp_program_version = "pixelflut-v6-client 0.1.0";
 static char doc[] = "Fast pixelflut v6 or pingxelflut client using DPDK";
-static char args_doc[] = "--image <image-file>";
+static char args_doc[] = "--image <image-file> | --packet-stream <file>";
 static struct argp argp = { options, parse_opt, args_doc, doc };
 
 // Main functional part of port initialization
-static inline int port_init(uint16_t port, struct rte_mempool *mbuf_pool) {
+// fast_free needs to be false in case mbufs are sent with a reference count above 1, as MBUF_FAST_FREE assumes it's 1
+static inline int port_init(uint16_t port, struct rte_mempool *mbuf_pool, uint16_t tx_rings, bool fast_free) {
     struct rte_eth_conf port_conf;
-    const uint16_t rx_rings = 1, tx_rings = 1;
+    const uint16_t rx_rings = 1;
     uint16_t nb_rxd = RX_RING_SIZE;
     uint16_t nb_txd = TX_RING_SIZE;
     int retval;
@@ -111,7 +228,7 @@ static inline int port_init(uint16_t port, struct rte_mempool *mbuf_pool) {
         return retval;
     }
 
-    if (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE)
+    if (fast_free && (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE))
         port_conf.txmode.offloads |=
             RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE;
 
@@ -134,7 +251,7 @@ static inline int port_init(uint16_t port, struct rte_mempool *mbuf_pool) {
 
     txconf = dev_info.default_txconf;
     txconf.offloads = port_conf.txmode.offloads;
-    // Allocate and set up 1 TX queue per Ethernet port
+    // Allocate and set up 1 TX queue per lcore sending on the port
     for (q = 0; q < tx_rings; q++) {
         retval = rte_eth_tx_queue_setup(port, q, nb_txd,
                 rte_eth_dev_socket_id(port), &txconf);
@@ -164,207 +281,1109 @@ static inline int port_init(uint16_t port, struct rte_mempool *mbuf_pool) {
     return 0;
 }
 
-struct main_thread_args {
+struct port_config {
+    uint16_t nb_queues;
+    uint16_t cores[MAX_CORES_PER_PORT];
+    struct rte_mempool *mbuf_pool;
+};
+
+// Shared by all TX lcores, only read after startup
+struct tx_args {
     struct fluter_image *fluter_image;
     bool use_pingxelflut;
     struct in6_addr pingxelflut_target;
+    uint16_t multi_pixel;
+    // Bits of (x << 16 | y) all pixels of a multi-pixel packet need to share
+    uint32_t shard_mask;
+    bool prerender;
+    bool animation;
+    // Indices of the pixels in the order they are sent, NULL for raster order
+    uint32_t *order;
+    // In case it's set, the packets are copied from the stream (see build_stream_packet) instead of being built. All
+    // packets share the same headers, which only need to be copied from the template.
+    struct packet_stream *stream;
+    uint8_t header_template[HEADER_TEMPLATE_SIZE];
+    uint16_t header_len;
+    uint16_t pixel_offset;
+
+    struct rte_ether_addr dst_mac_addr;
+    struct rte_ether_addr src_mac_addr;
+    struct in6_addr src_addr;
+    struct in6_addr dst_net;
+};
+
+// Rate limit of the whole client, every TX lcore gets the same share of it
+struct pacing {
+    bool enabled;
+    // Whether the rates are bits/s on the wire instead of packets/s
+    bool bits;
+    uint16_t nb_steps;
+    double rates[MAX_RAMP_STEPS];
+    double seconds[MAX_RAMP_STEPS];
+    // The last step lasts forever
+    uint64_t step_end_tsc[MAX_RAMP_STEPS];
+    uint16_t nb_workers;
+};
+
+// Token bucket of a single TX lcore. Instead of counting tokens, it tracks the time at which the bucket is empty: Every
+// sent packet moves next_tsc further into the future and we can send as soon as it is in the past.
+struct pacer {
+    uint16_t step;
+    // TSC cycles a packet (or bit) costs at the current rate
+    double tsc_per_unit;
+    uint16_t burst;
+    uint64_t burst_tsc;
+    uint64_t next_tsc;
+    uint64_t step_end_tsc;
+};
+
+// Every TX lcore sends its own slice [first_pixel, end_pixel) of the image (in raster order or of the order table) on its
+// own TX queue
+struct tx_worker {
+    bool active;
+    uint16_t port;
+    uint16_t queue;
+    uint32_t first_pixel;
+    uint32_t end_pixel;
+    // The slice when sending a packet stream
+    const uint8_t *stream_first;
+    const uint8_t *stream_end;
+    uint32_t stream_packets;
     struct rte_mempool *mbuf_pool;
-    int port_id;
+
+    // Only written by the owning lcore, read by the stats printing
+    uint64_t sent_packets;
+    // Packets the NIC did not take, as its TX queue was full
+    uint64_t tx_full;
+    // Oldest frame of the animation the lcore still reads, the decode lcore must not overwrite it
+    uint64_t frame;
+    // Only counted when pacing, including the ETHER_WIRE_OVERHEAD
+    uint64_t sent_wire_bytes;
+    struct pacer pacer;
+} __rte_cache_aligned;
+
+struct frame_slot {
+    uint32_t *pixels;
+    // Indices of the pixels that differ from the previous frame, in raster order
+    uint32_t *changed;
+    uint32_t nb_changed;
+    unsigned int delay_ms;
 };
 
-static __rte_noreturn void lcore_main(struct main_thread_args *args) {
-    // Read args
-    struct fluter_image *fluter_image = args->fluter_image;
-    struct rte_mempool *mbuf_pool = args->mbuf_pool;
-    int port_id = args->port_id;
+// Frame n of the animation lives in slot n % FRAME_SLOTS. The decode lcore fills the slots ahead and advances shown
+// whenever it's time for the next frame, the TX lcores then send the pixels that changed since the frame they sent last.
+struct animation {
+    struct frame_source *source;
+    struct frame_slot slots[FRAME_SLOTS];
+    unsigned int fixed_delay_ms;
+    uint64_t full_refresh_tsc;
+
+    // Written by the decode lcore only
+    uint64_t decoded;
+    uint64_t shown;
+    bool end_of_stream;
+};
 
-    int width = fluter_image->width;
-    int height = fluter_image->height;
+static struct port_config ports[MAX_PORTS];
+static struct tx_worker workers[RTE_MAX_LCORE];
+static struct tx_args tx_args;
+static struct animation animation;
+static struct pacing pacing;
+
+static void parse_port_core_map(const char *arg) {
+    char *copy = strdup(arg);
+    char *saveptr1 = NULL;
+    char *token = strtok_r(copy, " ", &saveptr1);
+    uint16_t nb_ports = rte_eth_dev_count_avail();
+
+    while (token) {
+        int port;
+        if (sscanf(token, "%d:", &port) != 1 || port < 0 || port >= nb_ports)
+            rte_exit(EXIT_FAILURE, "Invalid port spec '%s'. Valid range of ports: 0..%d\n", token, nb_ports - 1);
+
+        struct port_config *p = &ports[port];
+        if (p->nb_queues > 0)
+            rte_exit(EXIT_FAILURE, "Duplicate mapping for port %d\n", port);
+
+        char *cores = strchr(token, ':');
+        if (!cores || *(++cores) == '\0')
+            rte_exit(EXIT_FAILURE, "No cores specified for port %d\n", port);
+
+        char *saveptr2 = NULL;
+        char *ctok = strtok_r(cores, ",", &saveptr2);
+        while (ctok) {
+            int core = atoi(ctok);
+            if (p->nb_queues >= MAX_CORES_PER_PORT)
+                rte_exit(EXIT_FAILURE, "Too many cores for port %d\n", port);
+            if (core < 0 || core >= RTE_MAX_LCORE || !rte_lcore_is_enabled(core))
+                rte_exit(EXIT_FAILURE, "Core %d is not enabled, add it to the EAL -l argument\n", core);
+            if (workers[core].active)
+                rte_exit(EXIT_FAILURE, "Core %d is mapped more than once, every lcore can only send on one queue\n", core);
+
+            workers[core].active = true;
+            workers[core].port = port;
+            workers[core].queue = p->nb_queues;
+            p->cores[p->nb_queues++] = core;
+            ctok = strtok_r(NULL, ",", &saveptr2);
+        }
 
-    uint16_t port, nb_tx;
+        token = strtok_r(NULL, " ", &saveptr1);
+    }
 
-    uint32_t stats_loop_counter = 0;
-    struct timeval last_stats_report, now;
-    long elapsed_millis;
+    free(copy);
+}
 
-    struct rte_ether_addr dst_mac_addr = parse_mac("14:a0:f8:8b:1e:e4");
-    struct rte_ether_addr src_mac_addr = parse_mac("14:a0:f8:8b:1e:e3");
-    struct in6_addr src_addr = parse_ipv6("fe80::1");
-    struct in6_addr dst_net = parse_ipv6("fe80::");
+// Same as the old single core behaviour: All lcores (except the one given, e.g. the decode lcore) send on port 0
+static void map_all_cores_to_port_0(unsigned skip_core) {
+    unsigned core;
+    RTE_LCORE_FOREACH(core) {
+        if (core == skip_core)
+            continue;
+        if (ports[0].nb_queues >= MAX_CORES_PER_PORT)
+            break;
+        workers[core].active = true;
+        workers[core].port = 0;
+        workers[core].queue = ports[0].nb_queues;
+        ports[0].cores[ports[0].nb_queues++] = core;
+    }
+}
 
-    char src_addr_str[INET6_ADDRSTRLEN];
-    char dst_addr_str[INET6_ADDRSTRLEN];
-    if (!args->use_pingxelflut) {
-        inet_ntop(AF_INET6, &src_addr, src_addr_str, INET6_ADDRSTRLEN);
-        inet_ntop(AF_INET6, &dst_net, dst_addr_str, INET6_ADDRSTRLEN);
-        printf("Using pixelflut v6 protocol to flut from %s to %s/64", src_addr_str, dst_addr_str);
-    } else {
-        inet_ntop(AF_INET6, &src_addr, src_addr_str, INET6_ADDRSTRLEN);
-        inet_ntop(AF_INET6, &args->pingxelflut_target, dst_addr_str, INET6_ADDRSTRLEN);
-        printf("Using pingxelflut protocol to flut from %s to %s", src_addr_str, dst_addr_str);
+// Splits the image into consecutive slices of (nearly) the same number of pixels, one per TX lcore
+static void assign_image_slices(uint32_t nb_pixels) {
+    uint32_t nb_workers = 0;
+    for (unsigned core = 0; core < RTE_MAX_LCORE; core++)
+        nb_workers += workers[core].active;
+
+    uint32_t worker = 0;
+    for (uint16_t port = 0; port < MAX_PORTS; port++) {
+        for (uint16_t q = 0; q < ports[port].nb_queues; q++, worker++) {
+            struct tx_worker *w = &workers[ports[port].cores[q]];
+            w->first_pixel = (uint64_t)nb_pixels * worker / nb_workers;
+            w->end_pixel = (uint64_t)nb_pixels * (worker + 1) / nb_workers;
+            w->mbuf_pool = ports[port].mbuf_pool;
+            printf("Core %u sends pixels %u to %u on port %u queue %u\n", ports[port].cores[q], w->first_pixel,
+                w->end_pixel, port, q);
+        }
     }
+}
 
-    gettimeofday(&last_stats_report, NULL);
+// Splits the packet stream at the packets in its index into slices of (nearly) the same number of packets, one per TX lcore
+static void assign_stream_slices(const struct packet_stream *stream) {
+    const struct packet_stream_header *header = stream->header;
+    uint32_t nb_workers = 0;
+    for (unsigned core = 0; core < RTE_MAX_LCORE; core++)
+        nb_workers += workers[core].active;
+
+    uint32_t worker = 0;
+    for (uint16_t port = 0; port < MAX_PORTS; port++) {
+        for (uint16_t q = 0; q < ports[port].nb_queues; q++, worker++) {
+            struct tx_worker *w = &workers[ports[port].cores[q]];
+            uint64_t first = header->nb_index * worker / nb_workers;
+            uint64_t end = header->nb_index * (worker + 1) / nb_workers;
+            w->stream_first = stream->data + stream->index[first];
+            w->stream_end = end < header->nb_index ? stream->data + stream->index[end] : stream->data + header->records_end;
+            w->stream_packets = RTE_MIN(end * PACKET_STREAM_INDEX_INTERVAL, header->nb_packets)
+                - first * PACKET_STREAM_INDEX_INTERVAL;
+            w->mbuf_pool = ports[port].mbuf_pool;
+            printf("Core %u sends %u packets of the stream on port %u queue %u\n", ports[port].cores[q],
+                w->stream_packets, port, q);
+        }
+    }
+}
 
-    /*
-     * Check that the port is on the same NUMA node as the polling thread for best performance.
-     */
-    RTE_ETH_FOREACH_DEV(port)
-        if (rte_eth_dev_socket_id(port) >= 0 && rte_eth_dev_socket_id(port) != (int)rte_socket_id())
-            printf("WARNING, port %u is on remote NUMA node to polling thread.\n"
-                "\tPerformance will not be optimal.\n", port);
+// Walks the slice of a TX lcore in raster order, wrapping around at its end. In case indices is set, it walks the
+// pixels listed in indices[first, end) instead (e.g. the ones that changed in an animation).
+struct pixel_cursor {
+    uint16_t x;
+    uint16_t y;
+    uint32_t index;
+    uint32_t first;
+    uint32_t end;
+    // Colors of all pixels of the image
+    const uint32_t *pixels;
+    const uint32_t *indices;
+    uint32_t pos;
+};
+
+static inline void cursor_seek(struct pixel_cursor *cursor, uint32_t index, int width) {
+    cursor->index = index;
+    cursor->x = index % width;
+    cursor->y = index / width;
+}
+
+// Walks the records of a packet stream slice, wrapping around at its end
+struct stream_cursor {
+    const uint8_t *record;
+    const uint8_t *first;
+    const uint8_t *end;
+};
+
+static inline void cursor_init(struct pixel_cursor *cursor, uint32_t first, uint32_t end, const uint32_t *pixels,
+    const uint32_t *indices, int width) {
+    *cursor = (struct pixel_cursor){ .first = first, .end = end, .pixels = pixels, .indices = indices, .pos = first };
+    cursor_seek(cursor, indices ? indices[first] : first, width);
+}
+
+static inline void next_pixel(struct pixel_cursor *cursor, int width) {
+    if (cursor->indices) {
+        cursor->pos++;
+        if (unlikely(cursor->pos >= cursor->end))
+            cursor->pos = cursor->first;
+        cursor_seek(cursor, cursor->indices[cursor->pos], width);
+        return;
+    }
+
+    cursor->index++;
+    if (unlikely(cursor->index >= cursor->end)) {
+        cursor_seek(cursor, cursor->first, width);
+        return;
+    }
+    cursor->x++;
+    if (cursor->x >= width) {
+        cursor->x = 0;
+        cursor->y++;
+    }
+}
+
+// Target rate of the whole client at the given time
+static double pacing_rate_at(uint64_t tsc) {
+    uint16_t step = 0;
+    while (step + 1 < pacing.nb_steps && tsc >= pacing.step_end_tsc[step])
+        step++;
+    return pacing.rates[step];
+}
+
+static void print_stats(void) {
+    static uint64_t prev_sent_packets[RTE_MAX_LCORE];
+    static uint64_t prev_sent_wire_bytes[RTE_MAX_LCORE];
+    static uint64_t prev_tsc;
+    double achieved = 0;
+    uint64_t now = rte_rdtsc();
+    double seconds = prev_tsc ? (double)(now - prev_tsc) / rte_get_tsc_hz() : 0;
+    prev_tsc = now;
+
+    setlocale(LC_NUMERIC, "");
+    for (uint16_t port_id = 0; port_id < MAX_PORTS; port_id++) {
+        if (ports[port_id].nb_queues == 0)
+            continue;
+
+        struct rte_eth_stats eth_stats;
+        rte_eth_stats_get(port_id, &eth_stats);
+        printf("Total number of packets for port %u: send %'lu packets (%'lu bytes), "
+            "received %'lu packets (%'lu bytes), dropped rx %'lu, ierrors %'lu, rx_nombuf %'lu, q_ipackets %'lu\n",
+            port_id, eth_stats.opackets, eth_stats.obytes, eth_stats.ipackets, eth_stats.ibytes, eth_stats.imissed,
+            eth_stats.ierrors, eth_stats.rx_nombuf, eth_stats.q_ipackets[0]);
+
+        for (uint16_t q = 0; q < ports[port_id].nb_queues; q++) {
+            uint16_t core = ports[port_id].cores[q];
+            uint64_t sent = workers[core].sent_packets;
+            if (seconds > 0)
+                printf("    Core %u (queue %u): %'.0f packets/s, %'lu packets not taken by the full TX queue\n", core,
+                    q, (sent - prev_sent_packets[core]) / seconds, workers[core].tx_full);
+            if (seconds > 0)
+                achieved += pacing.bits ? (workers[core].sent_wire_bytes - prev_sent_wire_bytes[core]) * 8 / seconds
+                    : (sent - prev_sent_packets[core]) / seconds;
+            prev_sent_packets[core] = sent;
+            prev_sent_wire_bytes[core] = workers[core].sent_wire_bytes;
+        }
+    }
+
+    if (pacing.enabled && seconds > 0) {
+        double target = pacing_rate_at(now);
+        printf("Pacing: target %'.0f %s, achieved %'.0f (%+.2f%%)\n", target, pacing.bits ? "bit/s" : "packets/s",
+            achieved, target > 0 ? (achieved - target) / target * 100 : 0);
+    }
+
+    if (tx_args.animation) {
+        uint64_t shown = __atomic_load_n(&animation.shown, __ATOMIC_RELAXED);
+        printf("Showing frame %'lu of the animation (%u pixels changed), %lu frames decoded ahead%s\n", shown,
+            animation.slots[shown % FRAME_SLOTS].nb_changed,
+            __atomic_load_n(&animation.decoded, __ATOMIC_RELAXED) - shown - 1,
+            animation.end_of_stream ? ", end of stream reached" : "");
+    }
+}
+
+// Maximum size of the packets we send
+static uint16_t max_packet_size(void) {
+    uint16_t pkt_size;
+    if (!tx_args.use_pingxelflut) {
+        // Multi-pixel packets might be smaller in case the next pixel is outside of the shard, this is the maximum
+        pkt_size = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_udp_hdr)
+            + tx_args.multi_pixel * MULTI_PIXEL_TUPLE_SIZE;
+    } else {
+        // 8 bytes for command, x, y, r, g and b (note we don't send a [alpha])
+        pkt_size = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 8;
+    }
+    // The minimum packet size sent/received through Ethernet is always 64 bytes according to Ethernet specification
+    return MAX(64, pkt_size);
+}
 
+// Builds the packet for the pixel at the cursor (plus the following ones for multi-pixel packets) and moves the cursor
+// to the next pixel. Returns the number of pixels in the packet.
+static inline uint16_t build_packet(struct rte_mbuf *pkt, struct pixel_cursor *cursor, int width) {
+    struct tx_args *args = &tx_args;
+    const uint32_t *pixels = cursor->pixels;
     struct rte_ether_hdr *eth_hdr;
     struct rte_ipv6_hdr *ipv6_hdr;
     struct rte_udp_hdr *udp_hdr;
     struct rte_icmp_hdr *icmp_hdr;
+    uint16_t pkt_size = max_packet_size();
+    uint16_t tuples = 0;
+    uint8_t *tuple;
+    int pixel_index;
+
+    eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr*);
+    eth_hdr->dst_addr = args->dst_mac_addr;
+    eth_hdr->src_addr = args->src_mac_addr;
+    eth_hdr->ether_type = htons(RTE_ETHER_TYPE_IPV6);
+    ipv6_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv6_hdr*, sizeof(struct rte_ether_hdr));
 
-    uint16_t pkt_size;
     if (!args->use_pingxelflut) {
-        pkt_size = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_udp_hdr);
+        ipv6_hdr->vtc_flow = htonl(6 << 28); // IP version 6
+        ipv6_hdr->hop_limits = 0xff;
+        ipv6_hdr->proto = 0x11; // UDP
+        ipv6_hdr->payload_len = htonl(8); // TODO: Can we set this to sizeof(struct rte_udp_hdr)?
+
+        // Set the whole source IP (128 bit - 16 bytes)
+        memcpy(ipv6_hdr->src_addr, &args->src_addr, 16);
+        // We only set the /64 network, hence the first 8 bytes
+        memcpy(ipv6_hdr->dst_addr, &args->dst_net, 8);
+
+        // X Coordinate
+        ipv6_hdr->dst_addr[8] = cursor->x >> 8;
+        ipv6_hdr->dst_addr[9] = cursor->x;
+
+        // Y Coordinate
+        ipv6_hdr->dst_addr[10] = cursor->y >> 8;
+        ipv6_hdr->dst_addr[11] = cursor->y;
+
+        // Color in rgb
+        pixel_index = cursor->index;
+        ipv6_hdr->dst_addr[12] = pixels[pixel_index] >> 0;
+        ipv6_hdr->dst_addr[13] = pixels[pixel_index] >> 8;
+        ipv6_hdr->dst_addr[14] = pixels[pixel_index] >> 16;
+        ipv6_hdr->dst_addr[15] = pixels[pixel_index] >> 24;
+
+        udp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_udp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr));
+        udp_hdr->src_port = htons(1337);
+        udp_hdr->src_port = htons(1234);
+        udp_hdr->dgram_len = 0;
+        // This seems to be fine. Either the hardware offloading of the NIC takes care of this or I currently don't
+        // notice any problems, as I'm only sending NIC -> NIC and nothing is actually checking the checksum.
+        // Hopefully routers only care about the IP header and leave checking the UDP header to the receiving
+        // application or kernel.
+        udp_hdr->dgram_cksum = 0;
+
+        if (args->multi_pixel > 0) {
+            // Append the following pixels of the slice as long as they stay within the shard of the first one
+            uint32_t shard = ((uint32_t)cursor->x << 16 | cursor->y) & args->shard_mask;
+            struct pixel_cursor next = *cursor;
+            tuple = (uint8_t*)(udp_hdr + 1);
+            for (tuples = 0; tuples < args->multi_pixel; tuples++, tuple += MULTI_PIXEL_TUPLE_SIZE) {
+                next_pixel(&next, width);
+                if ((((uint32_t)next.x << 16 | next.y) & args->shard_mask) != shard)
+                    break;
+
+                *cursor = next;
+                pixel_index = cursor->index;
+                tuple[0] = cursor->x >> 8;
+                tuple[1] = cursor->x;
+                tuple[2] = cursor->y >> 8;
+                tuple[3] = cursor->y;
+                tuple[4] = pixels[pixel_index] >> 0;
+                tuple[5] = pixels[pixel_index] >> 8;
+                tuple[6] = pixels[pixel_index] >> 16;
+            }
+
+            udp_hdr->dst_port = htons(PIXELFLUT_V6_MULTI_PIXEL_PORT);
+            udp_hdr->dgram_len = htons(sizeof(struct rte_udp_hdr) + tuples * MULTI_PIXEL_TUPLE_SIZE);
+            ipv6_hdr->payload_len = udp_hdr->dgram_len;
+            pkt_size = MAX(64, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + ntohs(udp_hdr->dgram_len));
+        }
     } else {
-        // 8 bytes for command, x, y, r, g and b (note we don't send a [alpha])
-        pkt_size = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 8;
+        ipv6_hdr->vtc_flow = htonl(6 << 28); // IP version 6
+        ipv6_hdr->hop_limits = 0xff;
+        ipv6_hdr->proto = 58; // ICMPv6
+        ipv6_hdr->payload_len = htonl(sizeof(struct rte_icmp_hdr) + 8); // 8 bytes for command, x, y, r, g and b (note we don't send a [alpha])
+
+        memcpy(ipv6_hdr->src_addr, &args->src_addr, sizeof(struct in6_addr));
+        memcpy(ipv6_hdr->dst_addr, &args->pingxelflut_target, sizeof(struct in6_addr));
+
+        icmp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_icmp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr));
+        icmp_hdr->icmp_type = 128; // ICMPv6 echo request, RTE_IP_ICMP_ECHO_REQUEST (8) is the ICMPv4 one
+        icmp_hdr->icmp_code = 0;
+        // Let's see how it goes
+        icmp_hdr->icmp_cksum = 0;
+        // Set message type to command to set pixel
+        *rte_pktmbuf_mtod_offset(pkt, uint8_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr)) = 0xcc;
+        *rte_pktmbuf_mtod_offset(pkt, uint16_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 1) = htons(cursor->x);
+        *rte_pktmbuf_mtod_offset(pkt, uint16_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 3) = htons(cursor->y);
+
+        pixel_index = cursor->index;
+        // Please note that we write 4 bytes, but we only use 3 bytes for the packet, the last byte should just
+        // write into the buffer, but not get send over the network
+        *rte_pktmbuf_mtod_offset(pkt, uint32_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 5) = pixels[pixel_index];
     }
-    // The minimum packet size sent/received through Ethernet is always 64 bytes according to Ethernet specification
-    pkt_size = MAX(64, pkt_size);
 
-    uint16_t x = 0;
-    uint16_t y = 0;
-    int pixel_index = 0;
+    pkt->data_len = pkt_size;
+    pkt->pkt_len = pkt_size;
 
-    printf("\nCore %u sending %u byte packets on port %u. [Ctrl+C to quit]\n", rte_lcore_id(), pkt_size, port_id);
+    next_pixel(cursor, width);
+    return 1 + tuples;
+}
 
-    struct rte_mbuf * pkt[BURST_SIZE];
-    int i;
+// Offsets of the first pixel and the additional pixels of multi-pixel packets within our packets
+static void packet_layout(uint16_t *header_len, uint16_t *pixel_offset) {
+    if (!tx_args.use_pingxelflut) {
+        *header_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_udp_hdr);
+        // The last 8 bytes of the destination address
+        *pixel_offset = sizeof(struct rte_ether_hdr) + offsetof(struct rte_ipv6_hdr, dst_addr) + 8;
+    } else {
+        // After the command byte
+        *header_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 1;
+        *pixel_offset = *header_len;
+    }
+}
+
+// Copies the next packet of the packet stream into pkt, which does the same as build_packet without looking at any
+// pixel. Returns the number of pixels in the packet.
+static inline uint16_t build_stream_packet(struct rte_mbuf *pkt, struct stream_cursor *stream) {
+    const uint8_t *record = stream->record;
+    uint8_t nb_tuples = record[0];
+    uint8_t *data = rte_pktmbuf_mtod(pkt, uint8_t*);
+    uint16_t pkt_size = max_packet_size();
+
+    memcpy(data, tx_args.header_template, tx_args.header_len);
+    memcpy(data + tx_args.pixel_offset, record + 1, PACKET_STREAM_PIXEL_SIZE);
+    if (tx_args.multi_pixel > 0) {
+        uint16_t payload_len = sizeof(struct rte_udp_hdr) + nb_tuples * MULTI_PIXEL_TUPLE_SIZE;
+        memcpy(data + tx_args.header_len, record + 1 + PACKET_STREAM_PIXEL_SIZE, nb_tuples * MULTI_PIXEL_TUPLE_SIZE);
+
+        struct rte_ipv6_hdr *ipv6_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv6_hdr*, sizeof(struct rte_ether_hdr));
+        struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr*)(ipv6_hdr + 1);
+        udp_hdr->dgram_len = htons(payload_len);
+        ipv6_hdr->payload_len = udp_hdr->dgram_len;
+        pkt_size = MAX(64, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + payload_len);
+    }
+
+    pkt->data_len = pkt_size;
+    pkt->pkt_len = pkt_size;
+
+    stream->record = record + 1 + PACKET_STREAM_PIXEL_SIZE + nb_tuples * MULTI_PIXEL_TUPLE_SIZE;
+    if (unlikely(stream->record >= stream->end))
+        stream->record = stream->first;
+    return 1 + nb_tuples;
+}
+
+// The headers of all packets of a packet stream are the same (except for the lengths of multi-pixel packets, which
+// build_stream_packet sets anyway), so we build them once
+static void init_header_template(struct rte_mempool *pool) {
+    uint32_t pixel = 0;
+    struct pixel_cursor cursor;
+    cursor_init(&cursor, 0, 1, &pixel, NULL, 1);
+
+    struct rte_mbuf *scratch = rte_pktmbuf_alloc(pool);
+    if (scratch == NULL)
+        rte_exit(EXIT_FAILURE, "Failed to allocate a mbuf for the header template\n");
+    build_packet(scratch, &cursor, 1);
+    packet_layout(&tx_args.header_len, &tx_args.pixel_offset);
+    memcpy(tx_args.header_template, rte_pktmbuf_mtod(scratch, uint8_t*), tx_args.header_len);
+    rte_pktmbuf_free(scratch);
+}
+
+// Writes all packets of the image (as build_packet would send them) into a packet stream file
+static void compile_packet_stream(const char *file_name, enum emission_order order, struct rte_mempool *pool) {
+    struct fluter_image *image = tx_args.fluter_image;
+    uint32_t nb_pixels = image->width * image->height;
+    uint16_t header_len, pixel_offset;
+    packet_layout(&header_len, &pixel_offset);
+
+    struct packet_stream_header header = {
+        .width = image->width,
+        .height = image->height,
+        .multi_pixel = tx_args.multi_pixel,
+        .order = order,
+        .shard_mask = tx_args.shard_mask,
+    };
+    struct packet_stream_writer writer;
+    int err = packet_stream_writer_open(&writer, file_name, &header);
+    if (err)
+        rte_exit(EXIT_FAILURE, "Failed to open %s: %s\n", file_name, strerror(-err));
+
+    struct rte_mbuf *scratch = rte_pktmbuf_alloc(pool);
+    if (scratch == NULL)
+        rte_exit(EXIT_FAILURE, "Failed to allocate a mbuf to compile the packets\n");
+    const uint8_t *data = rte_pktmbuf_mtod(scratch, uint8_t*);
+
+    struct pixel_cursor cursor;
+    cursor_init(&cursor, 0, nb_pixels, image->pixels, tx_args.order, image->width);
+    for (uint32_t pixels = 0; pixels < nb_pixels;) {
+        uint16_t nb = build_packet(scratch, &cursor, image->width);
+        // The last packet might wrap around to the first pixels, we don't need them
+        nb = RTE_MIN(nb, nb_pixels - pixels);
+        if ((err = packet_stream_append(&writer, data + pixel_offset, data + header_len, nb - 1,
+                MULTI_PIXEL_TUPLE_SIZE)))
+            rte_exit(EXIT_FAILURE, "Failed to write %s: %s\n", file_name, strerror(-err));
+        pixels += nb;
+    }
+    rte_pktmbuf_free(scratch);
+
+    if ((err = packet_stream_writer_close(&writer)))
+        rte_exit(EXIT_FAILURE, "Failed to write %s: %s\n", file_name, strerror(-err));
+    printf("Compiled %lu pixels into %lu packets in %s order (%lu KiB) into %s\n", writer.header.nb_pixels,
+        writer.header.nb_packets, emission_order_name(order), writer.header.index_offset / 1024, file_name);
+}
+
+struct stats_timer {
+    uint32_t loop_counter;
+    struct timeval last_report;
+};
+
+// Only called on the main lcore in case it is sending as well
+static inline void maybe_print_stats(struct stats_timer *timer) {
+    struct timeval now;
+    long elapsed_millis;
+
+    // I assume reading the system time is a expensive operation, so let's not do that every loop...
+    timer->loop_counter++;
+    if (likely(timer->loop_counter <= 10000))
+        return;
+    timer->loop_counter = 0;
+
+    gettimeofday(&now, NULL);
+    elapsed_millis = (now.tv_sec - timer->last_report.tv_sec) * 1000.0;
+    elapsed_millis += (now.tv_usec - timer->last_report.tv_usec) / 1000.0;
+
+    if (elapsed_millis >= STATS_INTERVAL_MS) {
+        timer->last_report = now;
+        print_stats();
+    }
+}
+
+// Parses e.g. 10M (packets/s) or 40Gbit (bits/s)
+static double parse_rate(const char *str, bool *bits) {
+    char *end;
+    double rate = strtod(str, &end);
+    switch (*end) {
+        case 'k': case 'K': rate *= 1e3; end++; break;
+        case 'M': rate *= 1e6; end++; break;
+        case 'G': rate *= 1e9; end++; break;
+    }
+    *bits = strncmp(end, "bit", 3) == 0;
+    if (*bits)
+        end += 3;
+    if (end == str || rate < 0 || (*end != '\0' && *end != ':' && *end != ','))
+        rte_exit(EXIT_FAILURE, "Invalid rate %s\n", str);
+    return rate;
+}
+
+static void parse_pacing(const char *rate, const char *ramp) {
+    bool bits;
+    if (rate) {
+        pacing.rates[0] = parse_rate(rate, &pacing.bits);
+        pacing.seconds[0] = 0;
+        pacing.nb_steps = 1;
+    }
+    if (ramp) {
+        if (rate)
+            rte_exit(EXIT_FAILURE, "Please only pass one of --rate or --ramp\n");
+        for (const char *step = ramp; step; step = strchr(step, ',') ? strchr(step, ',') + 1 : NULL) {
+            if (pacing.nb_steps >= MAX_RAMP_STEPS)
+                rte_exit(EXIT_FAILURE, "The ramp can have at most %u steps\n", MAX_RAMP_STEPS);
+            pacing.rates[pacing.nb_steps] = parse_rate(step, &bits);
+            if (pacing.nb_steps > 0 && bits != pacing.bits)
+                rte_exit(EXIT_FAILURE, "All steps of the ramp need to be either packets/s or bits/s\n");
+            pacing.bits = bits;
+            const char *colon = strchr(step, ':');
+            const char *comma = strchr(step, ',');
+            pacing.seconds[pacing.nb_steps] = colon && (!comma || colon < comma) ? strtod(colon + 1, NULL) : 0;
+            pacing.nb_steps++;
+        }
+    }
+    pacing.enabled = pacing.nb_steps > 0;
+}
+
+// Needs to be called right before the TX lcores start, as the steps of the ramp start now
+static void start_pacing(void) {
+    uint64_t tsc = rte_rdtsc();
+    for (uint16_t step = 0; step < pacing.nb_steps; step++) {
+        tsc += pacing.seconds[step] * rte_get_tsc_hz();
+        pacing.step_end_tsc[step] = step + 1 < pacing.nb_steps ? tsc : UINT64_MAX;
+    }
+    for (unsigned core = 0; core < RTE_MAX_LCORE; core++)
+        pacing.nb_workers += workers[core].active;
+
+    printf("Pacing to %s%.0f %s\n", pacing.nb_steps > 1 ? "a ramp starting at " : "", pacing.rates[0],
+        pacing.bits ? "bit/s" : "packets/s");
+}
+
+static void pacer_set_step(struct pacer *p, uint16_t step, uint64_t now) {
+    double rate = pacing.rates[step] / pacing.nb_workers;
+    double packet_rate = pacing.bits ? rate / ((max_packet_size() + ETHER_WIRE_OVERHEAD) * 8) : rate;
+
+    p->step = step;
+    p->step_end_tsc = pacing.step_end_tsc[step];
+    // Sending at a low rate in big bursts would look nothing like the target rate at the receiver
+    p->burst = RTE_MAX(1, (uint16_t)RTE_MIN((double)BURST_SIZE, packet_rate * PACING_BURST_NS / 1e9));
+    if (rate > 0) {
+        p->tsc_per_unit = rte_get_tsc_hz() / rate;
+        p->burst_tsc = p->burst * rte_get_tsc_hz() / packet_rate;
+        p->next_tsc = RTE_MAX(p->next_tsc, now);
+    } else {
+        // Don't send anything until the step ends
+        p->tsc_per_unit = 0;
+        p->burst_tsc = 0;
+        p->next_tsc = p->step_end_tsc;
+    }
+}
+
+static void pacer_init(struct pacer *p) {
+    *p = (struct pacer){0};
+    pacer_set_step(p, 0, rte_rdtsc());
+}
+
+// Waits until the bucket allows the next burst of p->burst packets
+static inline void pacer_wait(struct pacer *p) {
+    uint64_t now = rte_rdtsc();
     for (;;) {
-        for(i = 0; i < BURST_SIZE; i++) {
-            pkt[i] = rte_pktmbuf_alloc(mbuf_pool);
-
-            eth_hdr = rte_pktmbuf_mtod(pkt[i], struct rte_ether_hdr*);
-            eth_hdr->dst_addr = dst_mac_addr;
-            eth_hdr->src_addr = src_mac_addr;
-            eth_hdr->ether_type = htons(RTE_ETHER_TYPE_IPV6);
-            ipv6_hdr = rte_pktmbuf_mtod_offset(pkt[i], struct rte_ipv6_hdr*, sizeof(struct rte_ether_hdr));
-
-            if (!args->use_pingxelflut) {
-                ipv6_hdr->vtc_flow = htonl(6 << 28); // IP version 6
-                ipv6_hdr->hop_limits = 0xff;
-                ipv6_hdr->proto = 0x11; // UDP
-                ipv6_hdr->payload_len = htonl(8); // TODO: Can we set this to sizeof(struct rte_udp_hdr)?
-
-                // Set the whole source IP (128 bit - 16 bytes)
-                memcpy(ipv6_hdr->src_addr, &src_addr, 16);
-                // We only set the /64 network, hence the first 8 bytes
-                memcpy(ipv6_hdr->dst_addr, &dst_net, 8);
-
-                // X Coordinate
-                ipv6_hdr->dst_addr[8] = x >> 8;
-                ipv6_hdr->dst_addr[9] = x;
-
-                // Y Coordinate
-                ipv6_hdr->dst_addr[10] = y >> 8;
-                ipv6_hdr->dst_addr[11] = y;
-
-                // Color in rgb
-                pixel_index = y * width + x;
-                ipv6_hdr->dst_addr[12] = fluter_image->pixels[pixel_index] >> 0;
-                ipv6_hdr->dst_addr[13] = fluter_image->pixels[pixel_index] >> 8;
-                ipv6_hdr->dst_addr[14] = fluter_image->pixels[pixel_index] >> 16;
-                ipv6_hdr->dst_addr[15] = fluter_image->pixels[pixel_index] >> 24;
-
-                udp_hdr = rte_pktmbuf_mtod_offset(pkt[i], struct rte_udp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr));
-                udp_hdr->src_port = htons(1337);
-                udp_hdr->src_port = htons(1234);
-                udp_hdr->dgram_len = 0;
-                // This seems to be fine. Either the hardware offloading of the NIC takes care of this or I currently don't
-                // notice any problems, as I'm only sending NIC -> NIC and nothing is actually checking the checksum.
-                // Hopefully routers only care about the IP header and leave checking the UDP header to the receiving
-                // application or kernel.
-                udp_hdr->dgram_cksum = 0;
-            } else {
-                ipv6_hdr->vtc_flow = htonl(6 << 28); // IP version 6
-                ipv6_hdr->hop_limits = 0xff;
-                ipv6_hdr->proto = 58; // ICMPv6
-                ipv6_hdr->payload_len = htonl(sizeof(struct rte_icmp_hdr) + 8); // 8 bytes for command, x, y, r, g and b (note we don't send a [alpha])
-
-                memcpy(ipv6_hdr->src_addr, &src_addr, sizeof(struct in6_addr));
-                memcpy(ipv6_hdr->dst_addr, &args->pingxelflut_target, sizeof(struct in6_addr));
-
-                icmp_hdr = rte_pktmbuf_mtod_offset(pkt[i], struct rte_icmp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr));
-                // Note: In older (or newer?) DPDK versions the constant was called RTE_ICMP6_ECHO_REQUEST
-                icmp_hdr->icmp_type = RTE_IP_ICMP_ECHO_REQUEST;
-                icmp_hdr->icmp_code = 0;
-                // Let's see how it goes
-                icmp_hdr->icmp_cksum = 0;
-                // Set message type to command to set pixel
-                *rte_pktmbuf_mtod_offset(pkt[i], uint8_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr)) = 0xcc;
-                *rte_pktmbuf_mtod_offset(pkt[i], uint16_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 1) = htons(x);
-                *rte_pktmbuf_mtod_offset(pkt[i], uint16_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 3) = htons(y);
-
-                pixel_index = y * width + x;
-                // Please note that we write 4 bytes, but we only use 3 bytes for the packet, the last byte should just
-                // write into the buffer, but not get send over the network
-                *rte_pktmbuf_mtod_offset(pkt[i], uint32_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 5) = fluter_image->pixels[pixel_index];
-            }
+        if (unlikely(now >= p->step_end_tsc))
+            pacer_set_step(p, p->step + 1, now);
+        if (now >= p->next_tsc)
+            break;
+        rte_pause();
+        now = rte_rdtsc();
+    }
+    // Don't save up for more than a burst, e.g. while the TX queue was full
+    if (now - p->next_tsc > p->burst_tsc)
+        p->next_tsc = now - p->burst_tsc;
+}
 
-            pkt[i]->data_len = pkt_size;
-            pkt[i]->pkt_len = pkt_size;
+// wire_bytes already contain the ETHER_WIRE_OVERHEAD
+static inline void pacer_charge(struct tx_worker *worker, uint16_t packets, uint64_t wire_bytes) {
+    struct pacer *p = &worker->pacer;
+    p->next_tsc += (pacing.bits ? wire_bytes * 8 : packets) * p->tsc_per_unit;
+    worker->sent_wire_bytes += wire_bytes;
+}
 
-            x++;
-            if (x >= width) {
-                x = 0;
-                y++;
-                if (y >= height) {
-                    y = 0;
-                }
-            }
+// Builds every packet while sending it. paced is constant for both instances, so the pacing costs nothing when disabled.
+// The same goes for from_stream, which copies the packets from the packet stream instead of building them.
+static __rte_always_inline void tx_loop_impl(struct tx_worker *worker, struct pixel_cursor *cursor,
+    struct stream_cursor *stream, int width, bool print, const bool paced, const bool from_stream) {
+    struct stats_timer timer = {0};
+    gettimeofday(&timer.last_report, NULL);
+
+    struct rte_mbuf *pkt[BURST_SIZE];
+    // Sizes on the wire, only needed when pacing, as we can't touch the packets after the NIC took them
+    uint64_t wire_bytes[BURST_SIZE + 1] = {0};
+    uint16_t burst = BURST_SIZE;
+    uint16_t nb_tx;
+    int i;
+    if (paced)
+        pacer_init(&worker->pacer);
+    for (;;) {
+        if (paced) {
+            pacer_wait(&worker->pacer);
+            burst = worker->pacer.burst;
+        }
+        if (unlikely(rte_pktmbuf_alloc_bulk(worker->mbuf_pool, pkt, burst) != 0))
+            continue;
+
+        for (i = 0; i < burst; i++) {
+            if (from_stream)
+                build_stream_packet(pkt[i], stream);
+            else
+                build_packet(pkt[i], cursor, width);
+            if (paced)
+                wire_bytes[i + 1] = wire_bytes[i] + pkt[i]->pkt_len + ETHER_WIRE_OVERHEAD;
         }
 
         do {
-            nb_tx = rte_eth_tx_burst(port_id, /* queue_id */ 0, pkt, BURST_SIZE);
-        } while(nb_tx == 0);
+            nb_tx = rte_eth_tx_burst(worker->port, worker->queue, pkt, burst);
+        } while (nb_tx == 0);
+        worker->sent_packets += nb_tx;
+        if (paced)
+            pacer_charge(worker, nb_tx, wire_bytes[nb_tx]);
+
+        // The NIC owns (and frees) the packets it took, we only need to take care of the rest
+        if (unlikely(nb_tx < burst)) {
+            worker->tx_full += burst - nb_tx;
+            rte_pktmbuf_free_bulk(&pkt[nb_tx], burst - nb_tx);
+        }
+
+        if (print)
+            maybe_print_stats(&timer);
+    }
+}
+
+static void tx_loop(struct tx_worker *worker, struct pixel_cursor *cursor, struct stream_cursor *stream, int width,
+    bool print) {
+    if (pacing.enabled && tx_args.stream)
+        tx_loop_impl(worker, cursor, stream, width, print, true, true);
+    else if (pacing.enabled)
+        tx_loop_impl(worker, cursor, stream, width, print, true, false);
+    else if (tx_args.stream)
+        tx_loop_impl(worker, cursor, stream, width, print, false, true);
+    else
+        tx_loop_impl(worker, cursor, stream, width, print, false, false);
+}
 
+// Renders every packet of the slice once, afterwards we only hand the same mbufs to the NIC over and over again. Every
+// mbuf gets an additional reference before it is sent, which the NIC drops once it is done with it, so that the mbuf
+// never goes back to the pool.
+static __rte_always_inline void tx_loop_prerendered_impl(struct tx_worker *worker, struct pixel_cursor *cursor,
+    struct stream_cursor *stream, int width, bool print, const bool paced) {
+    uint32_t slice_pixels = worker->end_pixel - worker->first_pixel;
+    uint16_t pkt_size = max_packet_size();
+    uint32_t pixels;
+
+    // Multi-pixel packets hold a varying number of pixels (depending on the shards), so render the slice once into a
+    // scratch mbuf to find out how many packets we need. Packet streams know it already.
+    uint32_t nb_packets = 0;
+    if (tx_args.stream) {
+        nb_packets = worker->stream_packets;
+    } else {
+        struct pixel_cursor count_cursor = *cursor;
+        struct rte_mbuf *scratch = rte_pktmbuf_alloc(worker->mbuf_pool);
+        if (scratch == NULL)
+            rte_exit(EXIT_FAILURE, "Core %u failed to allocate a mbuf\n", rte_lcore_id());
+        for (pixels = 0; pixels < slice_pixels; nb_packets++)
+            pixels += build_packet(scratch, &count_cursor, width);
+        rte_pktmbuf_free(scratch);
+    }
+
+    char pool_name[RTE_MEMPOOL_NAMESIZE];
+    snprintf(pool_name, sizeof(pool_name), "PRERENDER_%u", rte_lcore_id());
+    struct rte_mempool *pool = rte_pktmbuf_pool_create(pool_name, nb_packets, 0, 0,
+        RTE_PKTMBUF_HEADROOM + pkt_size, rte_socket_id());
+    struct rte_mbuf **packets = rte_malloc(NULL, nb_packets * sizeof(struct rte_mbuf*), 0);
+    if (pool == NULL || packets == NULL || rte_pktmbuf_alloc_bulk(pool, packets, nb_packets) != 0)
+        rte_exit(EXIT_FAILURE, "Core %u failed to allocate %u mbufs of %u bytes to prerender its packets\n",
+            rte_lcore_id(), nb_packets, pkt_size);
+
+    for (uint32_t i = 0; i < nb_packets; i++) {
+        if (tx_args.stream)
+            build_stream_packet(packets[i], stream);
+        else
+            build_packet(packets[i], cursor, width);
+    }
+    printf("Core %u prerendered %u packets\n", rte_lcore_id(), nb_packets);
 
-        if (unlikely(nb_tx < BURST_SIZE)) {
-            printf("ERROR: Couldn't send %u packets.\n", BURST_SIZE - nb_tx);
-            uint16_t buf;
+    struct stats_timer timer = {0};
+    gettimeofday(&timer.last_report, NULL);
+
+    uint32_t next = 0;
+    uint16_t nb_tx, i;
+    uint16_t max_burst = BURST_SIZE;
+    struct rte_mbuf *burst[BURST_SIZE];
+    if (paced)
+        pacer_init(&worker->pacer);
+    for (;;) {
+        if (paced) {
+            pacer_wait(&worker->pacer);
+            max_burst = worker->pacer.burst;
+        }
+        uint16_t nb_burst = RTE_MIN(max_burst, nb_packets - next);
+        for (i = 0; i < nb_burst; i++) {
+            burst[i] = packets[next + i];
+            rte_mbuf_refcnt_update(burst[i], 1);
+        }
 
-            for (buf = nb_tx; buf < BURST_SIZE; buf++)
-                rte_pktmbuf_free(pkt[buf]);
+        nb_tx = rte_eth_tx_burst(worker->port, worker->queue, burst, nb_burst);
+        worker->sent_packets += nb_tx;
+        if (paced) {
+            // We still hold a reference to the sent packets, so we can look at them
+            uint64_t wire_bytes = 0;
+            for (i = 0; i < nb_tx; i++)
+                wire_bytes += burst[i]->pkt_len + ETHER_WIRE_OVERHEAD;
+            pacer_charge(worker, nb_tx, wire_bytes);
         }
 
-        for(i = 0; i < BURST_SIZE; i++) {
-            rte_pktmbuf_free(pkt[i]);
+        // Give back the references of the packets the NIC did not take, we send them with the next burst
+        if (unlikely(nb_tx < nb_burst)) {
+            worker->tx_full += nb_burst - nb_tx;
+            for (i = nb_tx; i < nb_burst; i++)
+                rte_mbuf_refcnt_update(burst[i], -1);
         }
 
-        // I assume reading the system time is a expensive operation, so let's not do that every loop...
-        stats_loop_counter++;
-        if (unlikely(stats_loop_counter > 10000)) {
-            stats_loop_counter = 0;
-
-            gettimeofday(&now, NULL);
-            elapsed_millis = (now.tv_sec - last_stats_report.tv_sec) * 1000.0;
-            elapsed_millis += (now.tv_usec - last_stats_report.tv_usec) / 1000.0;
-
-            if (elapsed_millis >= STATS_INTERVAL_MS) {
-                last_stats_report = now;
-
-                struct rte_eth_stats eth_stats;
-                rte_eth_stats_get(port_id, &eth_stats);
-                setlocale(LC_NUMERIC, "");
-                printf("Total number of packets for port %u: send %'lu packets (%'lu bytes), "
-                    "received %'lu packets (%'lu bytes), dropped rx %'lu, ierrors %'lu, rx_nombuf %'lu, q_ipackets %'lu\n",
-                    port_id, eth_stats.opackets, eth_stats.obytes, eth_stats.ipackets, eth_stats.ibytes, eth_stats.imissed,
-                    eth_stats.ierrors, eth_stats.rx_nombuf, eth_stats.q_ipackets[0]);
+        next += nb_tx;
+        if (next == nb_packets)
+            next = 0;
+
+        if (print)
+            maybe_print_stats(&timer);
+    }
+}
+
+static void tx_loop_prerendered(struct tx_worker *worker, struct pixel_cursor *cursor, struct stream_cursor *stream,
+    int width, bool print) {
+    if (pacing.enabled)
+        tx_loop_prerendered_impl(worker, cursor, stream, width, print, true);
+    else
+        tx_loop_prerendered_impl(worker, cursor, stream, width, print, false);
+}
+
+// Sends the next nb_pixels pixels of the cursor. Unlike the endless loops above every packet matters here, so packets
+// the NIC didn't take are retried.
+static void send_pixels(struct tx_worker *worker, struct pixel_cursor *cursor, int width, uint32_t nb_pixels) {
+    struct rte_mbuf *pkt[BURST_SIZE];
+    uint16_t nb_pkts, nb_tx, sent;
+    uint16_t burst = BURST_SIZE;
+    uint64_t wire_bytes = 0;
+
+    while (nb_pixels > 0) {
+        // Animations only send in between idling, so checking whether to pace doesn't matter here
+        if (pacing.enabled) {
+            pacer_wait(&worker->pacer);
+            burst = worker->pacer.burst;
+        }
+        if (unlikely(rte_pktmbuf_alloc_bulk(worker->mbuf_pool, pkt, burst) != 0))
+            continue;
+
+        for (nb_pkts = 0; nb_pkts < burst && nb_pixels > 0; nb_pkts++) {
+            uint16_t pixels = build_packet(pkt[nb_pkts], cursor, width);
+            nb_pixels -= RTE_MIN(nb_pixels, pixels);
+            wire_bytes += pkt[nb_pkts]->pkt_len + ETHER_WIRE_OVERHEAD;
+        }
+        if (nb_pkts < burst)
+            rte_pktmbuf_free_bulk(&pkt[nb_pkts], burst - nb_pkts);
+
+        for (nb_tx = 0; nb_tx < nb_pkts; nb_tx += sent) {
+            sent = rte_eth_tx_burst(worker->port, worker->queue, &pkt[nb_tx], nb_pkts - nb_tx);
+            worker->tx_full += nb_pkts - nb_tx - sent;
+        }
+        worker->sent_packets += nb_pkts;
+        if (pacing.enabled)
+            pacer_charge(worker, nb_pkts, wire_bytes);
+        wire_bytes = 0;
+    }
+}
+
+// Index of the first element in sorted that is not smaller than value
+static uint32_t lower_bound(const uint32_t *sorted, uint32_t n, uint32_t value) {
+    uint32_t low = 0, high = n;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (sorted[mid] < value)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Sends the whole slice of the lcore
+static void send_slice(struct tx_worker *worker, const uint32_t *pixels, int width) {
+    struct pixel_cursor cursor;
+    cursor_init(&cursor, worker->first_pixel, worker->end_pixel, pixels, NULL, width);
+    send_pixels(worker, &cursor, width, worker->end_pixel - worker->first_pixel);
+}
+
+// Sends the pixels of the slice that changed in the given frame, using the colors of a (possibly newer) frame
+static void send_changed(struct tx_worker *worker, const struct frame_slot *slot, const uint32_t *pixels, int width) {
+    uint32_t first = lower_bound(slot->changed, slot->nb_changed, worker->first_pixel);
+    uint32_t end = lower_bound(slot->changed, slot->nb_changed, worker->end_pixel);
+    if (first == end)
+        return;
+
+    struct pixel_cursor cursor;
+    cursor_init(&cursor, first, end, pixels, slot->changed, width);
+    send_pixels(worker, &cursor, width, end - first);
+}
+
+// Sends the pixels that changed whenever the decode lcore shows the next frame of the animation and idles otherwise
+static void tx_loop_animation(struct tx_worker *worker, int width, bool print) {
+    struct stats_timer timer = {0};
+    gettimeofday(&timer.last_report, NULL);
+    if (pacing.enabled)
+        pacer_init(&worker->pacer);
+
+    uint64_t sent_frame = 0;
+    uint64_t last_full_refresh = 0;
+    bool first = true;
+    for (;;) {
+        uint64_t shown = __atomic_load_n(&animation.shown, __ATOMIC_ACQUIRE);
+        const uint32_t *pixels = animation.slots[shown % FRAME_SLOTS].pixels;
+        uint64_t now = rte_rdtsc();
+
+        if (unlikely(first) || (animation.full_refresh_tsc > 0 && now - last_full_refresh >= animation.full_refresh_tsc)) {
+            // We only read the shown frame, so the decode lcore can reuse all slots before it
+            __atomic_store_n(&worker->frame, shown, __ATOMIC_RELEASE);
+            send_slice(worker, pixels, width);
+            last_full_refresh = now;
+            sent_frame = shown;
+            first = false;
+        } else if (shown != sent_frame) {
+            // In case we were too slow and the decode lcore showed multiple frames in the meantime, we send the
+            // changes of all of them, but with the colors of the newest one
+            __atomic_store_n(&worker->frame, sent_frame + 1, __ATOMIC_RELEASE);
+            for (uint64_t frame = sent_frame + 1; frame <= shown; frame++)
+                send_changed(worker, &animation.slots[frame % FRAME_SLOTS], pixels, width);
+            __atomic_store_n(&worker->frame, shown, __ATOMIC_RELEASE);
+            sent_frame = shown;
+        } else {
+            rte_pause();
+        }
+
+        if (print)
+            maybe_print_stats(&timer);
+    }
+}
+
+// Oldest frame any TX lcore still reads
+static uint64_t oldest_frame_in_use(void) {
+    uint64_t oldest = UINT64_MAX;
+    for (unsigned core = 0; core < RTE_MAX_LCORE; core++)
+        if (workers[core].active)
+            oldest = RTE_MIN(oldest, __atomic_load_n(&workers[core].frame, __ATOMIC_ACQUIRE));
+    return oldest;
+}
+
+// Decodes the next frame into its slot and collects the pixels that differ from the previous frame. Returns false at
+// the end of the stream.
+static bool decode_frame(uint32_t nb_pixels) {
+    uint64_t n = animation.decoded;
+    struct frame_slot *slot = &animation.slots[n % FRAME_SLOTS];
+
+    int ret = read_frame(animation.source, slot->pixels, &slot->delay_ms);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "Failed to decode frame %lu: %s\n", n, strerror(-ret));
+    if (ret == 0)
+        return false;
+
+    if (animation.fixed_delay_ms > 0)
+        slot->delay_ms = animation.fixed_delay_ms;
+    else if (slot->delay_ms == 0)
+        slot->delay_ms = DEFAULT_FRAME_DELAY_MS;
+
+    slot->nb_changed = 0;
+    if (n > 0) {
+        const uint32_t *prev = animation.slots[(n - 1) % FRAME_SLOTS].pixels;
+        const uint32_t *cur = slot->pixels;
+        uint32_t i = 0;
+        // Animations usually only change a small part of the screen, so compare two pixels at once. Alpha is not sent,
+        // so we don't care about it.
+        for (; i + 1 < nb_pixels; i += 2) {
+            uint64_t a, b;
+            memcpy(&a, &cur[i], sizeof(a));
+            memcpy(&b, &prev[i], sizeof(b));
+            if (likely(((a ^ b) & 0x00ffffff00ffffff) == 0))
+                continue;
+            if ((cur[i] ^ prev[i]) & 0x00ffffff)
+                slot->changed[slot->nb_changed++] = i;
+            if ((cur[i + 1] ^ prev[i + 1]) & 0x00ffffff)
+                slot->changed[slot->nb_changed++] = i + 1;
+        }
+        if (i < nb_pixels && ((cur[i] ^ prev[i]) & 0x00ffffff))
+            slot->changed[slot->nb_changed++] = i;
+    }
+
+    __atomic_store_n(&animation.decoded, n + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Decodes the frames of the animation ahead (as long as there are free slots) and advances the shown frame once the
+// current one was shown for its delay
+static int decode_main(__rte_unused void *arg) {
+    uint32_t nb_pixels = animation.source->width * animation.source->height;
+    uint64_t tsc_per_ms = rte_get_tsc_hz() / 1000;
+    bool print = rte_lcore_id() == rte_get_main_lcore();
+    struct stats_timer timer = {0};
+    gettimeofday(&timer.last_report, NULL);
+
+    printf("Core %u decoding the frames of the animation\n", rte_lcore_id());
+
+    uint64_t next_frame_tsc = rte_rdtsc() + animation.slots[0].delay_ms * tsc_per_ms;
+    for (;;) {
+        bool idle = true;
+        if (!animation.end_of_stream && animation.decoded < oldest_frame_in_use() + FRAME_SLOTS) {
+            if (!decode_frame(nb_pixels)) {
+                printf("Reached the end of the stream after %lu frames\n", animation.decoded);
+                animation.end_of_stream = true;
             }
+            idle = false;
+        }
+
+        uint64_t now = rte_rdtsc();
+        if (now >= next_frame_tsc && animation.shown + 1 < animation.decoded) {
+            uint64_t shown = animation.shown + 1;
+            __atomic_store_n(&animation.shown, shown, __ATOMIC_RELEASE);
+
+            // Don't rush through the following frames in case decoding couldn't keep up
+            uint64_t delay = animation.slots[shown % FRAME_SLOTS].delay_ms * tsc_per_ms;
+            if (now - next_frame_tsc > delay)
+                next_frame_tsc = now;
+            next_frame_tsc += delay;
+            idle = false;
         }
+
+        if (idle)
+            rte_pause();
+        if (print)
+            maybe_print_stats(&timer);
     }
+    return 0;
+}
 
-    // Closing and releasing resources
-    // rte_flow_flush(port_id, &error);
-    rte_eth_dev_stop(port_id);
-    rte_eth_dev_close(port_id);
+static void setup_animation(struct arguments *arguments) {
+    uint32_t nb_pixels = animation.source->width * animation.source->height;
+    for (int i = 0; i < FRAME_SLOTS; i++) {
+        animation.slots[i].pixels = rte_malloc(NULL, nb_pixels * sizeof(uint32_t), 0);
+        animation.slots[i].changed = rte_malloc(NULL, nb_pixels * sizeof(uint32_t), 0);
+        if (!animation.slots[i].pixels || !animation.slots[i].changed)
+            rte_exit(EXIT_FAILURE, "Failed to allocate %u frames of the animation\n", FRAME_SLOTS);
+    }
+    animation.fixed_delay_ms = arguments->fps > 0 ? 1000 / arguments->fps : 0;
+    animation.full_refresh_tsc = arguments->full_refresh_ms * (rte_get_tsc_hz() / 1000);
+
+    // The TX lcores need a frame to start with
+    if (!decode_frame(nb_pixels))
+        rte_exit(EXIT_FAILURE, "The animation doesn't contain any frame\n");
+}
+
+static int lcore_main(__rte_unused void *arg) {
+    struct tx_worker *worker = &workers[rte_lcore_id()];
+    int width = tx_args.fluter_image->width;
+    // The main lcore prints the stats in case it is sending as well
+    bool print = rte_lcore_id() == rte_get_main_lcore();
+    uint16_t port;
+
+    /*
+     * Check that the port is on the same NUMA node as the polling thread for best performance.
+     */
+    RTE_ETH_FOREACH_DEV(port)
+        if (rte_eth_dev_socket_id(port) >= 0 && rte_eth_dev_socket_id(port) != (int)rte_socket_id())
+            printf("WARNING, port %u is on remote NUMA node to polling thread.\n"
+                "\tPerformance will not be optimal.\n", port);
+
+    if (tx_args.stream ? worker->stream_first == worker->stream_end : worker->first_pixel == worker->end_pixel) {
+        printf("Core %u has no pixels to send, as there are more lcores than pixels\n", rte_lcore_id());
+        // Don't hold back the decode lcore
+        __atomic_store_n(&worker->frame, UINT64_MAX, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    printf("Core %u sending up to %u byte packets on port %u queue %u. [Ctrl+C to quit]\n", rte_lcore_id(),
+        max_packet_size(), worker->port, worker->queue);
+
+    if (tx_args.animation) {
+        tx_loop_animation(worker, width, print);
+        return 0;
+    }
+
+    struct pixel_cursor cursor = {0};
+    struct stream_cursor stream = {0};
+    if (tx_args.stream)
+        stream = (struct stream_cursor){ .record = worker->stream_first, .first = worker->stream_first,
+            .end = worker->stream_end };
+    else
+        cursor_init(&cursor, worker->first_pixel, worker->end_pixel, tx_args.fluter_image->pixels, tx_args.order,
+            width);
+
+    if (tx_args.prerender)
+        tx_loop_prerendered(worker, &cursor, &stream, width, print);
+    else
+        tx_loop(worker, &cursor, &stream, width, print);
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -380,6 +1399,8 @@ int main(int argc, char *argv[]) {
     struct arguments arguments = {0};
     // Set defaults
     arguments.use_pingxelflut = false;
+    arguments.full_refresh_ms = 1000;
+    arguments.decode_lcore = -1;
     // Parse actual arguments. I think we don't need to check the return code, as the function will error out on wrong
     // arguments(?)
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
@@ -387,45 +1408,171 @@ int main(int argc, char *argv[]) {
     int err = 0;
 
     struct fluter_image* fluter_image;
-    if((err = load_image(&fluter_image, arguments.image_file))) {
+    struct packet_stream *stream = NULL;
+    if (arguments.packet_stream_file) {
+        if ((err = open_packet_stream(&stream, arguments.packet_stream_file))) {
+            fprintf(stderr, "Failed to open packet stream %s: %s\n", arguments.packet_stream_file, strerror(-err));
+            return err;
+        }
+        // The pixels are only part of the packets
+        fluter_image = calloc(1, sizeof(struct fluter_image));
+        fluter_image->width = stream->header->width;
+        fluter_image->height = stream->header->height;
+        printf("Loaded packet stream with %lu packets containing %lu pixels of (%u, %u) in %s order\n",
+            stream->header->nb_packets, stream->header->nb_pixels, fluter_image->width, fluter_image->height,
+            emission_order_name(stream->header->order));
+    } else if (arguments.animation) {
+        if ((err = open_frame_source(&animation.source, arguments.image_file, arguments.frame_width,
+                arguments.frame_height))) {
+            fprintf(stderr, "Failed to load animation from %s: %s\n", arguments.image_file, strerror(-err));
+            return err;
+        }
+        // The pixels of the frames live in the frame slots
+        fluter_image = calloc(1, sizeof(struct fluter_image));
+        fluter_image->width = animation.source->width;
+        fluter_image->height = animation.source->height;
+    } else if((err = load_image(&fluter_image, arguments.image_file))) {
 		fprintf(stderr, "Failed to load image from %s: %s\n", arguments.image_file, strerror(-err));
 		return err;
 	}
 
-    struct rte_mempool *mbuf_pool;
+    tx_args.fluter_image = fluter_image;
+    tx_args.use_pingxelflut = arguments.use_pingxelflut;
+    tx_args.pingxelflut_target = arguments.pingxelflut_target;
+    tx_args.multi_pixel = arguments.use_pingxelflut ? 0 : arguments.multi_pixel;
+    tx_args.shard_mask = arguments.shard_prefix_len <= 64 ? 0 : UINT32_MAX << (96 - arguments.shard_prefix_len);
+    if (stream) {
+        // The packets were compiled using these
+        if (stream->header->multi_pixel > 0 && arguments.use_pingxelflut)
+            rte_exit(EXIT_FAILURE, "The packet stream contains multi-pixel packets, which pingxelflut doesn't support\n");
+        tx_args.multi_pixel = stream->header->multi_pixel;
+        tx_args.shard_mask = stream->header->shard_mask;
+        tx_args.stream = stream;
+    }
+    tx_args.prerender = arguments.prerender;
+    tx_args.animation = arguments.animation;
+    tx_args.dst_mac_addr = parse_mac("14:a0:f8:8b:1e:e4");
+    tx_args.src_mac_addr = parse_mac("14:a0:f8:8b:1e:e3");
+    tx_args.src_addr = parse_ipv6("fe80::1");
+    tx_args.dst_net = parse_ipv6("fe80::");
+    if (arguments.order != ORDER_RASTER && !stream) {
+        // Walking raster order doesn't need a table
+        if ((err = create_emission_order(&tx_args.order, arguments.order, fluter_image->width, fluter_image->height,
+                tx_args.shard_mask)))
+            rte_exit(EXIT_FAILURE, "Failed to create the %s order: %s\n", emission_order_name(arguments.order),
+                strerror(-err));
+        printf("Sending the pixels in %s order\n", emission_order_name(arguments.order));
+    }
+
+    if (arguments.compile_file || stream) {
+        struct rte_mempool *scratch_pool = rte_pktmbuf_pool_create("SCRATCH_POOL", 63, 0, 0,
+            RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+        if (scratch_pool == NULL)
+            rte_exit(EXIT_FAILURE, "Cannot create scratch mbuf pool\n");
+
+        if (arguments.compile_file) {
+            compile_packet_stream(arguments.compile_file, arguments.order, scratch_pool);
+            rte_eal_cleanup();
+            return 0;
+        }
+        init_header_template(scratch_pool);
+    }
+
     unsigned nb_ports;
     uint16_t port_id;
 
     nb_ports = rte_eth_dev_count_avail();
     printf("Detected %u ports\n", nb_ports);
-    if (nb_ports != 1)
-        rte_exit(EXIT_FAILURE, "Error: currently only a single port is supported, you have %d ports\n", nb_ports);
-
-    // Allocates mempool to hold the mbufs
-    mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS * nb_ports,
-        MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
-    if (mbuf_pool == NULL)
-        rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
-
-    // Initializing all ports
-    RTE_ETH_FOREACH_DEV(port_id)
-        if (port_init(port_id, mbuf_pool) != 0)
+    if (nb_ports == 0)
+        rte_exit(EXIT_FAILURE, "Error: no ports found\n");
+
+    unsigned decode_lcore = RTE_MAX_LCORE;
+    if (arguments.animation) {
+        decode_lcore = arguments.decode_lcore >= 0 ? (unsigned)arguments.decode_lcore : rte_get_main_lcore();
+        if (decode_lcore >= RTE_MAX_LCORE || !rte_lcore_is_enabled(decode_lcore))
+            rte_exit(EXIT_FAILURE, "The decode lcore %u is not enabled, add it to the EAL -l argument\n", decode_lcore);
+    }
+
+    if (arguments.port_core_mapping)
+        parse_port_core_map(arguments.port_core_mapping);
+    else
+        map_all_cores_to_port_0(decode_lcore);
+
+    if (decode_lcore < RTE_MAX_LCORE && workers[decode_lcore].active)
+        rte_exit(EXIT_FAILURE, "The decode lcore %u can't send as well\n", decode_lcore);
+    if (ports[0].nb_queues == 0 && !arguments.port_core_mapping)
+        rte_exit(EXIT_FAILURE, "No lcore left to send, add more lcores to the EAL -l argument\n");
+
+    // Initializing all mapped ports. Every port gets its own mempool on its NUMA node, every lcore using it gets its
+    // own cache of the pool.
+    for (port_id = 0; port_id < MAX_PORTS; port_id++) {
+        struct port_config *p = &ports[port_id];
+        if (p->nb_queues == 0)
+            continue;
+
+        char pool_name[RTE_MEMPOOL_NAMESIZE];
+        snprintf(pool_name, sizeof(pool_name), "MBUF_POOL_%u", port_id);
+        p->mbuf_pool = rte_pktmbuf_pool_create(pool_name, NUM_MBUFS * p->nb_queues,
+            MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_eth_dev_socket_id(port_id));
+        if (p->mbuf_pool == NULL)
+            rte_exit(EXIT_FAILURE, "Cannot create mbuf pool for port %u\n", port_id);
+
+        if (port_init(port_id, p->mbuf_pool, p->nb_queues, !arguments.prerender) != 0)
             rte_exit(EXIT_FAILURE, "Cannot init port %"PRIu16 "\n",
                     port_id);
+    }
+
+    if (stream)
+        assign_stream_slices(stream);
+    else
+        assign_image_slices(fluter_image->width * fluter_image->height);
+    if (arguments.animation)
+        setup_animation(&arguments);
+    parse_pacing(arguments.rate, arguments.ramp);
+
+    char src_addr_str[INET6_ADDRSTRLEN];
+    char dst_addr_str[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &tx_args.src_addr, src_addr_str, INET6_ADDRSTRLEN);
+    if (!tx_args.use_pingxelflut) {
+        inet_ntop(AF_INET6, &tx_args.dst_net, dst_addr_str, INET6_ADDRSTRLEN);
+        printf("Using pixelflut v6 protocol to flut from %s to %s/64\n", src_addr_str, dst_addr_str);
+    } else {
+        inet_ntop(AF_INET6, &tx_args.pingxelflut_target, dst_addr_str, INET6_ADDRSTRLEN);
+        printf("Using pingxelflut protocol to flut from %s to %s\n", src_addr_str, dst_addr_str);
+    }
 
-    if (rte_lcore_count() > 1)
-        printf("\nWARNING: Too many lcores enabled. Only 1 used.\n");
+    if (pacing.enabled)
+        start_pacing();
 
-    // Call lcore_main on the main core only. Called on single lcore
-    struct main_thread_args args;
-    args.fluter_image = fluter_image;
-    args.use_pingxelflut = arguments.use_pingxelflut;
-    args.pingxelflut_target = arguments.pingxelflut_target;
-    args.mbuf_pool = mbuf_pool;
-    // FIXME: Currently this only works with a single port
-    args.port_id = 0;
+    unsigned core;
+    RTE_LCORE_FOREACH_WORKER(core) {
+        if (workers[core].active)
+            rte_eal_remote_launch(lcore_main, NULL, core);
+        else if (core == decode_lcore)
+            rte_eal_remote_launch(decode_main, NULL, core);
+    }
 
-    lcore_main(&args);
+    if (workers[rte_get_main_lcore()].active) {
+        lcore_main(NULL);
+    } else if (rte_get_main_lcore() == decode_lcore) {
+        // Prints the stats as well
+        decode_main(NULL);
+    } else {
+        // The main lcore only prints the stats
+        for (;;) {
+            rte_delay_ms(STATS_INTERVAL_MS);
+            print_stats();
+        }
+    }
+
+    rte_eal_mp_wait_lcore();
+    // Closing and releasing resources
+    for (port_id = 0; port_id < MAX_PORTS; port_id++) {
+        if (ports[port_id].nb_queues > 0) {
+            rte_eth_dev_stop(port_id);
+            rte_eth_dev_close(port_id);
+        }
+    }
 
     // Clean up the EAL
     rte_eal_cleanup();
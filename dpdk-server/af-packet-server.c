@@ -0,0 +1,473 @@
+// For sched_getcpu()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <argp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include <rte_common.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+#include <rte_cycles.h>
+#include <rte_vect.h>
+
+#include "decoder.h"
+#include "framebuffer.h"
+#include "stats.h"
+
+// Same ingest path as pixelflut-v6-server, but reading the packets from mmap'ed TPACKET_V3 rings of a regular kernel
+// interface instead of using DPDK. The DPDK libraries are only used for the mbuf layout the decoder works on, the EAL
+// is never initialized.
+
+#define MAX_THREADS 64
+#define BURST_SIZE 32
+// TPACKET_V3 frames have a variable size, but the kernel still wants a frame size that divides the block size
+#define FRAME_SIZE 2048
+// How long the kernel waits for a block to fill up before handing it to us anyway
+#define BLOCK_RETIRE_TIMEOUT_MS 2
+
+static struct argp_option options[] = {
+    {"width",  'w', "pixels", 0,  "Width of the drawing surface in pixels (default 1920)" },
+    {"height", 'h', "pixels", 0,  "Height of the drawing surface in pixels (default 1080)"},
+    {"shared-memory-name", 's', "name", 0, "Name of the shared memory. Usually it will be created at /dev/shm/<name> (default pixelflut)"},
+    {"hugepage-dir", 'g', "path", 0, "Create the shared memory as file within the given hugetlbfs mount (e.g. /dev/hugepages) instead of /dev/shm, so that it is backed by huge pages"},
+    {"transparent-hugepages", 't', 0, 0, "Ask the kernel to back the shared memory in /dev/shm with transparent huge pages. Requires /sys/kernel/mm/transparent_hugepage/shmem_enabled to be set to advise"},
+    {"interface", 'i', "name", 0, "Network interface to receive the packets on, e.g. eth0 or one end of a veth pair"},
+    {"threads", 'T', "count", 0, "Number of receive threads, every one gets its own ring (default 1)"},
+    {"fanout", 'f', "mode", 0, "How the kernel spreads the packets over the threads, one of hash or cpu. hash keeps flows on one thread, cpu hands the packets to the thread of the CPU that received them (default hash)"},
+    {"block-size", 'B', "KiB", 0, "Size of a ring block in KiB, needs to be a multiple of the page size (default 1024)"},
+    {"blocks", 'b', "count", 0, "Number of blocks per ring (default 64)"},
+    {"prefetch-headers", 'P', "packets", 0, "How many packets ahead the packet headers are prefetched, 0 disables it (default 8)"},
+    {"prefetch-pixels", 'F', "packets", 0, "How many packets ahead the framebuffer pixels are prefetched, 0 disables it (default 4)"},
+    {"multi-pixel", 'm', 0, 0, "Decode the additional pixels of pixelflut v6 packets sent to UDP port 28792, which carry (x, y, r, g, b) tuples in their payload"},
+    {"shard-prefix-len", 'S', "bits", 0, "Length of the IPv6 prefix routed to this server in case the screen is split across servers (64 to 96). Additional pixels of multi-pixel packets outside of the prefix of their first pixel are rejected (default 64)"},
+    {"decoder", 'd', "impl", 0, "Packet decoder implementation, one of auto, scalar, avx2 or avx512. auto picks the fastest one supported by the CPU (default auto)"},
+    {0}
+};
+
+struct arguments {
+    uint16_t width;
+    uint16_t height;
+    char* shared_memory_name;
+    char* hugepage_dir;
+    bool transparent_hugepages;
+    char* interface;
+    uint16_t threads;
+    uint16_t fanout;
+    uint32_t block_size;
+    uint32_t blocks;
+    enum decoder_impl decoder;
+    uint16_t prefetch_headers;
+    uint16_t prefetch_pixels;
+    bool multi_pixel;
+    uint8_t shard_prefix_len;
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    // Get the input argument from argp_parse, which we know is a pointer to our arguments structure
+    struct arguments *arguments = state->input;
+
+    switch (key)
+    {
+        case 'w':
+            arguments->width = (uint16_t) strtol(arg, NULL, 10);
+            break;
+        case 'h':
+            arguments->height = (uint16_t) strtol(arg, NULL, 10);
+            break;
+        case 's':
+            arguments->shared_memory_name = arg;
+            break;
+        case 'g':
+            arguments->hugepage_dir = arg;
+            break;
+        case 't':
+            arguments->transparent_hugepages = true;
+            break;
+        case 'i':
+            arguments->interface = arg;
+            break;
+        case 'T':
+            arguments->threads = (uint16_t) strtol(arg, NULL, 10);
+            if (arguments->threads == 0 || arguments->threads > MAX_THREADS)
+                argp_error(state, "The number of threads needs to be within 1 and %d", MAX_THREADS);
+            break;
+        case 'f':
+            if (strcmp(arg, "hash") == 0)
+                arguments->fanout = PACKET_FANOUT_HASH;
+            else if (strcmp(arg, "cpu") == 0)
+                arguments->fanout = PACKET_FANOUT_CPU;
+            else
+                argp_error(state, "Unknown fanout mode '%s'", arg);
+            break;
+        case 'B':
+            arguments->block_size = (uint32_t) strtol(arg, NULL, 10) * 1024;
+            break;
+        case 'b':
+            arguments->blocks = (uint32_t) strtol(arg, NULL, 10);
+            break;
+        case 'P':
+            arguments->prefetch_headers = (uint16_t) strtol(arg, NULL, 10);
+            break;
+        case 'F':
+            arguments->prefetch_pixels = (uint16_t) strtol(arg, NULL, 10);
+            break;
+        case 'm':
+            arguments->multi_pixel = true;
+            break;
+        case 'S':
+            arguments->shard_prefix_len = (uint8_t) strtol(arg, NULL, 10);
+            if (arguments->shard_prefix_len < 64 || arguments->shard_prefix_len > 96)
+                argp_error(state, "The shard prefix length needs to be between 64 and 96");
+            break;
+        case 'd':
+            arguments->decoder = NUM_DECODER_IMPLS;
+            for (int impl = 0; impl < NUM_DECODER_IMPLS; impl++) {
+                if (strcmp(arg, decoder_impl_name(impl)) == 0)
+                    arguments->decoder = impl;
+            }
+            if (arguments->decoder == NUM_DECODER_IMPLS)
+                argp_error(state, "Unknown decoder '%s'", arg);
+            break;
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+const char *argp_program_version = "af-packet-server 0.1.0";
+static char doc[] = "pixelflut v6 or pingxelflut server using AF_PACKET rings, for machines that can't dedicate a NIC to DPDK";
+static char args_doc[] = "";
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+struct rx_thread {
+    pthread_t thread;
+    uint16_t id;
+    int fd;
+    uint8_t* ring;
+    uint32_t block_size;
+    uint32_t blocks;
+    struct framebuffer* fb;
+    struct queue_stats* stats;
+};
+
+static struct rx_thread threads[MAX_THREADS];
+
+static int open_ring(struct rx_thread* t, int ifindex, uint16_t fanout_mode) {
+    t->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (t->fd == -1) {
+        printf("Failed to create packet socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        printf("Failed to switch to TPACKET_V3: %s\n", strerror(errno));
+        return -1;
+    }
+
+    struct tpacket_req3 req = {
+        .tp_block_size = t->block_size,
+        .tp_block_nr = t->blocks,
+        .tp_frame_size = FRAME_SIZE,
+        .tp_frame_nr = t->block_size / FRAME_SIZE * t->blocks,
+        .tp_retire_blk_tov = BLOCK_RETIRE_TIMEOUT_MS,
+    };
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+        printf("Failed to set up RX ring with %u blocks of %u bytes: %s\n", t->blocks, t->block_size, strerror(errno));
+        return -1;
+    }
+
+    t->ring = mmap(NULL, (size_t)t->block_size * t->blocks, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, t->fd, 0);
+    if (t->ring == MAP_FAILED) {
+        printf("Failed to mmap RX ring: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // We don't want to see our own replies. Only exists since Linux 4.20, so it's fine if it fails.
+    int one = 1;
+    setsockopt(t->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+
+    struct sockaddr_ll addr = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ALL),
+        .sll_ifindex = ifindex,
+    };
+    if (bind(t->fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        printf("Failed to bind packet socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // Same as the DPDK server, pixelflut v6 clients might not bother to use our MAC address
+    struct packet_mreq mreq = {
+        .mr_ifindex = ifindex,
+        .mr_type = PACKET_MR_PROMISC,
+    };
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+        printf("WARNING, failed to enable promiscuous mode: %s\n", strerror(errno));
+
+    // All sockets join the same group, the kernel then spreads the packets over them
+    int fanout = (getpid() & 0xffff) | (fanout_mode << 16);
+    if (setsockopt(t->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == -1) {
+        printf("Failed to join fanout group: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// Wraps the frames into mbufs, so that the decoder can work on them without copying. The buffer of an mbuf is the frame
+// slot without the tpacket3_hdr, so that replies (which are built in place) can't overwrite any header of the ring.
+static void decode_frames(struct rx_thread* t, struct rte_mbuf* mbufs, struct rte_mbuf** pkts, uint8_t** frames,
+        uint8_t* block_end, uint16_t nb_pkts) {
+    struct rte_mbuf *replies[BURST_SIZE];
+
+    for (uint16_t i = 0; i < nb_pkts; i++) {
+        struct tpacket3_hdr* hdr = (struct tpacket3_hdr*)frames[i];
+        uint8_t* buf = frames[i] + sizeof(struct tpacket3_hdr);
+        uint8_t* slot_end = hdr->tp_next_offset ? frames[i] + hdr->tp_next_offset : block_end;
+        struct rte_mbuf* m = &mbufs[i];
+
+        m->buf_addr = buf;
+        m->buf_len = RTE_MIN(slot_end - buf, UINT16_MAX);
+        m->data_off = hdr->tp_mac - sizeof(struct tpacket3_hdr);
+        m->data_len = hdr->tp_snaplen;
+        m->pkt_len = hdr->tp_snaplen;
+        pkts[i] = m;
+    }
+
+    uint16_t nb_replies = decode_burst(t->fb, &t->stats->decoder, pkts, nb_pkts, replies);
+
+    // Nothing to free, the frames are handed back to the kernel together with their block
+    for (uint16_t r = 0; r < nb_replies; r++) {
+        if (send(t->fd, rte_pktmbuf_mtod(replies[r], void*), replies[r]->data_len, MSG_DONTWAIT) == -1)
+            t->stats->tx_dropped++;
+    }
+}
+
+static void* rx_thread_main(void* arg) {
+    struct rx_thread* t = arg;
+    struct queue_stats* stats = t->stats;
+
+    printf("[DEBUG] Thread %u started on CPU %d\n", t->id, sched_getcpu());
+
+    // Only the fields the decoder looks at need to be set, the rest stays zero (e.g. no chained segments)
+    struct rte_mbuf mbufs[BURST_SIZE];
+    memset(mbufs, 0, sizeof(mbufs));
+    for (int i = 0; i < BURST_SIZE; i++)
+        mbufs[i].nb_segs = 1;
+    struct rte_mbuf* pkts[BURST_SIZE];
+    uint8_t* frames[BURST_SIZE];
+
+    struct pollfd pfd = {
+        .fd = t->fd,
+        .events = POLLIN | POLLERR,
+    };
+
+    uint32_t block = 0;
+    uint64_t last_tsc = rte_rdtsc();
+    while (1) {
+        uint8_t* block_start = t->ring + (size_t)block * t->block_size;
+        struct tpacket_block_desc* desc = (struct tpacket_block_desc*)block_start;
+
+        if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            stats->empty_polls++;
+            poll(&pfd, 1, -1);
+            uint64_t now = rte_rdtsc();
+            stats->idle_cycles += now - last_tsc;
+            last_tsc = now;
+            continue;
+        }
+
+        uint32_t nb_frames = desc->hdr.bh1.num_pkts;
+        uint8_t* frame = block_start + desc->hdr.bh1.offset_to_first_pkt;
+        uint8_t* block_end = block_start + t->block_size;
+
+        // A block is our RX burst, it gets decoded in chunks of BURST_SIZE
+        stats->rx_packets += nb_frames;
+        if (nb_frames > 0)
+            stats->burst_sizes[burst_histogram_bucket(RTE_MIN(nb_frames, UINT16_MAX))]++;
+
+        uint16_t nb_pkts = 0;
+        for (uint32_t i = 0; i < nb_frames; i++) {
+            frames[nb_pkts++] = frame;
+            frame += ((struct tpacket3_hdr*)frame)->tp_next_offset;
+
+            if (nb_pkts == BURST_SIZE) {
+                decode_frames(t, mbufs, pkts, frames, block_end, nb_pkts);
+                nb_pkts = 0;
+            }
+        }
+        if (nb_pkts > 0)
+            decode_frames(t, mbufs, pkts, frames, block_end, nb_pkts);
+
+        // Hand the block back to the kernel
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        block = (block + 1) % t->blocks;
+
+        uint64_t now = rte_rdtsc();
+        stats->busy_cycles += now - last_tsc;
+        last_tsc = now;
+    }
+    return NULL;
+}
+
+static void stats_loop(struct framebuffer* fb, int port_slot, uint16_t nb_threads) {
+    struct rte_eth_stats* port_stats = &fb->port_stats[port_slot].stats;
+
+    int print_to_screen_counter = 50;
+    while (1) {
+        // The kernel resets its counters on every read, so we need to sum them up
+        for (uint16_t i = 0; i < nb_threads; i++) {
+            struct tpacket_stats_v3 kstats;
+            socklen_t len = sizeof(kstats);
+            if (getsockopt(threads[i].fd, SOL_PACKET, PACKET_STATISTICS, &kstats, &len) == 0) {
+                port_stats->ipackets += kstats.tp_packets - kstats.tp_drops;
+                port_stats->imissed += kstats.tp_drops;
+            }
+        }
+
+        print_to_screen_counter--;
+        if (print_to_screen_counter <= 0) {
+            print_to_screen_counter = 50;
+
+            printf("\n[RX Stats]\n");
+            printf("Interface: %lu pkts, %lu dropped\n", port_stats->ipackets, port_stats->imissed);
+            for (uint16_t i = 0; i < nb_threads; i++) {
+                struct queue_stats *stats = threads[i].stats;
+                uint64_t total = stats->busy_cycles + stats->idle_cycles;
+                printf("Thread %u: %lu pkts, %lu out of bounds, %lu unknown, %.1f%% busy\n", i, stats->rx_packets,
+                    stats->decoder.out_of_bounds, stats->decoder.unknown,
+                    total > 0 ? 100.0 * stats->busy_cycles / total : 0.0);
+            }
+            fflush(stdout);
+        }
+
+        usleep(100000); // Sleep 100ms
+    }
+}
+
+int main(int argc, char **argv) {
+    struct arguments arguments = {0};
+    arguments.width = 1920;
+    arguments.height = 1080;
+    arguments.shared_memory_name = "/pixelflut";
+    arguments.threads = 1;
+    arguments.fanout = PACKET_FANOUT_HASH;
+    arguments.block_size = 1024 * 1024;
+    arguments.blocks = 64;
+    arguments.decoder = DECODER_AUTO;
+    arguments.prefetch_headers = DEFAULT_PREFETCH_HEADERS;
+    arguments.prefetch_pixels = DEFAULT_PREFETCH_PIXELS;
+    arguments.shard_prefix_len = 64;
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.interface == NULL) {
+        printf("No interface provided, use --interface for that. See --help for details\n");
+        return EXIT_FAILURE;
+    }
+    int ifindex = if_nametoindex(arguments.interface);
+    if (ifindex == 0) {
+        printf("Unknown interface %s\n", arguments.interface);
+        return EXIT_FAILURE;
+    }
+    if (arguments.block_size == 0 || arguments.block_size % sysconf(_SC_PAGESIZE) != 0 ||
+        arguments.block_size % FRAME_SIZE != 0) {
+        printf("The block size needs to be a multiple of the page size\n");
+        return EXIT_FAILURE;
+    }
+
+    struct framebuffer* fb;
+    int ret = create_fb(&fb, arguments.width, arguments.height, NULL, arguments.shared_memory_name,
+        arguments.hugepage_dir, arguments.transparent_hugepages);
+    if (ret != 0) {
+        printf("Failed to allocate framebuffer\n");
+        return EXIT_FAILURE;
+    }
+
+    // We don't run rte_eal_init(), which is what normally sets the max SIMD bitwidth (to what the CPU supports, or to
+    // --force-max-simd-bitwidth). Without it the bitwidth stays 0 and the decoder would only ever pick scalar. The
+    // decoder still checks the CPU flags on its own.
+    rte_vect_set_max_simd_bitwidth(RTE_VECT_SIMD_512);
+    ret = decoder_init(fb, arguments.decoder);
+    if (ret < 0) {
+        printf("The decoder %s is not supported on this CPU\n", decoder_impl_name(arguments.decoder));
+        return EXIT_FAILURE;
+    }
+    printf("Using the %s packet decoder\n", decoder_impl_name(ret));
+    decoder_set_prefetch(arguments.prefetch_headers, arguments.prefetch_pixels);
+    decoder_set_multi_pixel(arguments.multi_pixel, arguments.shard_prefix_len);
+
+    // The interface gets a port stats slot by its MAC address, same as the DPDK ports
+    struct ifreq ifr = {0};
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", arguments.interface);
+    int ioctl_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (ioctl_fd == -1 || ioctl(ioctl_fd, SIOCGIFHWADDR, &ifr) == -1) {
+        printf("Failed to read MAC address of %s: %s\n", arguments.interface, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    close(ioctl_fd);
+
+    struct rte_ether_addr mac_addr;
+    memcpy(mac_addr.addr_bytes, ifr.ifr_hwaddr.sa_data, RTE_ETHER_ADDR_LEN);
+    printf("Interface %s MAC: %02" PRIx8 " %02" PRIx8 " %02" PRIx8 " %02" PRIx8 " %02" PRIx8 " %02" PRIx8 "\n",
+        arguments.interface, RTE_ETHER_ADDR_BYTES(&mac_addr));
+
+    int port_slot = find_free_stats_slot(fb, &mac_addr);
+    if (port_slot == -1) {
+        printf("Failed to find free statistics slot for %s, increase MAX_PORTS\n", arguments.interface);
+        return EXIT_FAILURE;
+    }
+    memset(&fb->port_stats[port_slot].stats, 0, sizeof(fb->port_stats[port_slot].stats));
+    release_queue_stats_slots(fb, port_slot);
+
+    for (uint16_t i = 0; i < arguments.threads; i++) {
+        struct rx_thread* t = &threads[i];
+        t->id = i;
+        t->fb = fb;
+        t->block_size = arguments.block_size;
+        t->blocks = arguments.blocks;
+
+        int slot = find_free_queue_stats_slot(fb);
+        if (slot == -1) {
+            printf("Failed to find free statistics slot for thread %u, increase MAX_QUEUE_STATS\n", i);
+            return EXIT_FAILURE;
+        }
+        // Every thread is a queue of port 0, the lcore is the thread number
+        t->stats = &fb->queue_stats[slot];
+        memset(&t->stats->decoder, 0, sizeof(*t->stats) - offsetof(struct queue_stats, decoder));
+        t->stats->port_slot = port_slot;
+        t->stats->port = 0;
+        t->stats->queue = i;
+        t->stats->lcore = i;
+        t->stats->role = QUEUE_ROLE_RX;
+
+        if (open_ring(t, ifindex, arguments.fanout) == -1)
+            return EXIT_FAILURE;
+    }
+
+    // Only start receiving once all sockets joined the fanout group, so that the packets get spread from the start
+    for (uint16_t i = 0; i < arguments.threads; i++) {
+        if (pthread_create(&threads[i].thread, NULL, rx_thread_main, &threads[i]) != 0) {
+            printf("Failed to start thread %u\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    stats_loop(fb, port_slot, arguments.threads);
+    return 0;
+}
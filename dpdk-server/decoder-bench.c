@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <argp.h>
+
+#include <rte_common.h>
+#include <rte_eal.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_icmp.h>
+#include <rte_udp.h>
+#include <rte_lcore.h>
+#include <rte_launch.h>
+#include <rte_mempool.h>
+#include <rte_mbuf.h>
+#include <rte_cycles.h>
+
+#include "decoder.h"
+#include "framebuffer.h"
+
+#define BURST_SIZE 32
+#define MBUF_CACHE_SIZE 256
+// Additional pixels of the multi-pixel variant, which are placed right next to the first one (the way a client drawing
+// an image would send them)
+#define MULTI_PIXEL_EXTRA_PIXELS 16
+
+enum bench_variant {
+    VARIANT_PIXELFLUT_V6,
+    VARIANT_PINGXELFLUT_V6,
+    VARIANT_PINGXELFLUT_V4,
+    VARIANT_PINGXELFLUT_V6_RGBA,
+    VARIANT_PINGXELFLUT_V4_RGBA,
+    VARIANT_PIXELFLUT_V6_MULTI,
+    NUM_VARIANTS,
+};
+
+static const char* variant_names[NUM_VARIANTS] = {
+    [VARIANT_PIXELFLUT_V6] = "pixelflut-v6",
+    [VARIANT_PINGXELFLUT_V6] = "pingxelflut-v6",
+    [VARIANT_PINGXELFLUT_V4] = "pingxelflut-v4",
+    [VARIANT_PINGXELFLUT_V6_RGBA] = "pingxelflut-v6-rgba",
+    [VARIANT_PINGXELFLUT_V4_RGBA] = "pingxelflut-v4-rgba",
+    [VARIANT_PIXELFLUT_V6_MULTI] = "pixelflut-v6-multi",
+};
+
+static struct argp_option options[] = {
+    {"width",  'w', "pixels", 0,  "Width of the drawing surface in pixels (default 1920)" },
+    {"height", 'h', "pixels", 0,  "Height of the drawing surface in pixels (default 1080)"},
+    {"hugepage-dir", 'g', "path", 0, "Create the framebuffer as file within the given hugetlbfs mount (e.g. /dev/hugepages) instead of /dev/shm"},
+    {"transparent-hugepages", 't', 0, 0, "Ask the kernel to back the framebuffer in /dev/shm with transparent huge pages"},
+    {"packets", 'p', "count", 0, "Number of distinct synthetic packets per lcore (default 4096)"},
+    {"iterations", 'n', "count", 0, "How often every lcore decodes all of its packets per variant (default 2000)"},
+    {"prefetch-headers", 'P', "packets", 0, "How many packets ahead the packet headers are prefetched, 0 disables it (default 8)"},
+    {"prefetch-pixels", 'F', "packets", 0, "How many packets ahead the framebuffer pixels are prefetched, 0 disables it (default 4)"},
+    {"alpha", 'a', "alpha", 0, "Alpha (0-255) of the pixels sent by the RGBA variants. 0 and 255 take the fast paths (default random)"},
+    {0}
+};
+
+struct arguments {
+    uint16_t width;
+    uint16_t height;
+    char* hugepage_dir;
+    bool transparent_hugepages;
+    uint32_t packets;
+    uint32_t iterations;
+    uint16_t prefetch_headers;
+    uint16_t prefetch_pixels;
+    // -1 means random
+    int alpha;
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    // Get the input argument from argp_parse, which we know is a pointer to our arguments structure
+    struct arguments *arguments = state->input;
+
+    switch (key)
+    {
+        case 'w':
+            arguments->width = (uint16_t) strtol(arg, NULL, 10);
+            break;
+        case 'h':
+            arguments->height = (uint16_t) strtol(arg, NULL, 10);
+            break;
+        case 'g':
+            arguments->hugepage_dir = arg;
+            break;
+        case 't':
+            arguments->transparent_hugepages = true;
+            break;
+        case 'p':
+            arguments->packets = (uint32_t) strtol(arg, NULL, 10);
+            break;
+        case 'n':
+            arguments->iterations = (uint32_t) strtol(arg, NULL, 10);
+            break;
+        case 'P':
+            arguments->prefetch_headers = (uint16_t) strtol(arg, NULL, 10);
+            break;
+        case 'F':
+            arguments->prefetch_pixels = (uint16_t) strtol(arg, NULL, 10);
+            break;
+        case 'a':
+            arguments->alpha = (int) strtol(arg, NULL, 10);
+            if (arguments->alpha < 0 || arguments->alpha > 255)
+                argp_error(state, "The alpha needs to be within 0 and 255");
+            break;
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+const char *argp_program_version = "decoder-bench 0.1.0";
+static char doc[] = "Benchmarks the pixelflut v6 and pingxelflut decoder using synthetic mbufs, no NIC needed";
+static char args_doc[] = "";
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+struct bench_result {
+    uint64_t packets;
+    uint64_t cycles;
+};
+
+static struct arguments arguments;
+static struct framebuffer* fb;
+static struct rte_mempool* mbuf_pool;
+static enum bench_variant current_variant;
+static enum decoder_impl current_impl;
+static struct bench_result results[RTE_MAX_LCORE];
+
+static void build_packet(struct rte_mbuf* pkt, enum bench_variant variant, uint16_t x, uint16_t y, uint32_t rgb,
+    uint8_t alpha) {
+    uint16_t pkt_size;
+    // 8 bytes for command, x, y, r, g and b, plus a for the RGBA variants
+    bool rgba = variant == VARIANT_PINGXELFLUT_V6_RGBA || variant == VARIANT_PINGXELFLUT_V4_RGBA;
+    uint16_t payload_len = rgba ? 9 : 8;
+    struct rte_ether_hdr* eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr*);
+    memset(eth_hdr, 0, 256);
+
+    if (variant == VARIANT_PINGXELFLUT_V4 || variant == VARIANT_PINGXELFLUT_V4_RGBA) {
+        eth_hdr->ether_type = htons(RTE_ETHER_TYPE_IPV4);
+
+        struct rte_ipv4_hdr* ipv4_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv4_hdr*, sizeof(struct rte_ether_hdr));
+        ipv4_hdr->version_ihl = 0x45;
+        ipv4_hdr->time_to_live = 0xff;
+        ipv4_hdr->next_proto_id = IPPROTO_ICMP;
+        ipv4_hdr->total_length = htons(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + payload_len);
+
+        struct rte_icmp_hdr* icmp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_icmp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr));
+        icmp_hdr->icmp_type = RTE_IP_ICMP_ECHO_REQUEST;
+
+        uint8_t* payload = (uint8_t*)(icmp_hdr + 1);
+        payload[0] = MSG_SET_PIXEL;
+        *(uint16_t*)(payload + 1) = htons(x);
+        *(uint16_t*)(payload + 3) = htons(y);
+        memcpy(payload + 5, &rgb, 3);
+        payload[8] = alpha;
+
+        // The decoder checks the exact payload length, so no padding here
+        pkt_size = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + payload_len;
+    } else {
+        eth_hdr->ether_type = htons(RTE_ETHER_TYPE_IPV6);
+
+        struct rte_ipv6_hdr* ipv6_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv6_hdr*, sizeof(struct rte_ether_hdr));
+        ipv6_hdr->vtc_flow = htonl(6 << 28); // IP version 6
+        ipv6_hdr->hop_limits = 0xff;
+
+        if (variant == VARIANT_PIXELFLUT_V6 || variant == VARIANT_PIXELFLUT_V6_MULTI) {
+            uint16_t extra = variant == VARIANT_PIXELFLUT_V6_MULTI ? MULTI_PIXEL_EXTRA_PIXELS : 0;
+            uint16_t udp_len = sizeof(struct rte_udp_hdr) + extra * MULTI_PIXEL_TUPLE_SIZE;
+            ipv6_hdr->proto = 0x11; // UDP
+            ipv6_hdr->payload_len = htons(udp_len);
+
+            struct rte_udp_hdr* udp_hdr = (struct rte_udp_hdr*)(ipv6_hdr + 1);
+            udp_hdr->dgram_len = htons(udp_len);
+            if (extra > 0)
+                udp_hdr->dst_port = htons(PIXELFLUT_V6_MULTI_PIXEL_PORT);
+
+            uint8_t* tuple = (uint8_t*)(udp_hdr + 1);
+            for (uint16_t i = 1; i <= extra; i++, tuple += MULTI_PIXEL_TUPLE_SIZE) {
+                uint16_t tuple_x = x + i;
+                tuple[0] = tuple_x >> 8;
+                tuple[1] = tuple_x;
+                tuple[2] = y >> 8;
+                tuple[3] = y;
+                memcpy(tuple + 4, &rgb, 3);
+            }
+
+            ipv6_hdr->dst_addr[8] = x >> 8;
+            ipv6_hdr->dst_addr[9] = x;
+            ipv6_hdr->dst_addr[10] = y >> 8;
+            ipv6_hdr->dst_addr[11] = y;
+            ipv6_hdr->dst_addr[12] = rgb >> 0;
+            ipv6_hdr->dst_addr[13] = rgb >> 8;
+            ipv6_hdr->dst_addr[14] = rgb >> 16;
+
+            pkt_size = RTE_MAX(RTE_ETHER_MIN_LEN, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + udp_len);
+        } else {
+            ipv6_hdr->proto = 58; // ICMPv6
+            ipv6_hdr->payload_len = htons(sizeof(struct rte_icmp_hdr) + payload_len);
+
+            struct rte_icmp_hdr* icmp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_icmp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr));
+            icmp_hdr->icmp_type = 128; // ICMPv6 echo request, RTE_IP_ICMP_ECHO_REQUEST (8) is the ICMPv4 one
+
+            uint8_t* payload = (uint8_t*)(icmp_hdr + 1);
+            payload[0] = MSG_SET_PIXEL;
+            *(uint16_t*)(payload + 1) = htons(x);
+            *(uint16_t*)(payload + 3) = htons(y);
+            memcpy(payload + 5, &rgb, 3);
+            payload[8] = alpha;
+
+            pkt_size = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + payload_len;
+        }
+    }
+
+    pkt->data_len = pkt_size;
+    pkt->pkt_len = pkt_size;
+}
+
+static int bench_lcore(__rte_unused void* arg) {
+    unsigned lcore_id = rte_lcore_id();
+    uint32_t nb_pkts = arguments.packets;
+
+    struct rte_mbuf** pkts = malloc(nb_pkts * sizeof(struct rte_mbuf*));
+    if (pkts == NULL || rte_pktmbuf_alloc_bulk(mbuf_pool, pkts, nb_pkts) != 0) {
+        printf("Core %u failed to allocate %u mbufs\n", lcore_id, nb_pkts);
+        free(pkts);
+        return -1;
+    }
+
+    // Random coordinates spread over the whole framebuffer, so that we also measure the framebuffer cache misses
+    unsigned int seed = lcore_id;
+    for (uint32_t i = 0; i < nb_pkts; i++) {
+        uint8_t alpha = arguments.alpha >= 0 ? arguments.alpha : rand_r(&seed);
+        build_packet(pkts[i], current_variant, rand_r(&seed) % fb->width, rand_r(&seed) % fb->height, rand_r(&seed),
+            alpha);
+    }
+
+    // Same as in the server, the counters are part of the hot path. None of the variants asks for a reply, so the
+    // replies always stay empty.
+    struct decoder_stats stats = {0};
+    struct rte_mbuf* replies[BURST_SIZE];
+
+    // Warmup, so that all packets are in the cache hierarchy the same way they are in the measured runs
+    for (uint32_t i = 0; i < nb_pkts; i += BURST_SIZE) {
+        decode_burst(fb, &stats, &pkts[i], RTE_MIN(BURST_SIZE, nb_pkts - i), replies);
+    }
+
+    uint64_t start = rte_rdtsc_precise();
+    for (uint32_t iteration = 0; iteration < arguments.iterations; iteration++) {
+        for (uint32_t i = 0; i < nb_pkts; i += BURST_SIZE) {
+            decode_burst(fb, &stats, &pkts[i], RTE_MIN(BURST_SIZE, nb_pkts - i), replies);
+        }
+    }
+    uint64_t end = rte_rdtsc_precise();
+
+    results[lcore_id].packets = (uint64_t)nb_pkts * arguments.iterations;
+    results[lcore_id].cycles = end - start;
+
+    rte_pktmbuf_free_bulk(pkts, nb_pkts);
+    free(pkts);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int ret = rte_eal_init(argc, argv);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "EAL init failed\n");
+
+    argc -= ret;
+    argv += ret;
+
+    // Parse command arguments (after the EAL ones)
+    arguments.width = 1920;
+    arguments.height = 1080;
+    arguments.packets = 4096;
+    arguments.iterations = 2000;
+    arguments.prefetch_headers = DEFAULT_PREFETCH_HEADERS;
+    arguments.prefetch_pixels = DEFAULT_PREFETCH_PIXELS;
+    arguments.alpha = -1;
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.packets == 0 || arguments.iterations == 0 || arguments.width == 0 || arguments.height == 0)
+        rte_exit(EXIT_FAILURE, "All of width, height, packets and iterations need to be greater than zero\n");
+
+    char* shared_memory_name = "/pixelflut-decoder-bench";
+    ret = create_fb(&fb, arguments.width, arguments.height, NULL, shared_memory_name, arguments.hugepage_dir,
+        arguments.transparent_hugepages);
+    if (ret != 0)
+        rte_exit(EXIT_FAILURE, "Failed to allocate framebuffer\n");
+
+    decoder_set_prefetch(arguments.prefetch_headers, arguments.prefetch_pixels);
+    // Only changes the classification for the multi-pixel variant, the other ones don't use its UDP port
+    decoder_set_multi_pixel(true, 64);
+
+    mbuf_pool = rte_pktmbuf_pool_create("BENCH_POOL", arguments.packets * rte_lcore_count() + MBUF_CACHE_SIZE * rte_lcore_count(),
+                                        MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+    if (!mbuf_pool)
+        rte_exit(EXIT_FAILURE, "mbuf_pool create failed\n");
+
+    double ns_per_cycle = 1e9 / rte_get_tsc_hz();
+    printf("\nDecoding %u packets %u times per lcore on %u lcores (TSC %lu Hz), prefetching headers %u and pixels %u "
+        "packets ahead\n\n", arguments.packets, arguments.iterations, rte_lcore_count(), rte_get_tsc_hz(),
+        arguments.prefetch_headers, arguments.prefetch_pixels);
+    printf("+---------+---------------------+--------+------------+----------+\n");
+    printf("| Decoder | Variant             | LCore  |  ns/packet |     Mpps |\n");
+    printf("+---------+---------------------+--------+------------+----------+\n");
+
+    for (int impl = DECODER_SCALAR; impl < NUM_DECODER_IMPLS; impl++) {
+        if (decoder_init(fb, impl) < 0) {
+            printf("| %-7s | not supported on this CPU                            |\n", decoder_impl_name(impl));
+            printf("+---------+---------------------+--------+------------+----------+\n");
+            continue;
+        }
+        current_impl = impl;
+
+        for (int variant = 0; variant < NUM_VARIANTS; variant++) {
+            current_variant = variant;
+            memset(results, 0, sizeof(results));
+
+            rte_eal_mp_remote_launch(bench_lcore, NULL, CALL_MAIN);
+            if (rte_eal_mp_wait_lcore() < 0)
+                rte_exit(EXIT_FAILURE, "Benchmark of variant %s failed\n", variant_names[variant]);
+
+            double total_mpps = 0;
+            unsigned lcore_id;
+            RTE_LCORE_FOREACH(lcore_id) {
+                struct bench_result* result = &results[lcore_id];
+                double ns_per_packet = result->cycles * ns_per_cycle / result->packets;
+                double mpps = 1e3 / ns_per_packet;
+                total_mpps += mpps;
+
+                printf("| %-7s | %-19s | %6u | %10.2f | %8.2f |\n", decoder_impl_name(current_impl), variant_names[variant],
+                    lcore_id, ns_per_packet, mpps);
+            }
+            printf("| %-7s | %-19s |  total |            | %8.2f |\n", decoder_impl_name(current_impl), variant_names[variant],
+                total_mpps);
+            printf("+---------+---------------------+--------+------------+----------+\n");
+        }
+    }
+
+    if (arguments.hugepage_dir != NULL) {
+        char shared_memory_path[PATH_MAX];
+        snprintf(shared_memory_path, sizeof(shared_memory_path), "%s%s", arguments.hugepage_dir, shared_memory_name);
+        unlink(shared_memory_path);
+    } else {
+        shm_unlink(shared_memory_name);
+    }
+    rte_eal_cleanup();
+    return 0;
+}
@@ -0,0 +1,947 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rte_common.h>
+#include <rte_cpuflags.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_icmp.h>
+#include <rte_udp.h>
+#include <rte_mbuf.h>
+#include <rte_per_lcore.h>
+#include <rte_prefetch.h>
+#include <rte_vect.h>
+
+#ifdef RTE_ARCH_X86
+#include <immintrin.h>
+#endif
+
+#include "decoder.h"
+#include "framebuffer.h"
+
+// pingxelflut SIZE_RESPONSE payload: Message kind, width and height
+#define SIZE_RESPONSE_LEN 5
+
+// ICMPv6 has its own type numbers (RFC 4443), older DPDK versions don't define them yet
+#ifndef RTE_ICMP6_ECHO_REQUEST
+#define RTE_ICMP6_ECHO_REQUEST 128
+#endif
+#ifndef RTE_ICMP6_ECHO_REPLY
+#define RTE_ICMP6_ECHO_REPLY 129
+#endif
+
+// Older pingxelflut clients (including ours) used the ICMPv4 echo request type 8 for ICMPv6 as well, so we accept both
+static inline bool is_icmp6_echo_request(const struct rte_icmp_hdr* icmp_hdr) {
+    return (icmp_hdr->icmp_type == RTE_ICMP6_ECHO_REQUEST || icmp_hdr->icmp_type == RTE_IP_ICMP_ECHO_REQUEST)
+        && icmp_hdr->icmp_code == 0;
+}
+
+// Blending needs to read the framebuffer pixel, which is a cache miss most of the time. That's why RGBA pixels are
+// not blended right away, but collected (and their pixels prefetched) and blended in batches once the batch is full or
+// the burst is done. This means an RGBA pixel can land after a later packet of the same burst setting the same pixel,
+// which can happen across RX queues anyway.
+#define BLEND_BATCH_SIZE 8
+
+struct blend_batch {
+    uint16_t count;
+    uint32_t idx[BLEND_BATCH_SIZE] __rte_aligned(32);
+    uint32_t rgb[BLEND_BATCH_SIZE] __rte_aligned(32);
+    uint32_t alpha[BLEND_BATCH_SIZE] __rte_aligned(32);
+};
+
+// Every lcore calls the decoder for its own bursts, so every lcore needs its own batch
+static RTE_DEFINE_PER_LCORE(struct blend_batch, blend_batch);
+
+// Blends rgb over dst with alpha in [0, 255]. The division by 255 is done as (t + (t >> 8)) >> 8 with t = x + 128,
+// which gives the correctly rounded result for all products of two bytes. R and B are calculated at the same time in
+// the two 16 bit halves of a single 32 bit integer.
+static inline uint32_t blend_pixel(uint32_t dst, uint32_t rgb, uint32_t alpha) {
+    uint32_t inv_alpha = 255 - alpha;
+    uint32_t rb = (rgb & 0x00ff00ff) * alpha + (dst & 0x00ff00ff) * inv_alpha + 0x00800080;
+    uint32_t g = ((rgb >> 8) & 0xff) * alpha + ((dst >> 8) & 0xff) * inv_alpha + 0x80;
+
+    rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+    g = (g + (g >> 8)) & 0xff00;
+    return rb | g;
+}
+
+static void blend_batch_scalar(struct framebuffer* fb, struct blend_batch* batch) {
+    for (uint16_t i = 0; i < batch->count; i++) {
+        uint32_t* pixel = &fb->pixels[batch->idx[i]];
+        *pixel = blend_pixel(*pixel, batch->rgb[i], batch->alpha[i]);
+        fb_mark_dirty(fb, batch->idx[i]);
+    }
+}
+
+static void (*blend_batch_impl)(struct framebuffer* fb, struct blend_batch* batch) = blend_batch_scalar;
+
+static inline void blend_flush(struct framebuffer* fb) {
+    struct blend_batch* batch = &RTE_PER_LCORE(blend_batch);
+    if (batch->count == 0)
+        return;
+
+    blend_batch_impl(fb, batch);
+    batch->count = 0;
+}
+
+// Fully opaque pixels are a plain store and fully transparent ones don't do anything, only the rest is blended
+static inline void fb_blend(struct framebuffer* fb, struct decoder_stats* stats, uint16_t x, uint16_t y,
+    uint32_t rgba) {
+    uint32_t alpha = rgba >> 24;
+    if (alpha == 255) {
+        if (!fb_set(fb, x, y, rgba & 0x00ffffff))
+            stats->out_of_bounds++;
+        return;
+    }
+    uint32_t pixel_index;
+    if (!fb_pixel_index(fb, x, y, &pixel_index)) {
+        stats->out_of_bounds++;
+        return;
+    }
+    if (alpha == 0)
+        return;
+
+    struct blend_batch* batch = &RTE_PER_LCORE(blend_batch);
+    rte_prefetch0_write(&fb->pixels[pixel_index]);
+
+    batch->idx[batch->count] = pixel_index;
+    batch->rgb[batch->count] = rgba & 0x00ffffff;
+    batch->alpha[batch->count] = alpha;
+    if (++batch->count == BLEND_BATCH_SIZE)
+        blend_flush(fb);
+}
+
+static inline bool set_pkt_len(struct rte_mbuf* pkt, uint32_t len) {
+    if (pkt->pkt_len < len) {
+        uint16_t grow = len - pkt->pkt_len;
+        // E.g. the frames of the AF_PACKET rings are packed tightly, so we move the packet into the headroom instead
+        if (rte_pktmbuf_tailroom(pkt) < grow && rte_pktmbuf_headroom(pkt) >= grow && pkt->nb_segs == 1) {
+            char* data = rte_pktmbuf_mtod(pkt, char*);
+            pkt->data_off -= grow;
+            memmove(rte_pktmbuf_mtod(pkt, char*), data, pkt->data_len);
+        }
+        return rte_pktmbuf_append(pkt, grow) != NULL;
+    }
+    return rte_pktmbuf_trim(pkt, pkt->pkt_len - len) == 0;
+}
+
+static inline void write_size_response(struct framebuffer* fb, uint8_t* payload) {
+    payload[0] = MSG_SIZE_RESPONSE;
+    // Clients always draw in screen coordinates, no matter which region of it we own
+    *(unaligned_uint16_t*)(payload + 1) = htons(fb->screen_width);
+    *(unaligned_uint16_t*)(payload + 3) = htons(fb->screen_height);
+}
+
+// Turns the SIZE_REQUEST into the SIZE_RESPONSE in place by sending it back to where it came from, so that we don't
+// need to allocate a new mbuf.
+static bool build_size_response_v6(struct framebuffer* fb, struct rte_mbuf* pkt) {
+    if (!set_pkt_len(pkt, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + SIZE_RESPONSE_LEN))
+        return false;
+
+    struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
+    struct rte_ipv6_hdr *ipv6_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv6_hdr*, sizeof(struct rte_ether_hdr));
+    struct rte_icmp_hdr *icmp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_icmp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr));
+
+    struct rte_ether_addr mac_addr;
+    rte_ether_addr_copy(&eth_hdr->src_addr, &mac_addr);
+    rte_ether_addr_copy(&eth_hdr->dst_addr, &eth_hdr->src_addr);
+    rte_ether_addr_copy(&mac_addr, &eth_hdr->dst_addr);
+
+    uint8_t ip_addr[sizeof(ipv6_hdr->src_addr)];
+    memcpy(ip_addr, &ipv6_hdr->src_addr, sizeof(ip_addr));
+    memcpy(&ipv6_hdr->src_addr, &ipv6_hdr->dst_addr, sizeof(ip_addr));
+    memcpy(&ipv6_hdr->dst_addr, ip_addr, sizeof(ip_addr));
+    ipv6_hdr->payload_len = htons(sizeof(struct rte_icmp_hdr) + SIZE_RESPONSE_LEN);
+    ipv6_hdr->hop_limits = 64;
+
+    // Unlike ICMPv4 (where the echo reply is 0), ICMPv6 echo replies are type 129
+    icmp_hdr->icmp_type = RTE_ICMP6_ECHO_REPLY;
+    write_size_response(fb, (uint8_t*)(icmp_hdr + 1));
+
+    // NICs can't offload ICMP checksums, but it's only a few bytes anyway
+    icmp_hdr->icmp_cksum = 0;
+    icmp_hdr->icmp_cksum = rte_ipv6_udptcp_cksum(ipv6_hdr, icmp_hdr);
+    return true;
+}
+
+static bool build_size_response_v4(struct framebuffer* fb, struct rte_mbuf* pkt) {
+    if (!set_pkt_len(pkt, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + SIZE_RESPONSE_LEN))
+        return false;
+
+    struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
+    struct rte_ipv4_hdr *ipv4_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv4_hdr*, sizeof(struct rte_ether_hdr));
+    struct rte_icmp_hdr *icmp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_icmp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr));
+
+    struct rte_ether_addr mac_addr;
+    rte_ether_addr_copy(&eth_hdr->src_addr, &mac_addr);
+    rte_ether_addr_copy(&eth_hdr->dst_addr, &eth_hdr->src_addr);
+    rte_ether_addr_copy(&mac_addr, &eth_hdr->dst_addr);
+
+    rte_be32_t ip_addr = ipv4_hdr->src_addr;
+    ipv4_hdr->src_addr = ipv4_hdr->dst_addr;
+    ipv4_hdr->dst_addr = ip_addr;
+    ipv4_hdr->total_length = htons(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + SIZE_RESPONSE_LEN);
+    ipv4_hdr->time_to_live = 64;
+    ipv4_hdr->hdr_checksum = 0;
+    ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+
+    icmp_hdr->icmp_type = RTE_IP_ICMP_ECHO_REPLY;
+    write_size_response(fb, (uint8_t*)(icmp_hdr + 1));
+
+    icmp_hdr->icmp_cksum = 0;
+    icmp_hdr->icmp_cksum = ~rte_raw_cksum(icmp_hdr, sizeof(struct rte_icmp_hdr) + SIZE_RESPONSE_LEN);
+    return true;
+}
+
+// See decoder_set_multi_pixel(). The shard mask selects the bits of (x << 16 | y) every additional pixel needs to share
+// with the first pixel of the packet.
+static bool multi_pixel = false;
+static uint32_t shard_mask = 0;
+
+void decoder_set_multi_pixel(bool enabled, uint8_t shard_prefix_len) {
+    multi_pixel = enabled;
+    shard_prefix_len = RTE_MIN(RTE_MAX(shard_prefix_len, 64), 96);
+    shard_mask = shard_prefix_len == 64 ? 0 : UINT32_MAX << (96 - shard_prefix_len);
+}
+
+static void decode_extra_pixels_scalar(struct framebuffer* fb, struct decoder_stats* stats, const uint8_t* tuples,
+    uint16_t count, uint32_t shard) {
+    for (uint16_t i = 0; i < count; i++, tuples += MULTI_PIXEL_TUPLE_SIZE) {
+        uint16_t x = (uint16_t)tuples[0] << 8 | tuples[1];
+        uint16_t y = (uint16_t)tuples[2] << 8 | tuples[3];
+        uint32_t rgb = (uint32_t)tuples[4] | (uint32_t)tuples[5] << 8 | (uint32_t)tuples[6] << 16;
+
+        if ((((uint32_t)x << 16 | y) & shard_mask) != shard || !fb_set(fb, x, y, rgb))
+            stats->extra_pixels_rejected++;
+        else
+            stats->extra_pixels++;
+    }
+}
+
+#ifdef RTE_ARCH_X86
+// Decodes 8 tuples at a time. Every 128 bit lane is loaded from the start of two tuples (7 bytes apart), so a load of 4
+// tuples reads 16 bytes starting at the 3rd one, which is why we keep one tuple of distance to the end of the payload.
+__attribute__((target("avx2")))
+static void decode_extra_pixels_avx2(struct framebuffer* fb, struct decoder_stats* stats, const uint8_t* tuples,
+    uint16_t count, uint32_t shard) {
+    // x and y are big endian, these shuffles turn the two tuples of a lane into [x0, x1, y0, y1] and [rgb0, rgb1, 0, 0]
+    const __m256i xy_shuffle = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+        1, 0, -1, -1, 8, 7, -1, -1, 3, 2, -1, -1, 10, 9, -1, -1));
+    const __m256i rgb_shuffle = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+        4, 5, 6, -1, 11, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const __m256i width = _mm256_set1_epi32(fb->width);
+    const __m256i height = _mm256_set1_epi32(fb->height);
+    const __m256i region_x = _mm256_set1_epi32(fb->region_x);
+    const __m256i region_y = _mm256_set1_epi32(fb->region_y);
+    const __m256i mask16 = _mm256_set1_epi32(0xffff);
+    const __m256i mask = _mm256_set1_epi32(shard_mask);
+    const __m256i shard_v = _mm256_set1_epi32(shard);
+    // The unpacks below leave the tuples in this order within the vector (it happens to be its own inverse)
+    static const uint8_t tuple_lane[8] = {0, 1, 4, 5, 2, 3, 6, 7};
+
+    uint32_t idx[8] __rte_aligned(32);
+    uint32_t rgb[8] __rte_aligned(32);
+    int i = 0;
+    for (; count - i > 8; i += 8) {
+        const uint8_t* t = tuples + i * MULTI_PIXEL_TUPLE_SIZE;
+        __m256i a = _mm256_loadu2_m128i((const __m128i*)(t + 2 * MULTI_PIXEL_TUPLE_SIZE), (const __m128i*)t);
+        __m256i b = _mm256_loadu2_m128i((const __m128i*)(t + 6 * MULTI_PIXEL_TUPLE_SIZE),
+            (const __m128i*)(t + 4 * MULTI_PIXEL_TUPLE_SIZE));
+
+        __m256i xy_a = _mm256_shuffle_epi8(a, xy_shuffle);
+        __m256i xy_b = _mm256_shuffle_epi8(b, xy_shuffle);
+        __m256i x = _mm256_unpacklo_epi64(xy_a, xy_b);
+        __m256i y = _mm256_unpackhi_epi64(xy_a, xy_b);
+        __m256i color = _mm256_unpacklo_epi64(_mm256_shuffle_epi8(a, rgb_shuffle), _mm256_shuffle_epi8(b, rgb_shuffle));
+
+        // The shard is about screen coordinates, the bounds and the index about the ones within our region. Like in
+        // fb_pixel_index() the coordinates left of (or above) the region wrap around to large (16 bit) values.
+        __m256i in_shard = _mm256_cmpeq_epi32(
+            _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi32(x, 16), y), mask), shard_v);
+        x = _mm256_and_si256(_mm256_sub_epi32(x, region_x), mask16);
+        y = _mm256_and_si256(_mm256_sub_epi32(y, region_y), mask16);
+        // x and y are at most 16 bit, so the signed compare is fine
+        __m256i valid = _mm256_and_si256(_mm256_cmpgt_epi32(width, x), _mm256_cmpgt_epi32(height, y));
+        valid = _mm256_and_si256(valid, in_shard);
+
+        _mm256_store_si256((__m256i*)idx, _mm256_add_epi32(x, _mm256_mullo_epi32(y, width)));
+        _mm256_store_si256((__m256i*)rgb, color);
+        uint32_t valid_mask = _mm256_movemask_ps(_mm256_castsi256_ps(valid));
+
+        // Written in packet order, so that a later tuple still overwrites an earlier one setting the same pixel
+        for (unsigned j = 0; j < 8; j++) {
+            unsigned lane = tuple_lane[j];
+            if (valid_mask & (1u << lane)) {
+                fb->pixels[idx[lane]] = rgb[lane];
+                fb_mark_dirty(fb, idx[lane]);
+            }
+        }
+        stats->extra_pixels += __builtin_popcount(valid_mask);
+        stats->extra_pixels_rejected += 8 - __builtin_popcount(valid_mask);
+    }
+
+    decode_extra_pixels_scalar(fb, stats, tuples + i * MULTI_PIXEL_TUPLE_SIZE, count - i, shard);
+}
+#endif
+
+static void (*decode_extra_pixels_impl)(struct framebuffer* fb, struct decoder_stats* stats, const uint8_t* tuples,
+    uint16_t count, uint32_t shard) = decode_extra_pixels_scalar;
+
+static inline bool is_multi_pixel(struct rte_ipv6_hdr* ipv6_hdr) {
+    struct rte_udp_hdr* udp_hdr = (struct rte_udp_hdr*)(ipv6_hdr + 1);
+    return multi_pixel && ipv6_hdr->proto == IPPROTO_UDP && udp_hdr->dst_port == htons(PIXELFLUT_V6_MULTI_PIXEL_PORT);
+}
+
+// The number of tuples is taken from the UDP length, but never reaches past the end of the packet
+static void decode_extra_pixels(struct framebuffer* fb, struct decoder_stats* stats, struct rte_mbuf* pkt,
+    uint16_t x, uint16_t y) {
+    const uint32_t udp_offset = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr);
+    struct rte_udp_hdr* udp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_udp_hdr*, udp_offset);
+    if (rte_pktmbuf_data_len(pkt) < udp_offset + sizeof(struct rte_udp_hdr))
+        return;
+
+    uint32_t udp_len = RTE_MIN(ntohs(udp_hdr->dgram_len), rte_pktmbuf_data_len(pkt) - udp_offset);
+    if (udp_len < sizeof(struct rte_udp_hdr))
+        return;
+
+    uint16_t count = (udp_len - sizeof(struct rte_udp_hdr)) / MULTI_PIXEL_TUPLE_SIZE;
+    decode_extra_pixels_impl(fb, stats, (const uint8_t*)(udp_hdr + 1), count, ((uint32_t)x << 16 | y) & shard_mask);
+}
+
+// Returns true in case the packet was turned into a reply, which needs to be sent instead of freed
+static inline bool decode_packet(struct framebuffer* fb, struct decoder_stats* stats, struct rte_mbuf* pkt) {
+    bool was_pingxelflut;
+    struct rte_ether_hdr *eth_hdr;
+    struct rte_ipv4_hdr *ipv4_hdr;
+    struct rte_ipv6_hdr *ipv6_hdr;
+    struct rte_icmp_hdr *icmp_hdr;
+
+    uint8_t msg_kind;
+    uint16_t x, y;
+    uint32_t rgba, icmp_payload_len;
+
+    eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
+
+    // Let's handle pixelflut v6 traffic first, I assume that is a bit more performance-focused
+    if (eth_hdr->ether_type == htons(RTE_ETHER_TYPE_IPV6)) {
+        ipv6_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv6_hdr*, sizeof(struct rte_ether_hdr));
+
+        // As we support both (pingxelflut (ICMP) and pixelflut v6 traffic, we first detect if it's pingxelflut
+        // and only use pixelflut v6 in case it is not)
+        was_pingxelflut = false;
+
+        if (ipv6_hdr->proto == 58 /* ICMPv6 */) {
+            icmp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_icmp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr));
+            if (is_icmp6_echo_request(icmp_hdr)) {
+                msg_kind = *rte_pktmbuf_mtod_offset(pkt, uint8_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr));
+                if (msg_kind == MSG_SET_PIXEL) {
+                    was_pingxelflut = true;
+                    stats->pingxelflut_v6++;
+
+                    x = ntohs(*rte_pktmbuf_mtod_offset(pkt, uint16_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 1));
+                    y = ntohs(*rte_pktmbuf_mtod_offset(pkt, uint16_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 3));
+
+                    icmp_payload_len = pkt->pkt_len - sizeof(struct rte_ether_hdr) - sizeof(struct rte_ipv6_hdr) - sizeof(struct rte_icmp_hdr);
+                    // Packet is only sending rgb
+                    if (icmp_payload_len == 8) {
+                        rgba = *rte_pktmbuf_mtod_offset(pkt, uint32_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 5);
+                        if (!fb_set(fb, x, y, rgba))
+                            stats->out_of_bounds++;
+                    // Packet is sending rgba
+                    } else if (icmp_payload_len == 9) {
+                        rgba = *rte_pktmbuf_mtod_offset(pkt, uint32_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 5);
+                        fb_blend(fb, stats, x, y, rgba);
+                    }
+                } else if (msg_kind == MSG_SIZE_REQUEST) {
+                    was_pingxelflut = true;
+                    stats->pingxelflut_v6++;
+                    return build_size_response_v6(fb, pkt);
+                } else if (msg_kind == MSG_SIZE_RESPONSE) {
+                    was_pingxelflut = true;
+                    stats->pingxelflut_v6++;
+                }
+            }
+        }
+
+        if (!was_pingxelflut) {
+            x = ((uint16_t)ipv6_hdr->dst_addr[8] << 8) | (uint16_t)ipv6_hdr->dst_addr[9];
+            y = ((uint16_t)ipv6_hdr->dst_addr[10] << 8) | (uint16_t)ipv6_hdr->dst_addr[11];
+            rgba = (uint32_t)ipv6_hdr->dst_addr[12] << 0 | (uint32_t)ipv6_hdr->dst_addr[13] << 8 | (uint32_t)ipv6_hdr->dst_addr[14] << 16;
+            // rgba = 0x00ff0000; // blue
+            // rgba = 0x0000ff00; // green
+            // rgba = 0x000000ff; // red
+            // printf("[DEBUG] x: %d, y: %d, rgba: %08x\n", x, y, rgba);
+
+            stats->pixelflut_v6++;
+            if (!fb_set(fb, x, y, rgba))
+                stats->out_of_bounds++;
+            if (is_multi_pixel(ipv6_hdr))
+                decode_extra_pixels(fb, stats, pkt, x, y);
+        }
+    } else if (eth_hdr->ether_type == htons(RTE_ETHER_TYPE_IPV4)) {
+        ipv4_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv4_hdr*, sizeof(struct rte_ether_hdr));
+        if (ipv4_hdr->next_proto_id == IPPROTO_ICMP) {
+            icmp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_icmp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr));
+            if (icmp_hdr->icmp_type == RTE_IP_ICMP_ECHO_REQUEST && icmp_hdr->icmp_code == 0) {
+                msg_kind = *rte_pktmbuf_mtod_offset(pkt, uint8_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr));
+                if (msg_kind == MSG_SET_PIXEL) {
+                    stats->pingxelflut_v4++;
+                    x = ntohs(*rte_pktmbuf_mtod_offset(pkt, uint16_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + 1));
+                    y = ntohs(*rte_pktmbuf_mtod_offset(pkt, uint16_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + 3));
+
+                    icmp_payload_len = pkt->pkt_len - sizeof(struct rte_ether_hdr) - sizeof(struct rte_ipv4_hdr) - sizeof(struct rte_icmp_hdr);
+                    // Packet is only sending rgb
+                    if (icmp_payload_len == 8) {
+                        rgba = *rte_pktmbuf_mtod_offset(pkt, uint32_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + 5);
+                        if (!fb_set(fb, x, y, rgba))
+                            stats->out_of_bounds++;
+                    // Packet is sending rgba
+                    } else if (icmp_payload_len == 9) {
+                        rgba = *rte_pktmbuf_mtod_offset(pkt, uint32_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + 5);
+                        fb_blend(fb, stats, x, y, rgba);
+                    }
+                    return false;
+                } else if (msg_kind == MSG_SIZE_REQUEST) {
+                    stats->pingxelflut_v4++;
+                    return build_size_response_v4(fb, pkt);
+                } else if (msg_kind == MSG_SIZE_RESPONSE) {
+                    stats->pingxelflut_v4++;
+                    return false;
+                }
+            }
+        }
+        stats->unknown++;
+    } else {
+        stats->unknown++;
+    }
+
+    return false;
+}
+
+// Decodes the packet in the given slot of the burst. In case it was turned into a reply, it's moved from the burst to
+// `reply`. Returns the number of replies (0 or 1).
+static inline uint16_t decode_slot(struct framebuffer* fb, struct decoder_stats* stats, struct rte_mbuf** slot,
+    struct rte_mbuf** reply) {
+    if (likely(!decode_packet(fb, stats, *slot)))
+        return 0;
+
+    *reply = *slot;
+    *slot = NULL;
+    return 1;
+}
+
+// Needs to classify the packets the same way decode_packet() does
+int decoder_pixel_row(struct rte_mbuf* pkt) {
+    struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
+    struct rte_icmp_hdr *icmp_hdr;
+    uint8_t* payload;
+
+    if (eth_hdr->ether_type == htons(RTE_ETHER_TYPE_IPV6)) {
+        struct rte_ipv6_hdr *ipv6_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv6_hdr*, sizeof(struct rte_ether_hdr));
+        if (ipv6_hdr->proto == 58 /* ICMPv6 */) {
+            icmp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_icmp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr));
+            payload = (uint8_t*)(icmp_hdr + 1);
+            if (is_icmp6_echo_request(icmp_hdr)) {
+                if (payload[0] == MSG_SET_PIXEL)
+                    return ntohs(*(unaligned_uint16_t*)(payload + 3));
+                if (payload[0] == MSG_SIZE_REQUEST || payload[0] == MSG_SIZE_RESPONSE)
+                    return -1;
+            }
+        }
+        // Multi-pixel packets go with the row of their first pixel. The additional pixels can be anywhere within the
+        // shard, but the clients keep them on the same row (at least in raster and shard order) nearly all the time.
+        return ((uint16_t)ipv6_hdr->dst_addr[10] << 8) | (uint16_t)ipv6_hdr->dst_addr[11];
+    } else if (eth_hdr->ether_type == htons(RTE_ETHER_TYPE_IPV4)) {
+        struct rte_ipv4_hdr *ipv4_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv4_hdr*, sizeof(struct rte_ether_hdr));
+        if (ipv4_hdr->next_proto_id == IPPROTO_ICMP) {
+            icmp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_icmp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr));
+            payload = (uint8_t*)(icmp_hdr + 1);
+            if (icmp_hdr->icmp_type == RTE_IP_ICMP_ECHO_REQUEST && icmp_hdr->icmp_code == 0 && payload[0] == MSG_SET_PIXEL)
+                return ntohs(*(unaligned_uint16_t*)(payload + 3));
+        }
+    }
+
+    return -1;
+}
+
+// How many packets ahead the headers and the framebuffer pixels are prefetched
+static uint16_t prefetch_headers = DEFAULT_PREFETCH_HEADERS;
+static uint16_t prefetch_pixels = DEFAULT_PREFETCH_PIXELS;
+
+void decoder_set_prefetch(uint16_t headers, uint16_t pixels) {
+    prefetch_headers = headers;
+    prefetch_pixels = pixels;
+}
+
+// Pixelflut v6 only needs the first cache line, so we don't bother prefetching the rest of the (pingxelflut) packet
+static inline void prefetch_header_range(struct rte_mbuf** pkts, uint16_t from, uint16_t to) {
+    for (uint16_t i = from; i < to; i++) {
+        rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void*));
+    }
+}
+
+// Returns the pixel the packet is going to set, so that it can be prefetched. pingxelflut is rare enough that we only
+// look at pixelflut v6 packets here, NULL is returned for everything else.
+static inline uint32_t* peek_pixel(struct framebuffer* fb, struct rte_mbuf* pkt) {
+    struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
+    if (eth_hdr->ether_type != htons(RTE_ETHER_TYPE_IPV6))
+        return NULL;
+
+    struct rte_ipv6_hdr *ipv6_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv6_hdr*, sizeof(struct rte_ether_hdr));
+    if (ipv6_hdr->proto == 58 /* ICMPv6 */)
+        return NULL;
+
+    uint16_t x = ((uint16_t)ipv6_hdr->dst_addr[8] << 8) | (uint16_t)ipv6_hdr->dst_addr[9];
+    uint16_t y = ((uint16_t)ipv6_hdr->dst_addr[10] << 8) | (uint16_t)ipv6_hdr->dst_addr[11];
+    uint32_t pixel_index;
+    if (!fb_pixel_index(fb, x, y, &pixel_index))
+        return NULL;
+
+    return &fb->pixels[pixel_index];
+}
+
+static inline void prefetch_pixel(struct framebuffer* fb, struct rte_mbuf* pkt) {
+    uint32_t* pixel = peek_pixel(fb, pkt);
+    if (pixel != NULL)
+        rte_prefetch0_write(pixel);
+}
+
+// Software pipeline: While packet i gets decoded, the framebuffer line of packet i + prefetch_pixels and the header of
+// packet i + prefetch_headers are already on their way into the cache.
+static uint16_t decode_burst_scalar(struct framebuffer* fb, struct decoder_stats* stats, struct rte_mbuf** pkts,
+    uint16_t nb_pkts, struct rte_mbuf** replies) {
+    uint16_t nb_replies = 0;
+    const uint16_t headers = prefetch_headers;
+    const uint16_t pixels = prefetch_pixels;
+
+    prefetch_header_range(pkts, 0, RTE_MIN(nb_pkts, headers));
+    if (pixels > 0) {
+        for (uint16_t i = 0; i < RTE_MIN(nb_pkts, pixels); i++)
+            prefetch_pixel(fb, pkts[i]);
+    }
+
+    for (uint16_t i = 0; i < nb_pkts; i++) {
+        if (i + headers < nb_pkts)
+            rte_prefetch0(rte_pktmbuf_mtod(pkts[i + headers], void*));
+        if (pixels > 0 && i + pixels < nb_pkts)
+            prefetch_pixel(fb, pkts[i + pixels]);
+
+        nb_replies += decode_slot(fb, stats, &pkts[i], &replies[nb_replies]);
+    }
+
+    return nb_replies;
+}
+
+#ifdef RTE_ARCH_X86
+
+// Offsets within the packet of the 32 bit words the SIMD decoders gather. All of them are relative to the start of the
+// Ethernet header, as we gather from the packet data pointers directly.
+#define OFFSET_ETHER_TYPE (offsetof(struct rte_ether_hdr, ether_type))
+#define OFFSET_IPV6_PROTO (sizeof(struct rte_ether_hdr) + offsetof(struct rte_ipv6_hdr, proto))
+// dst_addr[8..11] are x and y, dst_addr[12..14] are r, g and b
+#define OFFSET_IPV6_XY (sizeof(struct rte_ether_hdr) + offsetof(struct rte_ipv6_hdr, dst_addr) + 8)
+#define OFFSET_IPV6_RGB (sizeof(struct rte_ether_hdr) + offsetof(struct rte_ipv6_hdr, dst_addr) + 12)
+// UDP source port in the lower and destination port in the upper 16 bits, only gathered for multi-pixel packets
+#define OFFSET_UDP_PORTS (sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr))
+
+// A group of packets classified and decoded by one of the SIMD decoders, but not yet applied to the framebuffer. The
+// SIMD decoders keep one group in flight, so that the framebuffer lines of a group can be prefetched while the previous
+// group is written.
+struct simd_group {
+    struct rte_mbuf** pkts;
+    // Lanes that are plain pixelflut v6 packets within the framebuffer
+    uint32_t fast_mask;
+    // Lanes that might be pingxelflut (or IPv4 in general) or are multi-pixel packets, which are handed to the scalar
+    // decoder
+    uint32_t slow_mask;
+    uint32_t idx[16] __rte_aligned(64);
+    uint32_t rgb[16] __rte_aligned(64);
+};
+
+static inline uint64_t pkt_data_addr(struct rte_mbuf* pkt) {
+    return (uint64_t)(uintptr_t)rte_pktmbuf_mtod(pkt, char*);
+}
+
+static inline void prefetch_group(struct framebuffer* fb, const struct simd_group* group) {
+    uint32_t mask = group->fast_mask;
+    while (mask) {
+        unsigned lane = __builtin_ctz(mask);
+        rte_prefetch0_write(&fb->pixels[group->idx[lane]]);
+        mask &= mask - 1;
+    }
+}
+
+// The slow lanes are counted by decode_packet() later on
+static inline void count_group(struct decoder_stats* stats, const struct simd_group* group, uint32_t v6_mask,
+    unsigned lanes) {
+    stats->pixelflut_v6 += __builtin_popcount(v6_mask);
+    stats->out_of_bounds += __builtin_popcount(v6_mask & ~group->fast_mask);
+    stats->unknown += lanes - __builtin_popcount(v6_mask | group->slow_mask);
+}
+
+// All lanes that are neither fast nor slow are dropped. The lanes are walked in packet order, so that a later packet
+// still overwrites an earlier one setting the same pixel.
+static inline uint16_t apply_group(struct framebuffer* fb, struct decoder_stats* stats, const struct simd_group* group,
+    unsigned lanes, struct rte_mbuf** replies) {
+    uint16_t nb_replies = 0;
+    for (unsigned lane = 0; lane < lanes; lane++) {
+        if (group->fast_mask & (1u << lane)) {
+            fb->pixels[group->idx[lane]] = group->rgb[lane];
+            fb_mark_dirty(fb, group->idx[lane]);
+        } else if (group->slow_mask & (1u << lane)) {
+            nb_replies += decode_slot(fb, stats, &group->pkts[lane], &replies[nb_replies]);
+        }
+    }
+
+    return nb_replies;
+}
+
+// Same as blend_pixel(), but for 16 channels in 16 bit lanes
+__attribute__((target("avx2")))
+static inline __m256i blend_channels_avx2(__m256i src, __m256i dst, __m256i alpha, __m256i inv_alpha) {
+    __m256i t = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(src, alpha), _mm256_mullo_epi16(dst, inv_alpha)),
+        _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// Blends the whole batch at once, 8 pixels in 16 bit lanes per channel. Pixels that are set multiple times within a batch
+// need to be blended one after the other, which is left to the scalar version.
+__attribute__((target("avx2")))
+static void blend_batch_avx2(struct framebuffer* fb, struct blend_batch* batch) {
+    // Unused lanes get distinct indices that are never valid, so that they are not taken as duplicates
+    for (uint16_t i = batch->count; i < BLEND_BATCH_SIZE; i++)
+        batch->idx[i] = UINT32_MAX - i;
+
+    __m256i idx = _mm256_load_si256((const __m256i*)batch->idx);
+    __m256i conflicts = _mm256_setzero_si256();
+    for (int rotation = 1; rotation <= BLEND_BATCH_SIZE / 2; rotation++) {
+        __m256i rotate = _mm256_setr_epi32(rotation, rotation + 1, rotation + 2, rotation + 3, rotation + 4,
+            rotation + 5, rotation + 6, rotation + 7);
+        rotate = _mm256_and_si256(rotate, _mm256_set1_epi32(BLEND_BATCH_SIZE - 1));
+        conflicts = _mm256_or_si256(conflicts, _mm256_cmpeq_epi32(idx, _mm256_permutevar8x32_epi32(idx, rotate)));
+    }
+    if (unlikely(!_mm256_testz_si256(conflicts, conflicts))) {
+        blend_batch_scalar(fb, batch);
+        return;
+    }
+
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(batch->count), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i dst = _mm256_mask_i32gather_epi32(zero, (const int*)fb->pixels, idx, valid, 4);
+    __m256i src = _mm256_load_si256((const __m256i*)batch->rgb);
+
+    // Every pixel needs its alpha in all four of its 16 bit channels
+    __m256i alpha = _mm256_load_si256((const __m256i*)batch->alpha);
+    alpha = _mm256_or_si256(alpha, _mm256_slli_epi32(alpha, 16));
+    __m256i inv_alpha = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+
+    __m256i lo = blend_channels_avx2(_mm256_unpacklo_epi8(src, zero), _mm256_unpacklo_epi8(dst, zero),
+        _mm256_unpacklo_epi32(alpha, alpha), _mm256_unpacklo_epi32(inv_alpha, inv_alpha));
+    __m256i hi = blend_channels_avx2(_mm256_unpackhi_epi8(src, zero), _mm256_unpackhi_epi8(dst, zero),
+        _mm256_unpackhi_epi32(alpha, alpha), _mm256_unpackhi_epi32(inv_alpha, inv_alpha));
+
+    uint32_t blended[BLEND_BATCH_SIZE] __rte_aligned(32);
+    _mm256_store_si256((__m256i*)blended,
+        _mm256_and_si256(_mm256_packus_epi16(lo, hi), _mm256_set1_epi32(0x00ffffff)));
+
+    // AVX2 has no scatter
+    for (uint16_t i = 0; i < batch->count; i++) {
+        fb->pixels[batch->idx[i]] = blended[i];
+        fb_mark_dirty(fb, batch->idx[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+static uint16_t decode_burst_avx2(struct framebuffer* fb, struct decoder_stats* stats, struct rte_mbuf** pkts,
+    uint16_t nb_pkts, struct rte_mbuf** replies) {
+    const __m256i mask8 = _mm256_set1_epi32(0xff);
+    const __m256i mask16 = _mm256_set1_epi32(0xffff);
+    const __m256i rgb_mask = _mm256_set1_epi32(0x00ffffff);
+    const __m256i ether_type_ipv6 = _mm256_set1_epi32(htons(RTE_ETHER_TYPE_IPV6));
+    const __m256i ether_type_ipv4 = _mm256_set1_epi32(htons(RTE_ETHER_TYPE_IPV4));
+    const __m256i proto_icmpv6 = _mm256_set1_epi32(58);
+    const __m256i proto_udp = _mm256_set1_epi32(IPPROTO_UDP);
+    const __m256i multi_pixel_port = _mm256_set1_epi32(htons(PIXELFLUT_V6_MULTI_PIXEL_PORT));
+    const __m256i width = _mm256_set1_epi32(fb->width);
+    const __m256i height = _mm256_set1_epi32(fb->height);
+    const __m256i region_x = _mm256_set1_epi32(fb->region_x);
+    const __m256i region_y = _mm256_set1_epi32(fb->region_y);
+    // x and y are big endian in the address, these shuffles swap them into the lower 16 bits of each lane
+    const __m256i x_shuffle = _mm256_setr_epi8(
+        1, 0, -1, -1, 5, 4, -1, -1, 9, 8, -1, -1, 13, 12, -1, -1,
+        1, 0, -1, -1, 5, 4, -1, -1, 9, 8, -1, -1, 13, 12, -1, -1);
+    const __m256i y_shuffle = _mm256_setr_epi8(
+        3, 2, -1, -1, 7, 6, -1, -1, 11, 10, -1, -1, 15, 14, -1, -1,
+        3, 2, -1, -1, 7, 6, -1, -1, 11, 10, -1, -1, 15, 14, -1, -1);
+
+    const uint16_t headers = prefetch_headers;
+    const uint16_t pixels = prefetch_pixels;
+    struct simd_group groups[2];
+    struct simd_group* pending = NULL;
+    uint16_t nb_replies = 0;
+
+    prefetch_header_range(pkts, 0, RTE_MIN(nb_pkts, headers));
+
+    uint16_t i = 0;
+    for (; i + 8 <= nb_pkts; i += 8) {
+        prefetch_header_range(pkts, RTE_MIN(nb_pkts, i + headers), RTE_MIN(nb_pkts, i + headers + 8));
+
+        struct simd_group* group = &groups[(i / 8) & 1];
+        group->pkts = &pkts[i];
+
+        __m256i addr_lo = _mm256_setr_epi64x(pkt_data_addr(pkts[i + 0]), pkt_data_addr(pkts[i + 1]),
+            pkt_data_addr(pkts[i + 2]), pkt_data_addr(pkts[i + 3]));
+        __m256i addr_hi = _mm256_setr_epi64x(pkt_data_addr(pkts[i + 4]), pkt_data_addr(pkts[i + 5]),
+            pkt_data_addr(pkts[i + 6]), pkt_data_addr(pkts[i + 7]));
+
+#define GATHER8(offset) _mm256_set_m128i( \
+            _mm256_i64gather_epi32((const int*)(uintptr_t)(offset), addr_hi, 1), \
+            _mm256_i64gather_epi32((const int*)(uintptr_t)(offset), addr_lo, 1))
+
+        __m256i ether_type = _mm256_and_si256(GATHER8(OFFSET_ETHER_TYPE), mask16);
+        __m256i proto = _mm256_and_si256(GATHER8(OFFSET_IPV6_PROTO), mask8);
+
+        __m256i is_ipv6 = _mm256_cmpeq_epi32(ether_type, ether_type_ipv6);
+        __m256i is_ipv4 = _mm256_cmpeq_epi32(ether_type, ether_type_ipv4);
+        __m256i is_icmpv6 = _mm256_cmpeq_epi32(proto, proto_icmpv6);
+        // Everything that is IPv6 but not ICMPv6 is pixelflut v6. ICMPv6 and IPv4 might be pingxelflut.
+        __m256i is_v6 = _mm256_andnot_si256(is_icmpv6, is_ipv6);
+        __m256i is_slow = _mm256_or_si256(_mm256_and_si256(is_icmpv6, is_ipv6), is_ipv4);
+        if (multi_pixel) {
+            // Multi-pixel packets are decoded (and counted) completely by decode_packet()
+            __m256i dst_port = _mm256_srli_epi32(GATHER8(OFFSET_UDP_PORTS), 16);
+            __m256i is_multi = _mm256_and_si256(is_v6, _mm256_and_si256(_mm256_cmpeq_epi32(proto, proto_udp),
+                _mm256_cmpeq_epi32(dst_port, multi_pixel_port)));
+            is_v6 = _mm256_andnot_si256(is_multi, is_v6);
+            is_slow = _mm256_or_si256(is_slow, is_multi);
+        }
+
+        __m256i xy = GATHER8(OFFSET_IPV6_XY);
+        // Relative to our region, the coordinates left of (or above) it wrap around to large values (see
+        // fb_pixel_index())
+        __m256i x = _mm256_and_si256(_mm256_sub_epi32(_mm256_shuffle_epi8(xy, x_shuffle), region_x), mask16);
+        __m256i y = _mm256_and_si256(_mm256_sub_epi32(_mm256_shuffle_epi8(xy, y_shuffle), region_y), mask16);
+        __m256i color = _mm256_and_si256(GATHER8(OFFSET_IPV6_RGB), rgb_mask);
+#undef GATHER8
+
+        // x and y are at most 16 bit, so the signed compare is fine
+        __m256i in_bounds = _mm256_and_si256(_mm256_cmpgt_epi32(width, x), _mm256_cmpgt_epi32(height, y));
+        __m256i fast = _mm256_and_si256(is_v6, in_bounds);
+
+        _mm256_store_si256((__m256i*)group->idx, _mm256_add_epi32(x, _mm256_mullo_epi32(y, width)));
+        _mm256_store_si256((__m256i*)group->rgb, color);
+        group->fast_mask = _mm256_movemask_ps(_mm256_castsi256_ps(fast));
+        group->slow_mask = _mm256_movemask_ps(_mm256_castsi256_ps(is_slow));
+        count_group(stats, group, _mm256_movemask_ps(_mm256_castsi256_ps(is_v6)), 8);
+
+        if (pixels == 0) {
+            nb_replies += apply_group(fb, stats, group, 8, &replies[nb_replies]);
+            continue;
+        }
+
+        prefetch_group(fb, group);
+        if (pending != NULL)
+            nb_replies += apply_group(fb, stats, pending, 8, &replies[nb_replies]);
+        pending = group;
+    }
+
+    if (pending != NULL)
+        nb_replies += apply_group(fb, stats, pending, 8, &replies[nb_replies]);
+
+    return nb_replies + decode_burst_scalar(fb, stats, &pkts[i], nb_pkts - i, &replies[nb_replies]);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline uint16_t apply_group_avx512(struct framebuffer* fb, struct decoder_stats* stats,
+    const struct simd_group* group, struct rte_mbuf** replies) {
+    if (likely(group->slow_mask == 0)) {
+        // Scatter stores to overlapping indices are ordered from the lowest to the highest lane, so the packet
+        // order is kept
+        _mm512_mask_i32scatter_epi32(fb->pixels, group->fast_mask, _mm512_load_si512(group->idx),
+            _mm512_load_si512(group->rgb), 4);
+
+        uint32_t mask = group->fast_mask;
+        while (mask) {
+            fb_mark_dirty(fb, group->idx[__builtin_ctz(mask)]);
+            mask &= mask - 1;
+        }
+        return 0;
+    }
+
+    return apply_group(fb, stats, group, 16, replies);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint16_t decode_burst_avx512(struct framebuffer* fb, struct decoder_stats* stats, struct rte_mbuf** pkts,
+    uint16_t nb_pkts, struct rte_mbuf** replies) {
+    const __m512i mask8 = _mm512_set1_epi32(0xff);
+    const __m512i mask16 = _mm512_set1_epi32(0xffff);
+    const __m512i rgb_mask = _mm512_set1_epi32(0x00ffffff);
+    const __m512i ether_type_ipv6 = _mm512_set1_epi32(htons(RTE_ETHER_TYPE_IPV6));
+    const __m512i ether_type_ipv4 = _mm512_set1_epi32(htons(RTE_ETHER_TYPE_IPV4));
+    const __m512i proto_icmpv6 = _mm512_set1_epi32(58);
+    const __m512i proto_udp = _mm512_set1_epi32(IPPROTO_UDP);
+    const __m512i multi_pixel_port = _mm512_set1_epi32(htons(PIXELFLUT_V6_MULTI_PIXEL_PORT));
+    const __m512i width = _mm512_set1_epi32(fb->width);
+    const __m512i height = _mm512_set1_epi32(fb->height);
+    const __m512i region_x = _mm512_set1_epi32(fb->region_x);
+    const __m512i region_y = _mm512_set1_epi32(fb->region_y);
+    // x and y are big endian in the address, these shuffles swap them into the lower 16 bits of each lane
+    const __m512i x_shuffle = _mm512_broadcast_i32x4(_mm_setr_epi8(
+        1, 0, -1, -1, 5, 4, -1, -1, 9, 8, -1, -1, 13, 12, -1, -1));
+    const __m512i y_shuffle = _mm512_broadcast_i32x4(_mm_setr_epi8(
+        3, 2, -1, -1, 7, 6, -1, -1, 11, 10, -1, -1, 15, 14, -1, -1));
+
+    const uint16_t headers = prefetch_headers;
+    const uint16_t pixels = prefetch_pixels;
+    struct simd_group groups[2];
+    struct simd_group* pending = NULL;
+    uint16_t nb_replies = 0;
+
+    prefetch_header_range(pkts, 0, RTE_MIN(nb_pkts, headers));
+
+    uint16_t i = 0;
+    for (; i + 16 <= nb_pkts; i += 16) {
+        prefetch_header_range(pkts, RTE_MIN(nb_pkts, i + headers), RTE_MIN(nb_pkts, i + headers + 16));
+
+        struct simd_group* group = &groups[(i / 16) & 1];
+        group->pkts = &pkts[i];
+
+        __m512i addr_lo = _mm512_setr_epi64(pkt_data_addr(pkts[i + 0]), pkt_data_addr(pkts[i + 1]),
+            pkt_data_addr(pkts[i + 2]), pkt_data_addr(pkts[i + 3]), pkt_data_addr(pkts[i + 4]),
+            pkt_data_addr(pkts[i + 5]), pkt_data_addr(pkts[i + 6]), pkt_data_addr(pkts[i + 7]));
+        __m512i addr_hi = _mm512_setr_epi64(pkt_data_addr(pkts[i + 8]), pkt_data_addr(pkts[i + 9]),
+            pkt_data_addr(pkts[i + 10]), pkt_data_addr(pkts[i + 11]), pkt_data_addr(pkts[i + 12]),
+            pkt_data_addr(pkts[i + 13]), pkt_data_addr(pkts[i + 14]), pkt_data_addr(pkts[i + 15]));
+
+#define GATHER16(offset) _mm512_inserti64x4(_mm512_castsi256_si512( \
+            _mm512_i64gather_epi32(addr_lo, (const void*)(uintptr_t)(offset), 1)), \
+            _mm512_i64gather_epi32(addr_hi, (const void*)(uintptr_t)(offset), 1), 1)
+
+        __m512i ether_type = _mm512_and_si512(GATHER16(OFFSET_ETHER_TYPE), mask16);
+        __m512i proto = _mm512_and_si512(GATHER16(OFFSET_IPV6_PROTO), mask8);
+
+        __mmask16 is_ipv6 = _mm512_cmpeq_epi32_mask(ether_type, ether_type_ipv6);
+        __mmask16 is_ipv4 = _mm512_cmpeq_epi32_mask(ether_type, ether_type_ipv4);
+        __mmask16 is_icmpv6 = _mm512_cmpeq_epi32_mask(proto, proto_icmpv6);
+        // Everything that is IPv6 but not ICMPv6 is pixelflut v6. ICMPv6 and IPv4 might be pingxelflut.
+        __mmask16 is_v6 = is_ipv6 & ~is_icmpv6;
+        __mmask16 is_slow = (is_ipv6 & is_icmpv6) | is_ipv4;
+        if (multi_pixel) {
+            // Multi-pixel packets are decoded (and counted) completely by decode_packet()
+            __m512i dst_port = _mm512_srli_epi32(GATHER16(OFFSET_UDP_PORTS), 16);
+            __mmask16 is_multi = is_v6 & _mm512_cmpeq_epi32_mask(proto, proto_udp)
+                & _mm512_cmpeq_epi32_mask(dst_port, multi_pixel_port);
+            is_v6 &= ~is_multi;
+            is_slow |= is_multi;
+        }
+
+        __m512i xy = GATHER16(OFFSET_IPV6_XY);
+        // Relative to our region, the coordinates left of (or above) it wrap around to large values (see
+        // fb_pixel_index())
+        __m512i x = _mm512_and_si512(_mm512_sub_epi32(_mm512_shuffle_epi8(xy, x_shuffle), region_x), mask16);
+        __m512i y = _mm512_and_si512(_mm512_sub_epi32(_mm512_shuffle_epi8(xy, y_shuffle), region_y), mask16);
+        __m512i color = _mm512_and_si512(GATHER16(OFFSET_IPV6_RGB), rgb_mask);
+#undef GATHER16
+
+        _mm512_store_si512(group->idx, _mm512_add_epi32(x, _mm512_mullo_epi32(y, width)));
+        _mm512_store_si512(group->rgb, color);
+        group->fast_mask = is_v6 & _mm512_cmplt_epu32_mask(x, width) & _mm512_cmplt_epu32_mask(y, height);
+        group->slow_mask = is_slow;
+        count_group(stats, group, is_v6, 16);
+
+        if (pixels == 0) {
+            nb_replies += apply_group_avx512(fb, stats, group, &replies[nb_replies]);
+            continue;
+        }
+
+        prefetch_group(fb, group);
+        if (pending != NULL)
+            nb_replies += apply_group_avx512(fb, stats, pending, &replies[nb_replies]);
+        pending = group;
+    }
+
+    if (pending != NULL)
+        nb_replies += apply_group_avx512(fb, stats, pending, &replies[nb_replies]);
+
+    return nb_replies + decode_burst_avx2(fb, stats, &pkts[i], nb_pkts - i, &replies[nb_replies]);
+}
+
+#endif
+
+static uint16_t (*decode_burst_impl)(struct framebuffer* fb, struct decoder_stats* stats, struct rte_mbuf** pkts,
+    uint16_t nb_pkts, struct rte_mbuf** replies) = decode_burst_scalar;
+
+static const char* decoder_impl_names[NUM_DECODER_IMPLS] = {
+    [DECODER_AUTO] = "auto",
+    [DECODER_SCALAR] = "scalar",
+    [DECODER_AVX2] = "avx2",
+    [DECODER_AVX512] = "avx512",
+};
+
+const char* decoder_impl_name(enum decoder_impl impl) {
+    return impl < NUM_DECODER_IMPLS ? decoder_impl_names[impl] : "unknown";
+}
+
+static bool decoder_impl_supported(struct framebuffer* fb, enum decoder_impl impl) {
+    switch (impl) {
+        case DECODER_SCALAR:
+            return true;
+#ifdef RTE_ARCH_X86
+        case DECODER_AVX2:
+            return rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) && rte_vect_get_max_simd_bitwidth() >= RTE_VECT_SIMD_256;
+        case DECODER_AVX512:
+            // The scatter uses signed 32 bit indices, which is plenty for every framebuffer I can think of
+            return rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX512F) && rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX512BW)
+                && rte_vect_get_max_simd_bitwidth() >= RTE_VECT_SIMD_512
+                && (uint64_t)fb->width * fb->height <= INT32_MAX;
+#endif
+        default:
+            return false;
+    }
+}
+
+int decoder_init(struct framebuffer* fb, enum decoder_impl impl) {
+    if (impl == DECODER_AUTO) {
+        impl = DECODER_SCALAR;
+        if (decoder_impl_supported(fb, DECODER_AVX2))
+            impl = DECODER_AVX2;
+        if (decoder_impl_supported(fb, DECODER_AVX512))
+            impl = DECODER_AVX512;
+    }
+
+    if (!decoder_impl_supported(fb, impl))
+        return -ENOTSUP;
+
+    switch (impl) {
+#ifdef RTE_ARCH_X86
+        case DECODER_AVX2:
+            decode_burst_impl = decode_burst_avx2;
+            blend_batch_impl = blend_batch_avx2;
+            decode_extra_pixels_impl = decode_extra_pixels_avx2;
+            break;
+        case DECODER_AVX512:
+            decode_burst_impl = decode_burst_avx512;
+            blend_batch_impl = blend_batch_avx2;
+            decode_extra_pixels_impl = decode_extra_pixels_avx2;
+            break;
+#endif
+        default:
+            decode_burst_impl = decode_burst_scalar;
+            blend_batch_impl = blend_batch_scalar;
+            decode_extra_pixels_impl = decode_extra_pixels_scalar;
+            break;
+    }
+
+    return impl;
+}
+
+uint16_t decode_burst(struct framebuffer* fb, struct decoder_stats* stats, struct rte_mbuf** pkts, uint16_t nb_pkts,
+    struct rte_mbuf** replies) {
+    uint16_t nb_replies = decode_burst_impl(fb, stats, pkts, nb_pkts, replies);
+    blend_flush(fb);
+    return nb_replies;
+}
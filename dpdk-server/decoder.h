@@ -0,0 +1,65 @@
+#ifndef _DECODER_H_
+#define _DECODER_H_
+
+#include <rte_mbuf.h>
+
+#include "framebuffer.h"
+#include "stats.h"
+
+// pingxelflut protocol constants
+#define MSG_SIZE_REQUEST 0xaa
+#define MSG_SIZE_RESPONSE 0xbb
+#define MSG_SET_PIXEL 0xcc
+
+// Multi-pixel extension of pixelflut v6: A pixelflut v6 packet sent to this UDP destination port carries additional
+// pixels as (x, y, r, g, b) tuples in its UDP payload, x and y are big endian. The first pixel still is the one in the
+// destination address. See decoder_set_multi_pixel().
+#define PIXELFLUT_V6_MULTI_PIXEL_PORT 0x7078 // "px"
+#define MULTI_PIXEL_TUPLE_SIZE 7
+
+// Default distances (in packets) of the software pipeline, see decoder_set_prefetch()
+#define DEFAULT_PREFETCH_HEADERS 8
+#define DEFAULT_PREFETCH_PIXELS 4
+
+enum decoder_impl {
+    DECODER_AUTO,
+    DECODER_SCALAR,
+    DECODER_AVX2,
+    DECODER_AVX512,
+    NUM_DECODER_IMPLS,
+};
+
+// Selects the decode_burst implementation. DECODER_AUTO picks the fastest one the CPU supports (and EAL allows via
+// --force-max-simd-bitwidth). Returns the selected implementation or -ENOTSUP in case the requested one is not supported.
+int decoder_init(struct framebuffer* fb, enum decoder_impl impl);
+const char* decoder_impl_name(enum decoder_impl impl);
+
+// While decoding a packet, the header of the packet `headers` packets ahead and the framebuffer pixel of the packet
+// `pixels` packets ahead are prefetched. `pixels` should be smaller than `headers`, as we need to read the header to
+// know which pixel will be written. The SIMD decoders prefetch one group of packets ahead in case `pixels` is non-zero.
+// A distance of zero disables the prefetching.
+void decoder_set_prefetch(uint16_t headers, uint16_t pixels);
+
+// Enables decoding the additional pixels of multi-pixel packets, otherwise they are plain pixelflut v6 packets.
+// As the additional pixels are not part of the destination address, they can't be routed. So in case the screen is
+// split across multiple servers by routing a part of the address space to each of them, `shard_prefix_len` is the
+// length of the prefix routed to this server (64 to 96). Only additional pixels within the same prefix as the first
+// pixel are accepted, i.e. the top (shard_prefix_len - 64) bits of x and y. 64 accepts everything.
+void decoder_set_multi_pixel(bool enabled, uint8_t shard_prefix_len);
+
+// Decodes all pixelflut v6 and pingxelflut packets of the burst and applies them to the framebuffer. Every packet is
+// counted in `stats`, which should only be written by the calling lcore.
+// The mbufs are *not* freed, this is the responsibility of the caller. This way the decoder can be benchmarked without
+// any NIC by feeding it the same synthetic mbufs over and over again.
+// Packets that need an answer (pingxelflut SIZE_REQUEST) are turned into the reply in place. They are moved from
+// `pkts` (leaving a NULL, which rte_pktmbuf_free_bulk() skips) to `replies`, which needs room for nb_pkts mbufs.
+// Returns the number of replies, which the caller needs to send.
+uint16_t decode_burst(struct framebuffer* fb, struct decoder_stats* stats, struct rte_mbuf** pkts, uint16_t nb_pkts,
+    struct rte_mbuf** replies);
+
+// Returns the row (y coordinate) the packet sets a pixel in, without decoding anything else. Returns -1 for packets
+// that don't set a pixel, e.g. a pingxelflut SIZE_REQUEST or packets of unknown protocols. For multi-pixel packets it's
+// the row of the first pixel.
+int decoder_pixel_row(struct rte_mbuf* pkt);
+
+#endif
@@ -0,0 +1,70 @@
+#!/usr/bin/env bash
+# End-to-end benchmark of the pixelflut-v6-server without any NIC. For every traffic pattern traffic-gen writes one pcap
+# file per RX queue, which the server replays over and over again using the net_pcap vdev. After RUN_TIME seconds the
+# server writes the per lcore packet rates and drop counters, afterwards the framebuffer is checked against the expected
+# one. The net_null vdev (which only delivers empty packets) serves as baseline of the pure RX overhead.
+#
+# Every run is a line of JSON in $OUTPUT, so that the results of different versions can be compared. The script exits
+# with 1 in case any framebuffer was wrong.
+#
+# Needs to run as root (or with the permissions DPDK needs), e.g.: make e2e or sudo ./e2e-bench.sh
+set -euo pipefail
+cd "$(dirname "$0")"
+
+WIDTH=${WIDTH:-1920}
+HEIGHT=${HEIGHT:-1080}
+QUEUES=${QUEUES:-2}
+RUN_TIME=${RUN_TIME:-5}
+PACKETS=${PACKETS:-4096}
+PATTERNS=${PATTERNS:-"uniform raster hotspot mixed junk null"}
+OUTPUT=${OUTPUT:-build/e2e-results.jsonl}
+# Additional arguments for the server, e.g. "--decoder scalar" or "--pipeline-workers 1:2,3"
+SERVER_ARGS=${SERVER_ARGS:-}
+
+SHM_NAME=/pixelflut-e2e
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# The lcores 1..QUEUES poll one queue each, lcore 0 is the main one
+CORES=$(seq -s, 1 "$QUEUES")
+failed=0
+: > "$OUTPUT"
+
+for pattern in $PATTERNS; do
+    if [ "$pattern" = null ]; then
+        # Every packet is empty, so nothing must be drawn
+        build/traffic-gen -w "$WIDTH" -h "$HEIGHT" -p junk -n 0 -o "$WORK_DIR" > /dev/null
+        vdev="net_null0"
+    else
+        build/traffic-gen -w "$WIDTH" -h "$HEIGHT" -p "$pattern" -n "$PACKETS" -q "$QUEUES" -o "$WORK_DIR"
+        vdev="net_pcap0,infinite_rx=1"
+        for queue in $(seq 0 $((QUEUES - 1))); do
+            vdev+=",rx_pcap=$WORK_DIR/queue$queue.pcap"
+        done
+    fi
+
+    echo "Running $pattern for $RUN_TIME seconds"
+    rm -f "/dev/shm$SHM_NAME"
+    # shellcheck disable=SC2086
+    build/pixelflut-v6-server --file-prefix pixelflut-e2e --no-pci -l "0-$QUEUES" --vdev "$vdev" -- \
+        -w "$WIDTH" -h "$HEIGHT" --shared-memory-name "$SHM_NAME" --port-core-mapping "0:$CORES" \
+        --run-time "$RUN_TIME" --results "$WORK_DIR/server.json" $SERVER_ARGS > "$WORK_DIR/server.log" 2>&1 || {
+        echo "The server failed, see its log:"
+        cat "$WORK_DIR/server.log"
+        exit 1
+    }
+
+    if ! build/traffic-gen -w "$WIDTH" -h "$HEIGHT" -o "$WORK_DIR" --verify --shared-memory-name "$SHM_NAME"; then
+        failed=1
+    fi
+    grep -o '"total_mpps": [0-9.]*' "$WORK_DIR/server.json"
+
+    echo "{\"pattern\": \"$pattern\", \"queues\": $QUEUES, \"width\": $WIDTH, \"height\": $HEIGHT," \
+        "\"git\": \"$(git describe --always --dirty 2> /dev/null || echo unknown)\"," \
+        "\"server\": $(tr -d '\n' < "$WORK_DIR/server.json"), \"verify\": $(tr -d '\n' < "$WORK_DIR/verify.json")}" \
+        >> "$OUTPUT"
+done
+
+rm -f "/dev/shm$SHM_NAME"
+echo "Wrote the results to $OUTPUT"
+exit $failed
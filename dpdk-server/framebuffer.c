@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdbool.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -6,26 +8,168 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
 #include <unistd.h>
 
 #include "framebuffer.h"
 
-int create_fb(struct framebuffer** framebuffer, uint16_t width, uint16_t height, char* shared_memory_name) {
-    int fd = shm_open(shared_memory_name, O_CREAT | O_RDWR, 0666);
+// Reads a field (such as "KernelPageSize:") of the mapping containing addr from /proc/self/smaps, returns it in bytes or
+// -1 in case it could not be found.
+static long read_smaps_field(void* addr, const char* field) {
+    FILE* smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == NULL)
+        return -1;
+
+    char line[256];
+    bool in_mapping = false;
+    long value = -1;
+    while (fgets(line, sizeof(line), smaps)) {
+        unsigned long start, end;
+        // Mapping headers look like "7f2d1c000000-7f2d1c800000 rw-s 00000000 00:2e 1234 /dev/shm/pixelflut"
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            in_mapping = (uintptr_t)addr >= start && (uintptr_t)addr < end;
+            continue;
+        }
+
+        long kb;
+        if (in_mapping && strncmp(line, field, strlen(field)) == 0 && sscanf(line + strlen(field), "%ld kB", &kb) == 1) {
+            value = kb * 1024;
+            break;
+        }
+    }
+
+    fclose(smaps);
+    return value;
+}
+
+static inline uint64_t align_up(uint64_t value, uint64_t align) {
+    return (value + align - 1) / align * align;
+}
+
+// Fills in the header (except for the magic) describing the layout of a framebuffer holding the given region of the
+// screen
+static void fb_layout(struct fb_header* header, uint16_t screen_width, uint16_t screen_height,
+        const struct fb_rect* region) {
+    uint16_t width = region->width;
+    uint16_t height = region->height;
+
+    memset(header, 0, sizeof(*header));
+    header->version = FB_LAYOUT_VERSION;
+    header->header_size = sizeof(struct fb_header);
+    header->width = width;
+    header->height = height;
+    header->pixel_format = FB_PIXEL_FORMAT_RGBX8888;
+    header->stride = width * sizeof(uint32_t);
+    header->dirty_span_pixels = DIRTY_SPAN_PIXELS;
+    header->max_ports = MAX_PORTS;
+    header->port_stats_size = sizeof(struct port_stats);
+    header->max_queue_stats = MAX_QUEUE_STATS;
+    header->queue_stats_size = sizeof(struct queue_stats);
+    header->eth_queue_stat_cntrs = RTE_ETHDEV_QUEUE_STAT_CNTRS;
+    header->screen_width = screen_width;
+    header->screen_height = screen_height;
+    header->region_x = region->x;
+    header->region_y = region->y;
+
+    // The queue stats are written by different cores and the dirty bitmap is updated atomically, so all of them are
+    // aligned to cache lines
+    header->port_stats.offset = align_up(sizeof(struct fb_header), 64);
+    header->port_stats.size = MAX_PORTS * sizeof(struct port_stats);
+    header->queue_stats.offset = align_up(header->port_stats.offset + header->port_stats.size, 64);
+    header->queue_stats.size = MAX_QUEUE_STATS * sizeof(struct queue_stats);
+    header->dirty.offset = align_up(header->queue_stats.offset + header->queue_stats.size, 64);
+    header->dirty.size = fb_dirty_size(width, height);
+    // Always aligned to 2 MiB, so that the layout doesn't depend on --transparent-hugepages or the huge page size. Not
+    // to the page size, as with 1 GiB pages the header and stats would take a whole page of their own. On hugetlbfs
+    // the pixels are backed by huge pages anyway.
+    header->pixels.offset = align_up(header->dirty.offset + header->dirty.size, FB_PIXELS_ALIGN);
+    header->pixels.size = (uint64_t)height * header->stride;
+}
+
+// The pixels are only aligned in memory in case the mapping itself is aligned. The kernel only does that on its own
+// for hugetlbfs (and for tmpfs with transparent huge pages enabled), so we reserve a bigger area and place the mapping
+// at an aligned address within it.
+static void* mmap_aligned(int fd, size_t size, size_t align) {
+    char* area = mmap(NULL, size + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED)
+        return MAP_FAILED;
+
+    char* aligned = (char*)align_up((uintptr_t)area, align);
+    void* mapping = mmap(aligned, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        munmap(area, size + align);
+        return MAP_FAILED;
+    }
+
+    if (aligned > area)
+        munmap(area, aligned - area);
+    if (area + align > aligned)
+        munmap(aligned + size, area + align - aligned);
+    return mapping;
+}
+
+bool fb_parse_rect(const char* arg, struct fb_rect* rect) {
+    int consumed = 0;
+    if (sscanf(arg, "%hux%hu+%hu+%hu%n", &rect->width, &rect->height, &rect->x, &rect->y, &consumed) != 4
+            || arg[consumed] != '\0')
+        return false;
+
+    return rect->width > 0 && rect->height > 0;
+}
+
+int create_fb(struct framebuffer** framebuffer, uint16_t width, uint16_t height, const struct fb_rect* region,
+        char* shared_memory_name, char* hugepage_dir, bool transparent_hugepages) {
+    struct fb_rect whole_screen = { .x = 0, .y = 0, .width = width, .height = height };
+    if (region == NULL) {
+        region = &whole_screen;
+    } else if (region->width == 0 || region->height == 0 || (uint32_t)region->x + region->width > width
+            || (uint32_t)region->y + region->height > height) {
+        printf("The region %ux%u+%u+%u does not fit into the screen of size (%u, %u)\n",
+            region->width, region->height, region->x, region->y, width, height);
+        return EINVAL;
+    }
+
+    int fd;
+    char shared_memory_path[PATH_MAX];
+    if (hugepage_dir != NULL) {
+        // The shared memory name starts with a slash, so we can simply append it
+        snprintf(shared_memory_path, sizeof(shared_memory_path), "%s%s", hugepage_dir, shared_memory_name);
+        fd = open(shared_memory_path, O_CREAT | O_RDWR, 0666);
+    } else {
+        snprintf(shared_memory_path, sizeof(shared_memory_path), "/dev/shm%s", shared_memory_name);
+        fd = shm_open(shared_memory_name, O_CREAT | O_RDWR, 0666);
+    }
     if(fd == -1) {
-        printf("Failed to create shared memory with name %s: %s\n", shared_memory_name, strerror(errno));
+        printf("Failed to create shared memory at %s: %s\n", shared_memory_path, strerror(errno));
         return errno;
     }
 
+    // hugetlbfs only allows sizes that are a multiple of the huge page size
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (hugepage_dir != NULL) {
+        struct statfs fs_stats;
+        if (fstatfs(fd, &fs_stats) == -1) {
+            printf("Failed to statfs %s: %s\n", shared_memory_path, strerror(errno));
+            return errno;
+        }
+        if (fs_stats.f_type != HUGETLBFS_MAGIC) {
+            printf("%s is not on a hugetlbfs, please pass the mount point of a hugetlbfs (e.g. /dev/hugepages)\n",
+                hugepage_dir);
+            return EINVAL;
+        }
+        page_size = fs_stats.f_bsize;
+    }
+
     struct stat shared_memory_stats;
     if (fstat(fd, &shared_memory_stats) == -1) {
         printf("Failed to fstat the shared memory with name %s: %s\n", shared_memory_name, strerror(errno));
         return errno;
     }
 
-    int expected_shared_memory_size = 2 * sizeof(uint16_t) /* size header */
-        + width * height * sizeof(uint32_t) /* pixels */
-        + MAX_PORTS * sizeof(struct port_stats) /* statistics for every per port */;
+    struct fb_header layout;
+    fb_layout(&layout, width, height, region);
+    size_t expected_shared_memory_size = align_up(layout.pixels.offset + layout.pixels.size, page_size);
 
     bool fresh_shm = false;
     if (shared_memory_stats.st_size == 0) {
@@ -33,72 +177,136 @@ int create_fb(struct framebuffer** framebuffer, uint16_t width, uint16_t height,
         fresh_shm = true;
 
         if (ftruncate(fd, expected_shared_memory_size) == -1) {
-            printf("Failed to resize the shared memory with name %s to size of %u bytes: %s\n",
-                shared_memory_name, expected_shared_memory_size, strerror(errno));
+            printf("Failed to resize the shared memory at %s to size of %zu bytes: %s\n",
+                shared_memory_path, expected_shared_memory_size, strerror(errno));
             return errno;
         }
-    } else if (shared_memory_stats.st_size != expected_shared_memory_size) {
-        printf("Found existing shared memory with size of %lu bytes. However, I expected it to be of size %u, as the"
-            "framebuffer has (%u, %u) pixels. The Pixelflut backend and frontend seem to use different resolutions! "
-            "In case you want to re-size your existing framebuffer please execute 'rm /dev/shm%s'\n",
-            shared_memory_stats.st_size, expected_shared_memory_size, width, height, shared_memory_name);
+    } else if ((size_t)shared_memory_stats.st_size != expected_shared_memory_size) {
+        printf("Found existing shared memory with size of %lu bytes. However, I expected it to be of size %zu, as the "
+            "framebuffer has (%u, %u) pixels. The Pixelflut backend and frontend seem to use different resolutions (or the "
+            "shared memory was created by an older version)! "
+            "In case you want to re-size your existing framebuffer please execute 'rm %s'\n",
+            shared_memory_stats.st_size, expected_shared_memory_size, region->width, region->height,
+            shared_memory_path);
         return EINVAL;
     } else {
         printf("Using existing shared memory of correct size\n");
     }
 
     char* shared_memory;
-    shared_memory = mmap(NULL, expected_shared_memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    shared_memory = mmap_aligned(fd, expected_shared_memory_size, RTE_MAX((size_t)page_size, FB_PIXELS_ALIGN));
     if (shared_memory == MAP_FAILED) {
-        printf("Failed to mmap the the shared memory with name %s: %s\n", shared_memory_name, strerror(errno));
+        printf("Failed to mmap the the shared memory at %s: %s%s\n", shared_memory_path, strerror(errno),
+            hugepage_dir != NULL ? " (are there enough free huge pages?)" : "");
         return errno;
     }
 
+    // tmpfs (/dev/shm) can back the mapping with transparent huge pages, in case
+    // /sys/kernel/mm/transparent_hugepage/shmem_enabled is set to "advise" (or "within_size"/"always")
+    if (transparent_hugepages && hugepage_dir == NULL) {
+        if (madvise(shared_memory, expected_shared_memory_size, MADV_HUGEPAGE) == -1) {
+            printf("Failed to madvise transparent huge pages for the shared memory at %s: %s\n",
+                shared_memory_path, strerror(errno));
+            return errno;
+        }
+    }
+
     // Zero the new shared memory, as e.g. the statistics rely on the fact that the mac addresses initialize with zero.
     if (fresh_shm) {
         memset(shared_memory, 0, expected_shared_memory_size);
     }
 
-    // We need to set width and height so that other tools (e.g. the frontend) can detect the framebuffer size
-    uint16_t* width_ptr = (uint16_t*)shared_memory;
-    if (*width_ptr == 0) {
-        // Shared memory was freshly created, we need to initialize it
-        *width_ptr = width;
-    } else if (*width_ptr != width) {
-        printf("Found existing shared memory, but it has the width %u, while I expected %u\n", *width_ptr, width);
+    // The header tells other tools (e.g. the frontend) the framebuffer size and where to find everything. In case the
+    // shared memory already existed (e.g. another server shares the framebuffer), it needs to have the same layout.
+    struct fb_header* header = (struct fb_header*)shared_memory;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == 0) {
+        *header = layout;
+        __atomic_store_n(&header->magic, FB_MAGIC, __ATOMIC_RELEASE);
+    } else if (header->magic != FB_MAGIC || header->version != FB_LAYOUT_VERSION) {
+        printf("Found existing shared memory at %s, but it has no layout version %u header (magic 0x%08x, version %u). "
+            "It was probably created by an older server, please execute 'rm %s'\n", shared_memory_path,
+            FB_LAYOUT_VERSION, header->magic, header->version, shared_memory_path);
         return EINVAL;
-    }
-
-    uint16_t* height_ptr = (uint16_t*)(shared_memory + 2);
-    if (*height_ptr == 0) {
-        // Shared memory was freshly created, we need to initialize it
-        *height_ptr = height;
-    } else if (*height_ptr != height) {
-        printf("Found existing shared memory, but it has the height %u, while I expected %u\n", *height_ptr, height);
+    } else if (memcmp((char*)header + sizeof(header->magic), (char*)&layout + sizeof(layout.magic),
+            sizeof(layout) - sizeof(layout.magic)) != 0) {
+        printf("Found existing shared memory at %s, but it has a different layout (e.g. the region %ux%u+%u+%u instead "
+            "of %ux%u+%u+%u). In case you want to re-size your existing framebuffer please execute 'rm %s'\n",
+            shared_memory_path, header->width, header->height, header->region_x, header->region_y,
+            region->width, region->height, region->x, region->y, shared_memory_path);
         return EINVAL;
     }
 
     struct framebuffer* fb = malloc(sizeof(struct framebuffer));
-    fb->width = width;
-    fb->height = height;
-    fb->pixels = (uint32_t*)(shared_memory + 2 * sizeof(uint16_t) /* size header */);
-    fb->port_stats = (struct port_stats*)(shared_memory + 2 * sizeof(uint16_t) /* size header */ + width * height * sizeof(uint32_t) /* pixels */);
+    fb->width = region->width;
+    fb->height = region->height;
+    fb->region_x = region->x;
+    fb->region_y = region->y;
+    fb->screen_width = width;
+    fb->screen_height = height;
+    fb->header = header;
+    fb->size = expected_shared_memory_size;
+    fb->pixels = (uint32_t*)(shared_memory + header->pixels.offset);
+    fb->port_stats = (struct port_stats*)(shared_memory + header->port_stats.offset);
+    fb->queue_stats = (struct queue_stats*)(shared_memory + header->queue_stats.offset);
+    fb->dirty = (uint64_t*)(shared_memory + header->dirty.offset);
+
+    if (region == &whole_screen) {
+        printf("Created framebuffer of size (%u,%u) backed by shared memory at %s\n",
+            width, height, shared_memory_path);
+    } else {
+        printf("Created framebuffer for the region %ux%u+%u+%u of the (%u,%u) screen backed by shared memory at %s\n",
+            region->width, region->height, region->x, region->y, width, height, shared_memory_path);
+    }
 
-    printf("Created framebuffer of size (%u,%u) backed by shared memory with the name %s\n",
-        width, height, shared_memory_name);
+    // Ask the kernel which page size we actually got, as transparent huge pages are only best effort
+    long kernel_page_size = read_smaps_field(shared_memory, "KernelPageSize:");
+    fb->page_size = kernel_page_size > 0 ? kernel_page_size : page_size;
+    if (transparent_hugepages && hugepage_dir == NULL) {
+        long huge_mapped = read_smaps_field(shared_memory, "ShmemPmdMapped:");
+        printf("Framebuffer uses a page size of %zu KiB, %ld KiB of %zu KiB are currently mapped using transparent huge pages\n",
+            fb->page_size / 1024, huge_mapped > 0 ? huge_mapped / 1024 : 0, fb->size / 1024);
+    } else {
+        printf("Framebuffer uses a page size of %zu KiB (%zu pages)\n", fb->page_size / 1024, fb->size / fb->page_size);
+    }
 
     *framebuffer = fb;
     return 0;
 }
 
-// Only sets pixel if it is within bounds
-void fb_set(struct framebuffer* framebuffer, uint16_t x, uint16_t y, uint32_t rgba) {
-    if (x < framebuffer->width && y < framebuffer->height) {
-        framebuffer->pixels[x + y * framebuffer->width] = rgba;
+int find_free_stats_slot(struct framebuffer* fb, struct rte_ether_addr* mac_addr) {
+    for (int slot = 0; slot < MAX_PORTS; slot++) {
+        if (rte_is_same_ether_addr(&fb->port_stats[slot].mac_addr, mac_addr)) {
+            printf("Found slot %d with my MAC address, using that\n", slot);
+            return slot;
+        }
+
+        if (rte_is_zero_ether_addr(&fb->port_stats[slot].mac_addr)) {
+            // All full slots have been checked before, so we can now assume this mac address does not have a slot yet
+            printf("Found empty slot %d, using that\n", slot);
+            rte_ether_addr_copy(mac_addr, &fb->port_stats[slot].mac_addr);
+            return slot;
+        }
     }
+
+    // No free slot found
+    return -1;
 }
 
-// Does *not* check for bounds
-uint32_t fb_get(struct framebuffer* framebuffer, uint16_t x, uint16_t y) {
-    return framebuffer->pixels[x + y * framebuffer->width];
+int find_free_queue_stats_slot(struct framebuffer* fb) {
+    for (int slot = 0; slot < MAX_QUEUE_STATS; slot++) {
+        if (!fb->queue_stats[slot].in_use) {
+            fb->queue_stats[slot].in_use = 1;
+            return slot;
+        }
+    }
+
+    // No free slot found
+    return -1;
+}
+
+void release_queue_stats_slots(struct framebuffer* fb, uint16_t port_slot) {
+    for (int slot = 0; slot < MAX_QUEUE_STATS; slot++) {
+        if (fb->queue_stats[slot].in_use && fb->queue_stats[slot].port_slot == port_slot)
+            fb->queue_stats[slot].in_use = 0;
+    }
 }
@@ -1,20 +1,154 @@
 #ifndef _FRAMEBUFFER_H_
 #define _FRAMEBUFFER_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "stats.h"
 
 #define MAX_PORTS 32 // WCGW? :)
 
+// Every bit of the dirty bitmap covers DIRTY_SPAN_PIXELS consecutive pixels of the framebuffer. In case the width is a
+// multiple of it (as e.g. 1920 and 3840 are), every bit covers a segment of a single row. Needs to match the Rust code.
+#define DIRTY_SPAN_PIXELS 64
+
+// Layout of the shared memory (version 3): The header at offset 0 describes where all the other regions are, so that
+// readers (e.g. the pixel-fluter) don't need to replicate the layout. The port stats, queue stats and the dirty bitmap
+// follow, each aligned to a cache line. The pixels come last and start at a (huge) page boundary, so that they can be
+// mapped with huge pages and scanned using aligned (non-temporal) SIMD loads.
+#define FB_MAGIC 0x4c465850 // "PXFL" in little endian
+#define FB_LAYOUT_VERSION 3
+#define FB_PIXELS_ALIGN (2 * 1024 * 1024)
+
+enum fb_pixel_format {
+    // One 32 bit word per pixel, the bytes in memory are r, g, b and an unused one
+    FB_PIXEL_FORMAT_RGBX8888 = 1,
+};
+
+struct fb_region {
+    uint64_t offset;
+    uint64_t size;
+};
+
+// A rectangle of the screen, e.g. the part a server is responsible for in case the screen is split across servers
+struct fb_rect {
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+};
+
+// Needs to match the Rust code. The magic is written last, so a reader seeing it also sees the rest of the header.
+struct fb_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    // Size of the pixels in the shared memory, which is the size of the region (see below)
+    uint16_t width;
+    uint16_t height;
+    uint32_t pixel_format;
+    // Bytes between the start of two rows. Currently always width * 4, as the dirty bitmap relies on it.
+    uint32_t stride;
+    uint32_t dirty_span_pixels;
+    uint32_t max_ports;
+    uint32_t port_stats_size;
+    uint32_t max_queue_stats;
+    uint32_t queue_stats_size;
+    // RTE_ETHDEV_QUEUE_STAT_CNTRS, which is the length of the per queue arrays within the port stats
+    uint32_t eth_queue_stat_cntrs;
+    // The framebuffer only holds the region of the screen starting at (region_x, region_y), it's the whole screen
+    // unless the server was started with --region
+    uint16_t screen_width;
+    uint16_t screen_height;
+    uint16_t region_x;
+    uint16_t region_y;
+    uint32_t reserved;
+
+    struct fb_region pixels;
+    struct fb_region port_stats;
+    struct fb_region queue_stats;
+    struct fb_region dirty;
+};
+
 struct framebuffer {
+    // Size of the region of the screen we hold, the pixels outside of it are not allocated
     uint16_t width;
     uint16_t height;
+    // Position of the region within the screen
+    uint16_t region_x;
+    uint16_t region_y;
+    uint16_t screen_width;
+    uint16_t screen_height;
+
+    struct fb_header* header;
+
+    // Size of the whole shared memory and the page size backing it
+    size_t size;
+    size_t page_size;
 
     uint32_t* pixels;
     struct port_stats* port_stats;
+    struct queue_stats* queue_stats;
+    // One bit per DIRTY_SPAN_PIXELS pixels, set by us and cleared by the pixel-fluter once it has sent the pixels
+    uint64_t* dirty;
 };
 
-int create_fb(struct framebuffer** framebuffer, uint16_t width, uint16_t height, char* shared_memory_name);
-void fb_set(struct framebuffer* framebuffer, uint16_t x, uint16_t y, uint32_t rgba);
-uint32_t fb_get(struct framebuffer* framebuffer, uint16_t x, uint16_t y);
+// Creates the framebuffer of a screen of width x height pixels. In case region is not NULL, only that part of the screen
+// is allocated and accepted.
+// In case hugepage_dir is set, the framebuffer is created as file within this hugetlbfs mount instead of /dev/shm.
+// transparent_hugepages asks the kernel to back the /dev/shm framebuffer with transparent huge pages.
+int create_fb(struct framebuffer** framebuffer, uint16_t width, uint16_t height, const struct fb_rect* region,
+    char* shared_memory_name, char* hugepage_dir, bool transparent_hugepages);
+// Parses a rectangle given as "<width>x<height>+<x>+<y>" (the X11 geometry format), returns false if it is invalid
+bool fb_parse_rect(const char* arg, struct fb_rect* rect);
+
+// Returns the port stats slot of the MAC address (claiming a free one if needed) or -1 in case all are taken
+int find_free_stats_slot(struct framebuffer* fb, struct rte_ether_addr* mac_addr);
+// Claims a free queue stats slot, returns -1 in case all are taken
+int find_free_queue_stats_slot(struct framebuffer* fb);
+// Frees the queue stats slots of the port, e.g. the ones left behind by a previous run
+void release_queue_stats_slots(struct framebuffer* fb, uint16_t port_slot);
+
+// Size of the dirty bitmap in bytes
+static inline size_t fb_dirty_size(uint16_t width, uint16_t height) {
+    size_t spans = ((size_t)width * height + DIRTY_SPAN_PIXELS - 1) / DIRTY_SPAN_PIXELS;
+    return (spans + 63) / 64 * sizeof(uint64_t);
+}
+
+static inline void fb_mark_dirty(struct framebuffer* framebuffer, uint32_t pixel_index) {
+    uint32_t span = pixel_index / DIRTY_SPAN_PIXELS;
+    uint64_t* word = &framebuffer->dirty[span / 64];
+    uint64_t bit = 1ULL << (span % 64);
+
+    // During a flood the bit is set nearly all the time, so only reading it keeps the cache line shared between all
+    // RX cores and we only pay for the atomic on the first write after the pixel-fluter cleared it.
+    // This races with the fluter clearing the bit between our check and our pixel store becoming visible, the fluter
+    // regularly sends the full framebuffer to cover for that.
+    if (!(__atomic_load_n(word, __ATOMIC_RELAXED) & bit))
+        __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+}
+
+// Turns the screen coordinates into the index of the pixel within our region, returns false in case they are outside of
+// it. Coordinates left of (or above) the region wrap around to large values, so a single compare per axis is enough.
+static inline bool fb_pixel_index(struct framebuffer* framebuffer, uint16_t x, uint16_t y, uint32_t* pixel_index) {
+    uint16_t region_x = x - framebuffer->region_x;
+    uint16_t region_y = y - framebuffer->region_y;
+    if (region_x >= framebuffer->width || region_y >= framebuffer->height)
+        return false;
+
+    *pixel_index = region_x + (uint32_t)region_y * framebuffer->width;
+    return true;
+}
+
+// Only sets pixel if it is within bounds (of our region), returns false otherwise
+static inline bool fb_set(struct framebuffer* framebuffer, uint16_t x, uint16_t y, uint32_t rgba) {
+    uint32_t pixel_index;
+    if (!fb_pixel_index(framebuffer, x, y, &pixel_index))
+        return false;
+
+    framebuffer->pixels[pixel_index] = rgba;
+    fb_mark_dirty(framebuffer, pixel_index);
+    return true;
+}
 
 #endif
@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <argp.h>
 
@@ -13,30 +15,64 @@
 #include <rte_mbuf.h>
 #include <rte_launch.h>
 #include <rte_cycles.h>
-
+#include <rte_malloc.h>
+#include <rte_errno.h>
+#include <rte_ring.h>
+#include <rte_prefetch.h>
+#include <rte_pause.h>
+#include <rte_power_intrinsics.h>
+
+#include "decoder.h"
 #include "framebuffer.h"
 #include "stats.h"
+#include "timelapse.h"
 
 #define MAX_PORTS 32 // Needs to match Rust code
 #define MAX_CORES 128
 #define MAX_CORES_PER_PORT 16
 #define MAX_QUEUES_PER_CORE 64
+#define MAX_WORKERS 16
 
 #define NUM_RX_DESC 1024
+#define NUM_TX_DESC 1024
 #define BURST_SIZE 32
 #define NUM_MBUFS 8192
 #define MBUF_CACHE_SIZE 256
+// Should be able to absorb a few bursts in case a worker is lagging behind
+#define WORKER_RING_SIZE 1024
+
+#define DEFAULT_IDLE_SPIN_POLLS 1024
+// A 1024 descriptor RX queue holds ~70us of 64 byte packets at 10 Gbit/s line rate, so don't sleep longer than that
+#define DEFAULT_MAX_WAKEUP_LATENCY_US 50
+
+#define DEFAULT_TIMELAPSE_INTERVAL_MS 1000
+#define DEFAULT_TIMELAPSE_KEYFRAMES 60
 
-// pingxelflut protocol constants
-#define MSG_SIZE_REQUEST 0xaa
-#define MSG_SIZE_RESPONSE 0xbb
-#define MSG_SET_PIXEL 0xcc
+// See --run-time, the first second is not part of the results, so that e.g. the caches are warm
+#define RESULTS_WARMUP_MS 1000
 
 static struct argp_option options[] = {
     {"width",  'w', "pixels", 0,  "Width of the drawing surface in pixels (default 1920)" },
     {"height", 'h', "pixels", 0,  "Height of the drawing surface in pixels (default 1080)"},
     {"shared-memory-name", 's', "name", 0, "Name of the shared memory. Usually it will be created at /dev/shm/<name> (default pixelflut)"},
+    {"hugepage-dir", 'g', "path", 0, "Create the shared memory as file within the given hugetlbfs mount (e.g. /dev/hugepages) instead of /dev/shm, so that it is backed by huge pages"},
+    {"transparent-hugepages", 't', 0, 0, "Ask the kernel to back the shared memory in /dev/shm with transparent huge pages. Requires /sys/kernel/mm/transparent_hugepage/shmem_enabled to be set to advise"},
     {"port-core-mapping", 'c', "mapping", 0, "Mapping of NIC ports to CPU cores. Format is '<port1>:<core1> <port2>:<core2>,<core3>', e.g. '0:1' or '0:1,2,3,4 1:5,6,7,8'"},
+    {"prefetch-headers", 'P', "packets", 0, "How many packets ahead the packet headers are prefetched, 0 disables it (default 8)"},
+    {"prefetch-pixels", 'F', "packets", 0, "How many packets ahead the framebuffer pixels are prefetched, 0 disables it (default 4)"},
+    {"pipeline-workers", 'W', "mapping", 0, "Let RX cores only poll their queues and hand the packets to worker cores, each of them owning a band of rows of the screen. Helps in case the NIC puts (nearly) all traffic into a single queue. Format is '<rx core>:<worker core1>,<worker core2> ...', e.g. '1:2,3,4'"},
+    {"idle-backoff", 'b', 0, 0, "Stop spinning at 100% when there is no traffic. After --idle-spin-polls empty polls the lcores first pause, then wait for the NIC (in case CPU and driver support it) or sleep. The first packet brings them back to full spinning"},
+    {"idle-spin-polls", 'n', "polls", 0, "Number of empty polls in a row before an lcore starts backing off (default 1024)"},
+    {"max-wakeup-latency", 'l', "us", 0, "Upper bound of the time a backing off lcore needs to notice new packets. Keep it below the time it takes to fill the RX queue. Sleeps might be longer than asked for, as the kernel rounds them to its timer slack (default 50)"},
+    {"multi-pixel", 'm', 0, 0, "Decode the additional pixels of pixelflut v6 packets sent to UDP port 28792, which carry (x, y, r, g, b) tuples in their payload"},
+    {"shard-prefix-len", 'S', "bits", 0, "Length of the IPv6 prefix routed to this server in case the screen is split across servers (64 to 96). Additional pixels of multi-pixel packets outside of the prefix of their first pixel are rejected (default 64)"},
+    {"region", 'R', "WxH+X+Y", 0, "Only own the given rectangle of the screen in case it is split across servers, e.g. 960x1080+960+0 for the right half of a 1920x1080 screen. Only the region is allocated, pixels outside of it are counted as out of bounds. The region is recorded in the shared memory, so that the pixel-fluter draws it at the right position (default the whole screen)"},
+    {"decoder", 'd', "impl", 0, "Packet decoder implementation, one of auto, scalar, avx2 or avx512. auto picks the fastest one supported by the CPU (default auto)"},
+    {"timelapse", 'r', "file", 0, "Record a time-lapse of the framebuffer to the given file. Snapshots are taken by the main core, the RX cores are not involved. In case the file exists, the new frames are appended. Use timelapse-replay to restore or export it"},
+    {"timelapse-interval", 'i', "ms", 0, "Time between two time-lapse snapshots (default 1000)"},
+    {"timelapse-keyframes", 'k', "frames", 0, "Write a full frame every that many time-lapse snapshots instead of only the changes (default 60)"},
+    {"run-time", 'D', "seconds", 0, "Stop after the given number of seconds instead of running forever. Used for benchmarks, see e2e-bench.sh"},
+    {"results", 'o', "file", 0, "Write the per lcore packet rates and the drop counters of the run (after a second of warmup) as JSON to the given file once --run-time is over"},
     {0}
 };
 
@@ -44,7 +80,25 @@ struct arguments {
     uint16_t width;
     uint16_t height;
     char* shared_memory_name;
+    char* hugepage_dir;
+    bool transparent_hugepages;
     char* port_core_mapping;
+    char* pipeline_workers;
+    enum decoder_impl decoder;
+    uint16_t prefetch_headers;
+    uint16_t prefetch_pixels;
+    bool multi_pixel;
+    uint8_t shard_prefix_len;
+    struct fb_rect region;
+    bool has_region;
+    bool idle_backoff;
+    uint32_t idle_spin_polls;
+    uint32_t max_wakeup_latency_us;
+    char* timelapse;
+    uint32_t timelapse_interval_ms;
+    uint32_t timelapse_keyframes;
+    uint32_t run_time_s;
+    char* results;
 };
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
@@ -62,9 +116,82 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case 's':
             arguments->shared_memory_name = arg;
             break;
+        case 'g':
+            arguments->hugepage_dir = arg;
+            break;
+        case 't':
+            arguments->transparent_hugepages = true;
+            break;
         case 'c':
             arguments->port_core_mapping = arg;
             break;
+        case 'W':
+            arguments->pipeline_workers = arg;
+            break;
+        case 'b':
+            arguments->idle_backoff = true;
+            break;
+        case 'n':
+            arguments->idle_spin_polls = (uint32_t) strtol(arg, NULL, 10);
+            break;
+        case 'l':
+            arguments->max_wakeup_latency_us = (uint32_t) strtol(arg, NULL, 10);
+            if (arguments->max_wakeup_latency_us == 0)
+                argp_error(state, "The wake-up latency needs to be at least 1us");
+            break;
+        case 'P':
+            arguments->prefetch_headers = (uint16_t) strtol(arg, NULL, 10);
+            break;
+        case 'F':
+            arguments->prefetch_pixels = (uint16_t) strtol(arg, NULL, 10);
+            break;
+        case 'm':
+            arguments->multi_pixel = true;
+            break;
+        case 'S':
+            arguments->shard_prefix_len = (uint8_t) strtol(arg, NULL, 10);
+            if (arguments->shard_prefix_len < 64 || arguments->shard_prefix_len > 96)
+                argp_error(state, "The shard prefix length needs to be between 64 and 96");
+            break;
+        case 'R':
+            if (!fb_parse_rect(arg, &arguments->region))
+                argp_error(state, "Invalid region '%s', expected <width>x<height>+<x>+<y>, e.g. 960x1080+960+0", arg);
+            arguments->has_region = true;
+            break;
+        case 'd':
+            arguments->decoder = NUM_DECODER_IMPLS;
+            for (int impl = 0; impl < NUM_DECODER_IMPLS; impl++) {
+                if (strcmp(arg, decoder_impl_name(impl)) == 0)
+                    arguments->decoder = impl;
+            }
+            if (arguments->decoder == NUM_DECODER_IMPLS)
+                argp_error(state, "Unknown decoder '%s'", arg);
+            break;
+        case 'r':
+            arguments->timelapse = arg;
+            break;
+        case 'i':
+            arguments->timelapse_interval_ms = (uint32_t) strtol(arg, NULL, 10);
+            if (arguments->timelapse_interval_ms == 0)
+                argp_error(state, "The time-lapse interval needs to be at least 1ms");
+            break;
+        case 'k':
+            arguments->timelapse_keyframes = (uint32_t) strtol(arg, NULL, 10);
+            if (arguments->timelapse_keyframes == 0)
+                argp_error(state, "There needs to be at least one frame per keyframe");
+            break;
+        case 'D':
+            arguments->run_time_s = (uint32_t) strtol(arg, NULL, 10);
+            if (arguments->run_time_s * 1000 <= RESULTS_WARMUP_MS)
+                argp_error(state, "The run time needs to be longer than the warmup of %ums", RESULTS_WARMUP_MS);
+            break;
+        case 'o':
+            arguments->results = arg;
+            break;
+        case ARGP_KEY_END:
+            if (arguments->results && arguments->run_time_s == 0)
+                argp_error(state, "--results needs --run-time");
+            break;
 
         default:
             return ARGP_ERR_UNKNOWN;
@@ -77,25 +204,6 @@ static char doc[] = "Fast pixelflut v6 or pingxelflut server using DPDK";
 static char args_doc[] = "";
 static struct argp argp = { options, parse_opt, args_doc, doc };
 
-int find_free_stats_slot(struct framebuffer* fb, struct rte_ether_addr* mac_addr) {
-    for (int slot = 0; slot < MAX_PORTS; slot++) {
-        if (rte_is_same_ether_addr(&fb->port_stats[slot].mac_addr, mac_addr)) {
-            printf("Found slot %d with my MAC address, using that\n", slot);
-            return slot;
-        }
-
-        if (rte_is_zero_ether_addr(&fb->port_stats[slot].mac_addr)) {
-            // All full slots have been checked before, so we can now assume this mac address does not have a slot yet
-            printf("Found empty slot %d, using that\n", slot);
-            rte_ether_addr_copy(mac_addr, &fb->port_stats[slot].mac_addr);
-            return slot;
-        }
-    }
-
-    // No free slot found
-    return -1;
-}
-
 struct port_config {
     uint16_t port_id;
     uint16_t nb_queues;
@@ -107,9 +215,31 @@ struct core_work {
     struct {
         uint16_t port;
         uint16_t queue;
+        struct queue_stats* stats;
+        // Replies are sent on the TX queue with the same id as the RX queue, so that every TX queue is only used by
+        // a single lcore
+        struct rte_eth_dev_tx_buffer* tx_buffer;
     } tasks[MAX_QUEUES_PER_CORE];
     struct framebuffer* fb;
-};
+
+    // Pipeline mode (see --pipeline-workers). A distributor hands every packet setting a pixel to the worker owning
+    // its row, so that every worker only writes to its own band of the framebuffer.
+    uint16_t nb_workers;
+    uint16_t workers[MAX_WORKERS];
+    struct rte_ring* worker_rings[MAX_WORKERS];
+    // Index of the worker owning the row, for every row of the framebuffer
+    uint8_t* row_owner;
+
+    // Set in case this core is a worker, which only decodes the packets it gets from its distributor over the ring
+    bool is_worker;
+    uint16_t distributor;
+    struct rte_ring* ring;
+    struct queue_stats* worker_stats;
+
+    // Only written by the owning lcore, read by the stats loop
+    uint64_t decode_cycles;
+    uint64_t decoded_packets;
+} __rte_cache_aligned;
 
 static struct port_config ports[MAX_PORTS];
 static struct core_work core_tasks[MAX_CORES];
@@ -117,7 +247,44 @@ static uint16_t total_ports = 0;
 static uint16_t mapped_ports = 0;
 
 static struct rte_mempool *mbuf_pool;
-static uint64_t rx_counters[MAX_PORTS][MAX_CORES_PER_PORT];
+
+// Set by the stats loop once --run-time is over, the lcores check it once per poll
+static volatile bool force_quit = false;
+static uint64_t run_time_cycles;
+
+// See --idle-backoff
+static bool idle_backoff_enabled = false;
+static uint32_t idle_spin_polls = DEFAULT_IDLE_SPIN_POLLS;
+static uint32_t max_wakeup_latency_us = DEFAULT_MAX_WAKEUP_LATENCY_US;
+static uint64_t max_wakeup_latency_cycles;
+static bool can_power_monitor = false;
+
+// See --prefetch-headers, the distributors prefetch the headers the same way as the decoder
+static uint16_t distribute_prefetch_headers = DEFAULT_PREFETCH_HEADERS;
+
+// See --timelapse
+static struct timelapse* timelapse;
+static uint64_t timelapse_interval_cycles;
+
+struct timelapse_stats {
+    uint64_t next_snapshot;
+    uint64_t frames;
+    uint64_t bytes;
+    // Of the last snapshot
+    uint64_t copy_cycles;
+    uint64_t encode_cycles;
+    // RX packets and TSC cycles while a snapshot was taken and encoded vs. in between, so that we see in case
+    // recording slows down the RX cores (e.g. by thrashing the caches)
+    uint64_t recording_packets;
+    uint64_t recording_cycles;
+    uint64_t other_packets;
+    uint64_t other_cycles;
+    uint64_t last_end;
+    uint64_t last_end_packets;
+};
+
+// Mapping from port to stats slot
+static int port_to_slot[MAX_PORTS];
 
 static void parse_port_core_map(const char *arg) {
     char *copy = strdup(arg);
@@ -186,7 +353,86 @@ static void build_core_task_map(void) {
     }
 }
 
-static void print_assignment(void) {
+// Needs to run after build_core_task_map(), as the distributors have to be RX cores
+static void parse_pipeline_workers(const char *arg) {
+    char *copy = strdup(arg);
+    char *saveptr1 = NULL;
+    char *token = strtok_r(copy, " ", &saveptr1);
+
+    while (token) {
+        int core;
+        if (sscanf(token, "%d:", &core) != 1 || core < 0 || core >= MAX_CORES || core_tasks[core].count == 0)
+            rte_exit(EXIT_FAILURE, "Invalid pipeline spec '%s', the distributor needs to be a core from --port-core-mapping\n", token);
+
+        struct core_work *cw = &core_tasks[core];
+        if (cw->nb_workers > 0)
+            rte_exit(EXIT_FAILURE, "Duplicate pipeline for core %d\n", core);
+
+        char *workers = strchr(token, ':');
+        if (!workers || *(++workers) == '\0')
+            rte_exit(EXIT_FAILURE, "No workers specified for core %d\n", core);
+
+        char *saveptr2 = NULL;
+        char *wtok = strtok_r(workers, ",", &saveptr2);
+        while (wtok) {
+            int worker = atoi(wtok);
+            if (cw->nb_workers >= MAX_WORKERS)
+                rte_exit(EXIT_FAILURE, "Too many workers for core %d\n", core);
+
+            if (worker == 0)
+                rte_exit(EXIT_FAILURE, "Im sorry, but core 0 is reserved for the main (stats) loop, use a different one\n");
+            if (worker < 0 || worker >= MAX_CORES || !rte_lcore_is_enabled(worker))
+                rte_exit(EXIT_FAILURE, "Worker core %d is not enabled (used for core %d)\n", worker, core);
+            if (core_tasks[worker].count > 0)
+                rte_exit(EXIT_FAILURE, "Worker core %d already polls a port, it can not be a worker as well\n", worker);
+            if (core_tasks[worker].is_worker)
+                rte_exit(EXIT_FAILURE, "Worker core %d is used twice\n", worker);
+
+            core_tasks[worker].is_worker = true;
+            core_tasks[worker].distributor = core;
+            cw->workers[cw->nb_workers++] = worker;
+            wtok = strtok_r(NULL, ",", &saveptr2);
+        }
+
+        token = strtok_r(NULL, " ", &saveptr1);
+    }
+
+    free(copy);
+}
+
+static void init_pipelines(struct framebuffer* fb) {
+    for (uint16_t core = 0; core < MAX_CORES; core++) {
+        struct core_work *cw = &core_tasks[core];
+        if (cw->nb_workers == 0)
+            continue;
+
+        // Split the screen into bands of consecutive rows, so that the workers write to different cache lines (at
+        // least in case a row is a multiple of 64 bytes)
+        cw->row_owner = rte_zmalloc_socket("row_owner", fb->height, 0, rte_lcore_to_socket_id(core));
+        if (cw->row_owner == NULL)
+            rte_exit(EXIT_FAILURE, "Failed to allocate row owners for core %u\n", core);
+        for (uint32_t y = 0; y < fb->height; y++)
+            cw->row_owner[y] = y * cw->nb_workers / fb->height;
+
+        for (uint16_t w = 0; w < cw->nb_workers; w++) {
+            uint16_t worker = cw->workers[w];
+            char name[RTE_RING_NAMESIZE];
+            snprintf(name, sizeof(name), "worker_ring_%u", worker);
+
+            // Single producer (the distributor) and single consumer (the worker), which saves the CAS
+            struct rte_ring *ring = rte_ring_create(name, WORKER_RING_SIZE, rte_lcore_to_socket_id(worker),
+                RING_F_SP_ENQ | RING_F_SC_DEQ);
+            if (ring == NULL)
+                rte_exit(EXIT_FAILURE, "Failed to create ring for worker core %u: %s\n", worker, rte_strerror(rte_errno));
+
+            cw->worker_rings[w] = ring;
+            core_tasks[worker].ring = ring;
+        }
+    }
+}
+
+static void print_assignment(struct framebuffer* fb) {
+    uint16_t height = fb->height;
     printf("\nDPDK Port/Core Assignment:\n");
     printf("+--------+----------+--------+\n");
     printf("| PortID | Queue ID | CoreID |\n");
@@ -197,6 +443,21 @@ static void print_assignment(void) {
         }
     }
     printf("+--------+----------+--------+\n\n");
+
+    for (uint16_t core = 0; core < MAX_CORES; core++) {
+        struct core_work *cw = &core_tasks[core];
+        if (cw->nb_workers == 0)
+            continue;
+
+        printf("Core %u distributes its packets to the workers:\n", core);
+        for (uint16_t w = 0; w < cw->nb_workers; w++) {
+            // Inverse of the row_owner calculation, which splits the rows of our region
+            uint32_t first = ((uint32_t)w * height + cw->nb_workers - 1) / cw->nb_workers;
+            uint32_t last = ((uint32_t)(w + 1) * height + cw->nb_workers - 1) / cw->nb_workers;
+            printf("  Core %u: rows %u..%u\n", cw->workers[w], fb->region_y + first, fb->region_y + last - 1);
+        }
+        printf("\n");
+    }
 }
 
 int disable_pause_frames(uint16_t port_id) {
@@ -265,7 +526,16 @@ static void init_port(uint16_t port_id) {
         }
     };
 
-    if (rte_eth_dev_configure(port_id, cfg->nb_queues, 0, &port_conf) < 0)
+    // Virtual devices (e.g. net_pcap and net_null used by e2e-bench.sh) don't hash at all and refuse to be configured
+    // for it, every queue gets its own packets there anyway
+    struct rte_eth_dev_info dev_info;
+    if (rte_eth_dev_info_get(port_id, &dev_info) != 0)
+        rte_exit(EXIT_FAILURE, "Failed to get the device info of port %u\n", port_id);
+    port_conf.rx_adv_conf.rss_conf.rss_hf &= dev_info.flow_type_rss_offloads;
+    if (port_conf.rx_adv_conf.rss_conf.rss_hf == 0)
+        port_conf.rxmode.mq_mode = RTE_ETH_MQ_RX_NONE;
+
+    if (rte_eth_dev_configure(port_id, cfg->nb_queues, cfg->nb_queues, &port_conf) < 0)
         rte_exit(EXIT_FAILURE, "Port %u configure failed\n", port_id);
 
     for (uint16_t q = 0; q < cfg->nb_queues; q++) {
@@ -273,6 +543,10 @@ static void init_port(uint16_t port_id) {
             rte_eth_dev_socket_id(port_id), NULL, mbuf_pool) < 0) {
             rte_exit(EXIT_FAILURE, "RX queue setup failed for port %u, queue %u\n", port_id, q);
         }
+        if (rte_eth_tx_queue_setup(port_id, q, NUM_TX_DESC,
+            rte_eth_dev_socket_id(port_id), NULL) < 0) {
+            rte_exit(EXIT_FAILURE, "TX queue setup failed for port %u, queue %u\n", port_id, q);
+        }
     }
 
     if (rte_eth_dev_start(port_id) < 0)
@@ -282,10 +556,181 @@ static void init_port(uint16_t port_id) {
     disable_pause_frames(port_id);
 }
 
+// Decodes the packets on this lcore and sends the replies on the TX queue of the task
+static inline void decode_and_reply(struct core_work *core_work, uint16_t task, struct rte_mbuf **pkt, uint16_t nb_pkts) {
+    uint16_t port = core_work->tasks[task].port;
+    uint16_t queue = core_work->tasks[task].queue;
+    struct queue_stats *stats = core_work->tasks[task].stats;
+    struct rte_mbuf *replies[BURST_SIZE];
+
+    uint64_t start = rte_rdtsc();
+    uint16_t nb_replies = decode_burst(core_work->fb, &stats->decoder, pkt, nb_pkts, replies);
+    core_work->decode_cycles += rte_rdtsc() - start;
+    core_work->decoded_packets += nb_pkts;
+
+    // The replies have been taken out of the burst, as they re-use the mbufs
+    rte_pktmbuf_free_bulk(pkt, nb_pkts);
+
+    if (unlikely(nb_replies > 0)) {
+        struct rte_eth_dev_tx_buffer *tx_buffer = core_work->tasks[task].tx_buffer;
+        for (uint16_t r = 0; r < nb_replies; r++)
+            rte_eth_tx_buffer(port, queue, tx_buffer, replies[r]);
+        rte_eth_tx_buffer_flush(port, queue, tx_buffer);
+    }
+}
+
+// Hands the packets setting a pixel to the worker owning the row. Everything else (e.g. size requests, which need a
+// reply on our TX queue) is decoded by ourselves.
+static inline void distribute_burst(struct core_work *core_work, uint16_t task, struct rte_mbuf **pkt, uint16_t nb_pkts) {
+    struct queue_stats *stats = core_work->tasks[task].stats;
+    uint16_t height = core_work->fb->height;
+    uint16_t region_y = core_work->fb->region_y;
+    struct rte_mbuf *staged[MAX_WORKERS][BURST_SIZE];
+    uint16_t nb_staged[MAX_WORKERS] = {0};
+    uint16_t nb_local = 0;
+    const uint16_t headers = distribute_prefetch_headers;
+
+    for (uint16_t i = 0; i < nb_pkts && i < headers; i++)
+        rte_prefetch0(rte_pktmbuf_mtod(pkt[i], void *));
+
+    for (uint16_t i = 0; i < nb_pkts; i++) {
+        if (headers > 0 && i + headers < nb_pkts)
+            rte_prefetch0(rte_pktmbuf_mtod(pkt[i + headers], void *));
+
+        // The rows are owned within our region, rows above it (or no row at all) end up negative
+        int y = decoder_pixel_row(pkt[i]) - region_y;
+        if (likely(y >= 0 && y < height)) {
+            uint8_t w = core_work->row_owner[y];
+            staged[w][nb_staged[w]++] = pkt[i];
+        } else {
+            // Out of bounds packets end up here as well, so that they get counted
+            pkt[nb_local++] = pkt[i];
+        }
+    }
+
+    for (uint16_t w = 0; w < core_work->nb_workers; w++) {
+        if (nb_staged[w] == 0)
+            continue;
+
+        unsigned sent = rte_ring_enqueue_burst(core_work->worker_rings[w], (void **)staged[w], nb_staged[w], NULL);
+        if (unlikely(sent < nb_staged[w])) {
+            rte_pktmbuf_free_bulk(&staged[w][sent], nb_staged[w] - sent);
+            stats->ring_dropped += nb_staged[w] - sent;
+        }
+    }
+
+    if (nb_local > 0)
+        decode_and_reply(core_work, task, pkt, nb_local);
+}
+
+struct idle_state {
+    uint32_t empty_rounds;
+    uint32_t sleep_us;
+    // The queue to monitor in case the lcore only polls a single one, negative otherwise
+    int monitor_port;
+    uint16_t monitor_queue;
+};
+
+static void idle_state_init(struct idle_state *idle, struct core_work *core_work) {
+    idle->empty_rounds = 0;
+    idle->sleep_us = 1;
+    idle->monitor_port = -1;
+
+    // We can only wait for a single address (rte_power_monitor_multi() needs TSX), so cores polling multiple queues sleep
+    struct rte_power_monitor_cond pmc;
+    if (can_power_monitor && !core_work->is_worker && core_work->count == 1 &&
+        rte_eth_get_monitor_addr(core_work->tasks[0].port, core_work->tasks[0].queue, &pmc) == 0) {
+        idle->monitor_port = core_work->tasks[0].port;
+        idle->monitor_queue = core_work->tasks[0].queue;
+    }
+}
+
+// Back to full spinning
+static inline void idle_reset(struct idle_state *idle) {
+    idle->empty_rounds = 0;
+    idle->sleep_us = 1;
+}
+
+// Called after a round over all queues of the lcore did not return a single packet. First we spin, then pause to give
+// the sibling hyperthread some room and at last we wait until the NIC writes the next RX descriptor (or sleep), but
+// never longer than max_wakeup_latency_us.
+static void idle_backoff(struct idle_state *idle) {
+    if (idle->empty_rounds < 2 * idle_spin_polls)
+        idle->empty_rounds++;
+
+    if (idle->empty_rounds < idle_spin_polls)
+        return;
+
+    if (idle->empty_rounds < 2 * idle_spin_polls) {
+        rte_pause();
+        return;
+    }
+
+    if (idle->monitor_port >= 0) {
+        // The address moves with every received packet, so we need to ask for it every time
+        struct rte_power_monitor_cond pmc;
+        if (rte_eth_get_monitor_addr(idle->monitor_port, idle->monitor_queue, &pmc) == 0) {
+            rte_power_monitor(&pmc, rte_rdtsc() + max_wakeup_latency_cycles);
+            return;
+        }
+    }
+
+    rte_delay_us_sleep(idle->sleep_us);
+    // Start with short sleeps, as the traffic might only have paused for a bit
+    if (idle->sleep_us < max_wakeup_latency_us)
+        idle->sleep_us = RTE_MIN(idle->sleep_us * 2, max_wakeup_latency_us);
+}
+
+static int worker_main(struct core_work *core_work) {
+    struct framebuffer* fb = core_work->fb;
+    struct queue_stats *stats = core_work->worker_stats;
+
+    printf("[DEBUG] Core %d will decode the packets of core %d\n", rte_lcore_id(), core_work->distributor);
+
+    struct rte_mbuf *pkt[BURST_SIZE];
+    struct rte_mbuf *replies[BURST_SIZE];
+    struct idle_state idle;
+    idle_state_init(&idle, core_work);
+    uint64_t last_tsc = rte_rdtsc();
+
+    while (!force_quit) {
+        uint16_t nb_rx = rte_ring_dequeue_burst(core_work->ring, (void **)pkt, BURST_SIZE, NULL);
+        if (nb_rx == 0) {
+            stats->empty_polls++;
+            if (idle_backoff_enabled)
+                idle_backoff(&idle);
+            uint64_t now = rte_rdtsc();
+            stats->idle_cycles += now - last_tsc;
+            last_tsc = now;
+            continue;
+        }
+        stats->rx_packets += nb_rx;
+        stats->burst_sizes[burst_histogram_bucket(nb_rx)]++;
+
+        uint64_t start = rte_rdtsc();
+        uint16_t nb_replies = decode_burst(fb, &stats->decoder, pkt, nb_rx, replies);
+        core_work->decode_cycles += rte_rdtsc() - start;
+        core_work->decoded_packets += nb_rx;
+
+        rte_pktmbuf_free_bulk(pkt, nb_rx);
+        // The distributor keeps everything that needs a reply, we don't have a TX queue to send it on anyway
+        if (unlikely(nb_replies > 0))
+            rte_pktmbuf_free_bulk(replies, nb_replies);
+
+        idle_reset(&idle);
+        uint64_t now = rte_rdtsc();
+        stats->busy_cycles += now - last_tsc;
+        last_tsc = now;
+    }
+    return 0;
+}
+
 static int lcore_main(void *arg) {
     uint16_t core_id = rte_lcore_id();
     struct core_work *core_work = &core_tasks[core_id];
-    struct framebuffer* fb = core_work->fb;
+
+    if (core_work->is_worker)
+        return worker_main(core_work);
 
     printf("[DEBUG] Core %d will handle %d queues\n", core_id, core_work->count);
 
@@ -298,109 +743,76 @@ static int lcore_main(void *arg) {
 
     // Actual packet processing starts
     struct rte_mbuf *pkt[BURST_SIZE];
+    struct idle_state idle;
+    idle_state_init(&idle, core_work);
+    if (idle_backoff_enabled)
+        printf("[DEBUG] Core %d will %s when idle\n", core_id, idle.monitor_port >= 0 ? "wait for the NIC" : "sleep");
 
-    bool was_pingxelflut;
-    struct rte_ether_hdr *eth_hdr;
-    struct rte_ipv4_hdr *ipv4_hdr;
-    struct rte_ipv6_hdr *ipv6_hdr;
-    struct rte_icmp_hdr *icmp_hdr;
+    // Every poll is accounted as busy or idle, depending on whether it returned packets
+    uint64_t last_tsc = rte_rdtsc();
 
-    uint8_t msg_kind;
-    uint16_t x, y;
-    uint32_t rgba, icmp_payload_len;
+    while (!force_quit) {
+        bool got_packets = false;
 
-    while (1) {
         for (uint16_t i = 0; i < core_work->count; i++) {
-            uint16_t port = core_work->tasks[i].port;
-            uint16_t queue = core_work->tasks[i].queue;
-            uint16_t nb_rx = rte_eth_rx_burst(port, queue, pkt, BURST_SIZE);
-            rx_counters[port][queue] += nb_rx;
-
-            for (uint16_t i = 0; i < nb_rx; i++) {
-                eth_hdr = rte_pktmbuf_mtod(pkt[i], struct rte_ether_hdr *);
-
-                // Let's handle pixelflut v6 traffic first, I assume that is a bit more performance-focused
-                if (eth_hdr->ether_type == htons(RTE_ETHER_TYPE_IPV6)) {
-                    ipv6_hdr = rte_pktmbuf_mtod_offset(pkt[i], struct rte_ipv6_hdr*, sizeof(struct rte_ether_hdr));
-
-                    // As we support both (pingxelflut (ICMP) and pixelflut v6 traffic, we first detect if it's pingxelflut
-                    // and only use pixelflut v6 in case it is not)
-                    was_pingxelflut = false;
-
-                    if (ipv6_hdr->proto == 58 /* ICMPv6 */) {
-                        icmp_hdr = rte_pktmbuf_mtod_offset(pkt[i], struct rte_icmp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr));
-                        // Note: In older(?) DPDK versions the constant was called RTE_ICMP6_ECHO_REQUEST
-                        if (icmp_hdr->icmp_type == RTE_IP_ICMP_ECHO_REQUEST && icmp_hdr->icmp_code == 0) {
-                            msg_kind = *rte_pktmbuf_mtod_offset(pkt[i], uint8_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr));
-                            if (msg_kind == MSG_SET_PIXEL) {
-                                was_pingxelflut = true;
-
-                                x = ntohs(*rte_pktmbuf_mtod_offset(pkt[i], uint16_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 1));
-                                y = ntohs(*rte_pktmbuf_mtod_offset(pkt[i], uint16_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 3));
-
-                                icmp_payload_len = pkt[i]->pkt_len - sizeof(struct rte_ether_hdr) - sizeof(struct rte_ipv6_hdr) - sizeof(struct rte_icmp_hdr);
-                                // Packet is only sending rgb
-                                if (icmp_payload_len == 8) {
-                                    rgba = *rte_pktmbuf_mtod_offset(pkt[i], uint32_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + 5);
-                                    fb_set(fb, x, y, rgba);
-                                // Packet is sending rgba
-                                } else if (icmp_payload_len == 9) {
-                                    // TODO: Implement alpha in SET_PIXEL command
-                                }
-                            } else if (msg_kind == MSG_SIZE_REQUEST) {
-                                was_pingxelflut = true;
-                                // TODO: Implement reading of screen size flow
-                            } else if (msg_kind == MSG_SIZE_RESPONSE) {
-                                was_pingxelflut = true;
-                            }
-                        }
-                    }
-
-                    if (!was_pingxelflut) {
-                        x = ((uint16_t)ipv6_hdr->dst_addr[8] << 8) | (uint16_t)ipv6_hdr->dst_addr[9];
-                        y = ((uint16_t)ipv6_hdr->dst_addr[10] << 8) | (uint16_t)ipv6_hdr->dst_addr[11];
-                        rgba = (uint32_t)ipv6_hdr->dst_addr[12] << 0 | (uint32_t)ipv6_hdr->dst_addr[13] << 8 | (uint32_t)ipv6_hdr->dst_addr[14] << 16;
-                        // rgba = 0x00ff0000; // blue
-                        // rgba = 0x0000ff00; // green
-                        // rgba = 0x000000ff; // red
-                        // printf("[DEBUG] x: %d, y: %d, rgba: %08x\n", x, y, rgba);
-
-                        fb_set(fb, x, y, rgba);
-                    }
-                } else if (eth_hdr->ether_type == htons(RTE_ETHER_TYPE_IPV4)) {
-                    ipv4_hdr = rte_pktmbuf_mtod_offset(pkt[i], struct rte_ipv4_hdr*, sizeof(struct rte_ether_hdr));
-                    if (ipv4_hdr->next_proto_id == IPPROTO_ICMP) {
-                        icmp_hdr = rte_pktmbuf_mtod_offset(pkt[i], struct rte_icmp_hdr*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr));
-                        if (icmp_hdr->icmp_type == RTE_IP_ICMP_ECHO_REQUEST && icmp_hdr->icmp_code == 0) {
-                            msg_kind = *rte_pktmbuf_mtod_offset(pkt[i], uint8_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr));
-                            if (msg_kind == MSG_SET_PIXEL) {
-                                x = ntohs(*rte_pktmbuf_mtod_offset(pkt[i], uint16_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + 1));
-                                y = ntohs(*rte_pktmbuf_mtod_offset(pkt[i], uint16_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + 3));
-
-                                icmp_payload_len = pkt[i]->pkt_len - sizeof(struct rte_ether_hdr) - sizeof(struct rte_ipv4_hdr) - sizeof(struct rte_icmp_hdr);
-                                // Packet is only sending rgb
-                                if (icmp_payload_len == 8) {
-                                    rgba = *rte_pktmbuf_mtod_offset(pkt[i], uint32_t*, sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + 5);
-                                    fb_set(fb, x, y, rgba);
-                                // Packet is sending rgba
-                                } else if (icmp_payload_len == 9) {
-                                    // TODO: Implement alpha in SET_PIXEL command
-                                }
-                            }
-                        }
-                    }
-                }
-
-                rte_pktmbuf_free(pkt[i]);
+            struct queue_stats *stats = core_work->tasks[i].stats;
+            uint16_t nb_rx = rte_eth_rx_burst(core_work->tasks[i].port, core_work->tasks[i].queue, pkt, BURST_SIZE);
+
+            if (nb_rx == 0) {
+                stats->empty_polls++;
+                uint64_t now = rte_rdtsc();
+                stats->idle_cycles += now - last_tsc;
+                last_tsc = now;
+                continue;
             }
+            stats->rx_packets += nb_rx;
+            stats->burst_sizes[burst_histogram_bucket(nb_rx)]++;
+
+            if (core_work->nb_workers > 0)
+                distribute_burst(core_work, i, pkt, nb_rx);
+            else
+                decode_and_reply(core_work, i, pkt, nb_rx);
+
+            uint64_t now = rte_rdtsc();
+            stats->busy_cycles += now - last_tsc;
+            last_tsc = now;
+            got_packets = true;
+        }
+
+        if (!idle_backoff_enabled)
+            continue;
+
+        if (got_packets) {
+            idle_reset(&idle);
+        } else {
+            idle_backoff(&idle);
+            // All queues were empty, so just put it on the last one
+            uint64_t now = rte_rdtsc();
+            core_work->tasks[core_work->count - 1].stats->idle_cycles += now - last_tsc;
+            last_tsc = now;
         }
     }
     return 0;
 }
 
-static void stats_loop(struct framebuffer* fb) {
-    // Store mapping from port to stats slot
-    int port_to_slot[MAX_PORTS];
+static struct queue_stats* claim_queue_stats_slot(struct framebuffer* fb, uint16_t port, uint16_t queue, uint16_t core,
+    enum queue_stats_role role) {
+    int slot = find_free_queue_stats_slot(fb);
+    if (slot == -1)
+        rte_exit(EXIT_FAILURE, "Failed to find free statistics slot for port %u queue %u core %u, increase MAX_QUEUE_STATS\n", port, queue, core);
+
+    // The counters are reset, so that they are in line with the NIC counters (which start at zero as well)
+    struct queue_stats *stats = &fb->queue_stats[slot];
+    memset(&stats->decoder, 0, sizeof(*stats) - offsetof(struct queue_stats, decoder));
+    stats->port_slot = port_to_slot[port];
+    stats->port = port;
+    stats->queue = queue;
+    stats->lcore = core;
+    stats->role = role;
+    return stats;
+}
+
+static void assign_stats_slots(struct framebuffer* fb) {
     for (int i = 0; i < MAX_PORTS; i++)
         port_to_slot[i] = -1;
 
@@ -423,9 +835,230 @@ static void stats_loop(struct framebuffer* fb) {
         port_to_slot[port_id] = stats_slot;
     }
 
+    // Release the queue slots a previous run on our ports left behind. We can't simply re-use them by port and queue
+    // anymore, as in pipeline mode the workers share the port and queue of their distributor.
+    for (uint16_t port_id = 0; port_id < total_ports; port_id++)
+        release_queue_stats_slots(fb, port_to_slot[port_id]);
+
+    for (uint16_t core = 0; core < MAX_CORES; core++) {
+        struct core_work *cw = &core_tasks[core];
+        for (uint16_t i = 0; i < cw->count; i++) {
+            cw->tasks[i].stats = claim_queue_stats_slot(fb, cw->tasks[i].port, cw->tasks[i].queue, core,
+                cw->nb_workers > 0 ? QUEUE_ROLE_DISTRIBUTOR : QUEUE_ROLE_RX);
+        }
+
+        // The workers decode the packets of all queues of their distributor, they are labeled with the first one
+        for (uint16_t w = 0; w < cw->nb_workers; w++) {
+            uint16_t worker = cw->workers[w];
+            core_tasks[worker].worker_stats = claim_queue_stats_slot(fb, cw->tasks[0].port, cw->tasks[0].queue,
+                worker, QUEUE_ROLE_WORKER);
+        }
+    }
+}
+
+static void init_tx_buffers(void) {
+    for (uint16_t core = 0; core < MAX_CORES; core++) {
+        struct core_work *cw = &core_tasks[core];
+        for (uint16_t i = 0; i < cw->count; i++) {
+            struct rte_eth_dev_tx_buffer *tx_buffer = rte_zmalloc_socket("tx_buffer",
+                RTE_ETH_TX_BUFFER_SIZE(BURST_SIZE), 0, rte_lcore_to_socket_id(core));
+            if (tx_buffer == NULL)
+                rte_exit(EXIT_FAILURE, "Failed to allocate TX buffer for core %u\n", core);
+
+            rte_eth_tx_buffer_init(tx_buffer, BURST_SIZE);
+            // Replies the NIC could not take are freed and counted
+            rte_eth_tx_buffer_set_err_callback(tx_buffer, rte_eth_tx_buffer_count_callback,
+                &cw->tasks[i].stats->tx_dropped);
+            cw->tasks[i].tx_buffer = tx_buffer;
+        }
+    }
+}
+
+static uint64_t total_rx_packets(void) {
+    uint64_t packets = 0;
+    for (uint16_t core = 0; core < MAX_CORES; core++) {
+        for (uint16_t i = 0; i < core_tasks[core].count; i++)
+            packets += core_tasks[core].tasks[i].stats->rx_packets;
+    }
+    return packets;
+}
+
+static void record_timelapse(struct framebuffer* fb, struct timelapse_stats* tl_stats) {
+    uint64_t start = rte_rdtsc();
+    if (start < tl_stats->next_snapshot)
+        return;
+    tl_stats->next_snapshot = start + timelapse_interval_cycles;
+
+    uint64_t start_packets = total_rx_packets();
+    if (tl_stats->last_end != 0) {
+        tl_stats->other_packets += start_packets - tl_stats->last_end_packets;
+        tl_stats->other_cycles += start - tl_stats->last_end;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    timelapse_snapshot(timelapse, fb);
+    uint64_t copied = rte_rdtsc();
+
+    ssize_t size = timelapse_append(timelapse, (uint64_t)now.tv_sec * NS_PER_S + now.tv_nsec);
+    if (size < 0)
+        rte_exit(EXIT_FAILURE, "Failed to append to the time-lapse: %s\n", strerror(-size));
+    uint64_t end = rte_rdtsc();
+    uint64_t end_packets = total_rx_packets();
+
+    tl_stats->frames++;
+    tl_stats->bytes += size;
+    tl_stats->copy_cycles = copied - start;
+    tl_stats->encode_cycles = end - copied;
+    tl_stats->recording_packets += end_packets - start_packets;
+    tl_stats->recording_cycles += end - start;
+    tl_stats->last_end = end;
+    tl_stats->last_end_packets = end_packets;
+}
+
+static void print_timelapse_stats(struct timelapse_stats* tl_stats) {
+    double hz = rte_get_tsc_hz();
+    printf("Time-lapse: %lu frames (%.1f MiB) recorded, last copy %.2fms + encode %.2fms", tl_stats->frames,
+        tl_stats->bytes / (1024.0 * 1024.0), 1e3 * tl_stats->copy_cycles / hz, 1e3 * tl_stats->encode_cycles / hz);
+    if (tl_stats->recording_cycles > 0 && tl_stats->other_cycles > 0)
+        printf(", RX %.2f Mpps while recording vs. %.2f Mpps otherwise",
+            tl_stats->recording_packets / (tl_stats->recording_cycles / hz) / 1e6,
+            tl_stats->other_packets / (tl_stats->other_cycles / hz) / 1e6);
+    printf("\n");
+}
+
+// Counters of all lcores and ports at a point in time, the results of a run are the difference of two of them
+struct run_counters {
+    uint64_t tsc;
+    struct {
+        uint64_t rx_packets;
+        uint64_t decoded_packets;
+        uint64_t busy_cycles;
+        uint64_t idle_cycles;
+        uint64_t ring_dropped;
+        uint64_t tx_dropped;
+        struct decoder_stats decoder;
+    } cores[MAX_CORES];
+    struct rte_eth_stats ports[MAX_PORTS];
+};
+
+static void add_queue_counters(struct run_counters* counters, uint16_t core, struct queue_stats* stats) {
+    counters->cores[core].rx_packets += stats->rx_packets;
+    counters->cores[core].busy_cycles += stats->busy_cycles;
+    counters->cores[core].idle_cycles += stats->idle_cycles;
+    counters->cores[core].ring_dropped += stats->ring_dropped;
+    counters->cores[core].tx_dropped += stats->tx_dropped;
+    counters->cores[core].decoder.pixelflut_v6 += stats->decoder.pixelflut_v6;
+    counters->cores[core].decoder.pingxelflut_v6 += stats->decoder.pingxelflut_v6;
+    counters->cores[core].decoder.pingxelflut_v4 += stats->decoder.pingxelflut_v4;
+    counters->cores[core].decoder.out_of_bounds += stats->decoder.out_of_bounds;
+    counters->cores[core].decoder.unknown += stats->decoder.unknown;
+    counters->cores[core].decoder.extra_pixels += stats->decoder.extra_pixels;
+    counters->cores[core].decoder.extra_pixels_rejected += stats->decoder.extra_pixels_rejected;
+}
+
+static void read_run_counters(struct run_counters* counters) {
+    memset(counters, 0, sizeof(*counters));
+    counters->tsc = rte_rdtsc();
+    for (uint16_t core = 0; core < MAX_CORES; core++) {
+        struct core_work *cw = &core_tasks[core];
+        for (uint16_t i = 0; i < cw->count; i++)
+            add_queue_counters(counters, core, cw->tasks[i].stats);
+        if (cw->is_worker)
+            add_queue_counters(counters, core, cw->worker_stats);
+        counters->cores[core].decoded_packets = cw->decoded_packets;
+    }
+    for (uint16_t port_id = 0; port_id < total_ports; port_id++)
+        rte_eth_stats_get(port_id, &counters->ports[port_id]);
+}
+
+// Machine readable results of a benchmark run, see --results
+static void write_results(const char* path, struct run_counters* start, struct run_counters* end) {
+    FILE* file = fopen(path, "w");
+    if (!file)
+        rte_exit(EXIT_FAILURE, "Failed to open the results file %s: %s\n", path, strerror(errno));
+
+    double seconds = (double)(end->tsc - start->tsc) / rte_get_tsc_hz();
+    uint64_t total_packets = 0;
+    fprintf(file, "{\"seconds\": %.3f, \"lcores\": [", seconds);
+    bool first = true;
+    for (uint16_t core = 0; core < MAX_CORES; core++) {
+        struct core_work *cw = &core_tasks[core];
+        if (cw->count == 0 && !cw->is_worker)
+            continue;
+
+#define DIFF(field) (end->cores[core].field - start->cores[core].field)
+        uint64_t busy = DIFF(busy_cycles);
+        uint64_t total = busy + DIFF(idle_cycles);
+        // Workers get their packets from their distributor, which already counted them
+        if (!cw->is_worker)
+            total_packets += DIFF(rx_packets);
+
+        fprintf(file, "%s\n  {\"lcore\": %u, \"role\": \"%s\", \"rx_packets\": %lu, \"mpps\": %.3f, "
+            "\"decoded_packets\": %lu, \"busy_percent\": %.1f, \"pixelflut_v6\": %lu, \"pingxelflut_v6\": %lu, "
+            "\"pingxelflut_v4\": %lu, \"out_of_bounds\": %lu, \"unknown\": %lu, \"extra_pixels\": %lu, "
+            "\"extra_pixels_rejected\": %lu, \"ring_dropped\": %lu, \"tx_dropped\": %lu}",
+            first ? "" : ",", core, cw->is_worker ? "worker" : "rx", DIFF(rx_packets), DIFF(rx_packets) / seconds / 1e6,
+            DIFF(decoded_packets), total > 0 ? 100.0 * busy / total : 0.0, DIFF(decoder.pixelflut_v6),
+            DIFF(decoder.pingxelflut_v6), DIFF(decoder.pingxelflut_v4), DIFF(decoder.out_of_bounds),
+            DIFF(decoder.unknown), DIFF(decoder.extra_pixels), DIFF(decoder.extra_pixels_rejected),
+            DIFF(ring_dropped), DIFF(tx_dropped));
+#undef DIFF
+        first = false;
+    }
+
+    fprintf(file, "\n], \"ports\": [");
+    first = true;
+    for (uint16_t port_id = 0; port_id < total_ports; port_id++) {
+        if (ports[port_id].nb_queues == 0)
+            continue;
+
+#define DIFF(field) (end->ports[port_id].field - start->ports[port_id].field)
+        // imissed are the packets the NIC dropped as we were too slow
+        fprintf(file, "%s\n  {\"port\": %u, \"ipackets\": %lu, \"imissed\": %lu, \"ierrors\": %lu, "
+            "\"rx_nombuf\": %lu}", first ? "" : ",", port_id, DIFF(ipackets), DIFF(imissed), DIFF(ierrors),
+            DIFF(rx_nombuf));
+#undef DIFF
+        first = false;
+    }
+    fprintf(file, "\n], \"total_mpps\": %.3f}\n", total_packets / seconds / 1e6);
+
+    if (fclose(file) != 0)
+        rte_exit(EXIT_FAILURE, "Failed to write the results file %s: %s\n", path, strerror(errno));
+    printf("Wrote the results of the last %.1f seconds (%.2f Mpps) to %s\n", seconds, total_packets / seconds / 1e6,
+        path);
+}
+
+static void stats_loop(struct framebuffer* fb, const char* results) {
+    // Used to calculate the decode cycles/packet since the last print
+    uint64_t prev_decode_cycles[MAX_CORES] = {0};
+    uint64_t prev_decoded_packets[MAX_CORES] = {0};
+    // Used to calculate the utilization since the last print
+    uint64_t prev_busy_cycles[MAX_CORES] = {0};
+    uint64_t prev_idle_cycles[MAX_CORES] = {0};
+    struct timelapse_stats tl_stats = {0};
+
+    // See --run-time
+    static struct run_counters start_counters, end_counters;
+    uint64_t start_tsc = rte_rdtsc();
+    bool warm = false;
+
     // Do actual stat polling
     int print_to_screen_counter = 50;
     while (1) {
+        if (run_time_cycles > 0) {
+            uint64_t elapsed = rte_rdtsc() - start_tsc;
+            if (!warm && elapsed >= rte_get_tsc_hz() * RESULTS_WARMUP_MS / MS_PER_S) {
+                read_run_counters(&start_counters);
+                warm = true;
+            }
+            if (elapsed >= run_time_cycles) {
+                read_run_counters(&end_counters);
+                force_quit = true;
+                break;
+            }
+        }
+
         for (uint16_t port_id = 0; port_id < total_ports; port_id++) {
             int slot = port_to_slot[port_id];
             if (slot == -1)
@@ -438,17 +1071,73 @@ static void stats_loop(struct framebuffer* fb) {
                 print_to_screen_counter = 50;
 
                 printf("\n[RX Stats]\n");
-                for (uint16_t p = 0; p < MAX_PORTS; p++) {
-                    for (uint16_t q = 0; q < ports[p].nb_queues; q++) {
-                        printf("Port %u Queue %u: %lu pkts\n", p, q, rx_counters[p][q]);
+                for (uint16_t core = 0; core < MAX_CORES; core++) {
+                    struct core_work *cw = &core_tasks[core];
+                    for (uint16_t i = 0; i < cw->count; i++) {
+                        struct queue_stats *stats = cw->tasks[i].stats;
+                        printf("Port %u Queue %u Core %u: %lu pkts, %lu empty polls, %lu out of bounds, %lu unknown",
+                            stats->port, stats->queue, core, stats->rx_packets, stats->empty_polls,
+                            stats->decoder.out_of_bounds, stats->decoder.unknown);
+                        if (cw->nb_workers > 0)
+                            printf(", %lu ring dropped", stats->ring_dropped);
+                        if (stats->decoder.extra_pixels + stats->decoder.extra_pixels_rejected > 0)
+                            printf(", %lu extra pixels (%lu rejected)", stats->decoder.extra_pixels,
+                                stats->decoder.extra_pixels_rejected);
+                        printf("\n");
+                    }
+
+                    if (cw->is_worker) {
+                        struct queue_stats *stats = cw->worker_stats;
+                        printf("Worker Core %u (of Core %u): %lu pkts, %lu empty polls, %lu out of bounds\n",
+                            core, cw->distributor, stats->rx_packets, stats->empty_polls, stats->decoder.out_of_bounds);
                     }
                 }
+
+                for (uint16_t core = 0; core < MAX_CORES; core++) {
+                    struct core_work *cw = &core_tasks[core];
+                    if (cw->count == 0 && !cw->is_worker)
+                        continue;
+
+                    uint64_t cycles = cw->decode_cycles - prev_decode_cycles[core];
+                    uint64_t packets = cw->decoded_packets - prev_decoded_packets[core];
+                    prev_decode_cycles[core] = cw->decode_cycles;
+                    prev_decoded_packets[core] = cw->decoded_packets;
+
+                    uint64_t busy_cycles = 0, idle_cycles = 0;
+                    for (uint16_t i = 0; i < cw->count; i++) {
+                        busy_cycles += cw->tasks[i].stats->busy_cycles;
+                        idle_cycles += cw->tasks[i].stats->idle_cycles;
+                    }
+                    if (cw->is_worker) {
+                        busy_cycles += cw->worker_stats->busy_cycles;
+                        idle_cycles += cw->worker_stats->idle_cycles;
+                    }
+                    uint64_t busy = busy_cycles - prev_busy_cycles[core];
+                    uint64_t total = busy + idle_cycles - prev_idle_cycles[core];
+                    prev_busy_cycles[core] = busy_cycles;
+                    prev_idle_cycles[core] = idle_cycles;
+
+                    printf("Core %u: %.1f%% busy", core, total > 0 ? 100.0 * busy / total : 0.0);
+                    if (packets > 0)
+                        printf(", %.1f cycles/packet", (double)cycles / packets);
+                    printf("\n");
+                }
+
+                if (timelapse)
+                    print_timelapse_stats(&tl_stats);
                 fflush(stdout);
             }
         }
 
+        // Snapshots are taken here (and not by the RX cores), so recording never stalls packet processing
+        if (timelapse)
+            record_timelapse(fb, &tl_stats);
+
         usleep(100000); // Sleep 100ms
     }
+
+    if (results)
+        write_results(results, &start_counters, &end_counters);
 }
 
 int main(int argc, char **argv) {
@@ -469,6 +1158,14 @@ int main(int argc, char **argv) {
     arguments.height = 1080;
     arguments.shared_memory_name = "/pixelflut";
     arguments.port_core_mapping = "";
+    arguments.decoder = DECODER_AUTO;
+    arguments.prefetch_headers = DEFAULT_PREFETCH_HEADERS;
+    arguments.prefetch_pixels = DEFAULT_PREFETCH_PIXELS;
+    arguments.shard_prefix_len = 64;
+    arguments.idle_spin_polls = DEFAULT_IDLE_SPIN_POLLS;
+    arguments.max_wakeup_latency_us = DEFAULT_MAX_WAKEUP_LATENCY_US;
+    arguments.timelapse_interval_ms = DEFAULT_TIMELAPSE_INTERVAL_MS;
+    arguments.timelapse_keyframes = DEFAULT_TIMELAPSE_KEYFRAMES;
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
     parse_port_core_map(arguments.port_core_mapping);
@@ -477,13 +1174,44 @@ int main(int argc, char **argv) {
 
     // Create framebuffer
     struct framebuffer* fb;
-    ret = create_fb(&fb, arguments.width, arguments.height, arguments.shared_memory_name);
-    if (ret < 0)
+    ret = create_fb(&fb, arguments.width, arguments.height, arguments.has_region ? &arguments.region : NULL,
+        arguments.shared_memory_name, arguments.hugepage_dir, arguments.transparent_hugepages);
+    // create_fb() returns a (positive) errno
+    if (ret != 0)
         rte_exit(EXIT_FAILURE, "Failed to allocate framebuffer\n");
 
+    ret = decoder_init(fb, arguments.decoder);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "The decoder %s is not supported on this CPU\n", decoder_impl_name(arguments.decoder));
+    printf("Using the %s packet decoder\n", decoder_impl_name(ret));
+    decoder_set_prefetch(arguments.prefetch_headers, arguments.prefetch_pixels);
+    distribute_prefetch_headers = arguments.prefetch_headers;
+    decoder_set_multi_pixel(arguments.multi_pixel, arguments.shard_prefix_len);
+
+    idle_backoff_enabled = arguments.idle_backoff;
+    idle_spin_polls = arguments.idle_spin_polls;
+    max_wakeup_latency_us = arguments.max_wakeup_latency_us;
+    max_wakeup_latency_cycles = rte_get_tsc_hz() * max_wakeup_latency_us / US_PER_S;
+    if (idle_backoff_enabled) {
+        struct rte_cpu_intrinsics intrinsics;
+        rte_cpu_get_intrinsics_support(&intrinsics);
+        can_power_monitor = intrinsics.power_monitor;
+        printf("Idle backoff enabled after %u empty polls, max wake-up latency %uus, power monitor %ssupported\n",
+            idle_spin_polls, max_wakeup_latency_us, can_power_monitor ? "" : "not ");
+    }
+
+    if (arguments.timelapse) {
+        ret = timelapse_open(&timelapse, arguments.timelapse, fb, arguments.timelapse_keyframes);
+        if (ret != 0)
+            rte_exit(EXIT_FAILURE, "Failed to open the time-lapse\n");
+        timelapse_interval_cycles = rte_get_tsc_hz() * arguments.timelapse_interval_ms / MS_PER_S;
+    }
+
     check_and_enable_lcores();
     build_core_task_map();
-    print_assignment();
+    if (arguments.pipeline_workers)
+        parse_pipeline_workers(arguments.pipeline_workers);
+    print_assignment(fb);
 
     mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS * rte_lcore_count(),
                                         MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
@@ -493,15 +1221,26 @@ int main(int argc, char **argv) {
     for (uint16_t p = 0; p < total_ports; p++)
         init_port(p);
 
+    assign_stats_slots(fb);
+    init_tx_buffers();
+    init_pipelines(fb);
+
     unsigned int core_id;
     RTE_LCORE_FOREACH_WORKER(core_id) {
-        if (core_tasks[core_id].count > 0) {
+        if (core_tasks[core_id].count > 0 || core_tasks[core_id].is_worker) {
             core_tasks[core_id].fb = fb;
             rte_eal_remote_launch(lcore_main, NULL, core_id);
         }
     }
 
-    stats_loop(fb);
+    run_time_cycles = rte_get_tsc_hz() * arguments.run_time_s;
+    stats_loop(fb, arguments.results);
     rte_eal_mp_wait_lcore();
+
+    for (uint16_t p = 0; p < total_ports; p++) {
+        if (ports[p].nb_queues > 0)
+            rte_eth_dev_stop(p);
+    }
+    rte_eal_cleanup();
     return 0;
 }
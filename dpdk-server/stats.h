@@ -3,9 +3,71 @@
 
 #include <rte_ethdev.h>
 
+#define MAX_QUEUE_STATS 512 // Needs to match Rust code
+
+enum queue_stats_role {
+    // Polls the RX queue and decodes the packets
+    QUEUE_ROLE_RX,
+    // Polls the RX queue and hands the packets to its workers (see --pipeline-workers)
+    QUEUE_ROLE_DISTRIBUTOR,
+    // Decodes the packets a distributor polled from the RX queue
+    QUEUE_ROLE_WORKER,
+};
+
+// Bucket i counts the RX bursts with [2^i, 2^(i+1)) packets, the last bucket counts everything above (the full bursts)
+#define BURST_HISTOGRAM_BUCKETS 6 // Needs to match Rust code
+
 struct port_stats {
     struct rte_ether_addr mac_addr;
     struct rte_eth_stats stats;
 };
 
+// Counted by the decoder. Every packet is counted exactly once in one of the protocols or as unknown,
+// out_of_bounds is a subset of the protocol counters. It includes the pixels outside of our region (see --region).
+struct decoder_stats {
+    uint64_t pixelflut_v6;
+    uint64_t pingxelflut_v6;
+    uint64_t pingxelflut_v4;
+    uint64_t out_of_bounds;
+    uint64_t unknown;
+    // Additional pixels of multi-pixel packets (see decoder_set_multi_pixel()), which are not counted as packets.
+    // Rejected ones are out of bounds or outside of the shard.
+    uint64_t extra_pixels;
+    uint64_t extra_pixels_rejected;
+};
+
+// Statistics of a single RX queue. Every queue is polled by exactly one lcore, which is the only one writing to it.
+// As it gets written for every burst, it gets its own cache line, so that the lcores don't fight over them.
+// In pipeline mode every worker of the distributor polling the queue gets a slot as well.
+struct queue_stats {
+    // Zero in case the slot is free
+    uint16_t in_use;
+    // Index into the port stats, so that the MAC address can be looked up
+    uint16_t port_slot;
+    uint16_t port;
+    uint16_t queue;
+    uint32_t lcore;
+    uint16_t role;
+    uint16_t reserved;
+
+    struct decoder_stats decoder;
+    // For workers these count the packets and polls of their ring
+    uint64_t rx_packets;
+    uint64_t empty_polls;
+    uint64_t burst_sizes[BURST_HISTOGRAM_BUCKETS];
+    // Replies (e.g. pingxelflut SIZE_RESPONSE) that could not be sent
+    uint64_t tx_dropped;
+    // Packets the distributor could not hand to a worker, as the ring of the worker was full
+    uint64_t ring_dropped;
+    // TSC cycles spent on polls that returned packets (including decoding them) and on empty polls (including the
+    // idle backoff). Their ratio is the utilization of the lcore.
+    uint64_t busy_cycles;
+    uint64_t idle_cycles;
+} __rte_cache_aligned;
+
+static inline unsigned burst_histogram_bucket(uint16_t nb_rx) {
+    unsigned bucket = 31 - __builtin_clz(nb_rx);
+    return bucket < BURST_HISTOGRAM_BUCKETS ? bucket : BURST_HISTOGRAM_BUCKETS - 1;
+}
+
 #endif
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <argp.h>
+
+#include <rte_common.h>
+
+#include "framebuffer.h"
+#include "timelapse.h"
+
+static struct argp_option options[] = {
+    {"file", 'f', "file", 0, "Time-lapse recorded by pixelflut-v6-server --timelapse"},
+    {"frame", 'n', "frame", 0, "Index of the frame to restore, negative ones count from the end (default -1, the last one)"},
+    {"shared-memory-name", 's', "name", 0, "Name of the shared memory to restore the frame into. Usually it will be created at /dev/shm/<name> (default pixelflut)"},
+    {"hugepage-dir", 'g', "path", 0, "Create the shared memory as file within the given hugetlbfs mount (e.g. /dev/hugepages) instead of /dev/shm, needs to match the server"},
+    {"transparent-hugepages", 't', 0, 0, "Ask the kernel to back the shared memory in /dev/shm with transparent huge pages, needs to match the server"},
+    {"export-dir", 'e', "path", 0, "Instead of restoring the frame, write all frames up to it as PPM images into the given directory (e.g. to turn them into a video using ffmpeg)"},
+    {"list", 'l', 0, 0, "Only list the frames of the time-lapse"},
+    {0}
+};
+
+struct arguments {
+    char* file;
+    int64_t frame;
+    char* shared_memory_name;
+    char* hugepage_dir;
+    bool transparent_hugepages;
+    char* export_dir;
+    bool list;
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    // Get the input argument from argp_parse, which we know is a pointer to our arguments structure
+    struct arguments *arguments = state->input;
+
+    switch (key)
+    {
+        case 'f':
+            arguments->file = arg;
+            break;
+        case 'n':
+            arguments->frame = strtoll(arg, NULL, 10);
+            break;
+        case 's':
+            arguments->shared_memory_name = arg;
+            break;
+        case 'g':
+            arguments->hugepage_dir = arg;
+            break;
+        case 't':
+            arguments->transparent_hugepages = true;
+            break;
+        case 'e':
+            arguments->export_dir = arg;
+            break;
+        case 'l':
+            arguments->list = true;
+            break;
+        case ARGP_KEY_END:
+            if (!arguments->file)
+                argp_error(state, "Please pass the time-lapse using --file");
+            break;
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+const char *argp_program_version = "timelapse-replay 0.1.0";
+static char doc[] = "Restores a frame of a pixelflut-v6-server time-lapse into the shared memory or exports it as images. "
+    "Run it before starting the server to continue where a previous run left off";
+static char args_doc[] = "";
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+static void export_ppm(const char* dir, uint64_t index, uint32_t* pixels, uint16_t width, uint16_t height) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/frame-%06lu.ppm", dir, index);
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("Failed to open %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    uint8_t row[3 * UINT16_MAX];
+    for (uint32_t y = 0; y < height; y++) {
+        // The bytes of every pixel are r, g, b and an unused one
+        const uint8_t* src = (const uint8_t*)&pixels[(size_t)y * width];
+        for (uint32_t x = 0; x < width; x++)
+            memcpy(&row[3 * x], &src[4 * x], 3);
+        fwrite(row, 3, width, file);
+    }
+
+    if (fclose(file) != 0) {
+        printf("Failed to write %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char **argv) {
+    struct arguments arguments = {0};
+    arguments.frame = -1;
+    arguments.shared_memory_name = "/pixelflut";
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    struct timelapse_reader reader;
+    if (timelapse_reader_open(&reader, arguments.file) != 0)
+        return EXIT_FAILURE;
+    uint16_t width = reader.header->width;
+    uint16_t height = reader.header->height;
+    // The server only recorded its region of the screen, it's restored into the same region
+    struct fb_rect region = {
+        .x = reader.header->region_x,
+        .y = reader.header->region_y,
+        .width = width,
+        .height = height,
+    };
+    uint16_t screen_width = reader.header->screen_width;
+    uint16_t screen_height = reader.header->screen_height;
+    uint64_t frames = reader.header->frames;
+    printf("Time-lapse of the region %ux%u+%u+%u of a (%u, %u) screen with %lu frames (%lu KiB)\n", width, height,
+        region.x, region.y, screen_width, screen_height, frames, reader.length / 1024);
+
+    // Walk the frame headers once, so that we can start decoding at the last keyframe before the requested frame
+    struct timelapse_frame_header frame;
+    uint64_t start_offset = reader.offset;
+    uint64_t start_index = 0;
+    uint64_t index = 0;
+    int64_t target = arguments.frame < 0 ? (int64_t)frames + arguments.frame : arguments.frame;
+    while (true) {
+        size_t offset = reader.offset;
+        int ret = timelapse_reader_next(&reader, NULL, &frame);
+        if (ret == 0)
+            break;
+        if (ret < 0) {
+            printf("Frame %lu is corrupt, ignoring it and all following ones\n", index);
+            break;
+        }
+
+        if (arguments.list)
+            printf("Frame %lu: %s at %lu.%03lu, %u runs, %lu bytes\n", index,
+                frame.kind == TIMELAPSE_KEYFRAME ? "keyframe" : "delta", frame.timestamp_ns / 1000000000,
+                frame.timestamp_ns / 1000000 % 1000, frame.runs, frame.size);
+        if (frame.kind == TIMELAPSE_KEYFRAME && (int64_t)index <= target && !arguments.export_dir) {
+            start_offset = offset;
+            start_index = index;
+        }
+        index++;
+    }
+    if (arguments.list)
+        return EXIT_SUCCESS;
+
+    if (target < 0 || (uint64_t)target >= index) {
+        printf("There is no frame %ld, the time-lapse has %lu readable frames\n", arguments.frame, index);
+        return EXIT_FAILURE;
+    }
+
+    uint32_t* pixels = calloc((size_t)width * height, sizeof(uint32_t));
+    if (!pixels) {
+        printf("Failed to allocate the pixels\n");
+        return EXIT_FAILURE;
+    }
+    reader.offset = start_offset;
+    for (index = start_index; (int64_t)index <= target; index++) {
+        if (timelapse_reader_next(&reader, pixels, &frame) != 1) {
+            printf("Frame %lu is corrupt\n", index);
+            return EXIT_FAILURE;
+        }
+        if (arguments.export_dir)
+            export_ppm(arguments.export_dir, index, pixels, width, height);
+    }
+    timelapse_reader_close(&reader);
+
+    if (arguments.export_dir) {
+        printf("Exported %ld frames to %s\n", target + 1, arguments.export_dir);
+        return EXIT_SUCCESS;
+    }
+
+    struct framebuffer* fb;
+    if (create_fb(&fb, screen_width, screen_height, &region, arguments.shared_memory_name, arguments.hugepage_dir,
+            arguments.transparent_hugepages) != 0)
+        return EXIT_FAILURE;
+
+    memcpy(fb->pixels, pixels, (size_t)width * height * sizeof(uint32_t));
+    // Let the pixel-fluter send the whole canvas
+    memset(fb->dirty, 0xff, fb->header->dirty.size);
+    printf("Restored frame %ld (decoded from frame %lu on) into %s\n", target, start_index,
+        arguments.shared_memory_name);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,340 @@
+#define _GNU_SOURCE // mremap()
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <rte_common.h>
+#include <rte_cpuflags.h>
+
+#ifdef RTE_ARCH_X86
+#include <immintrin.h>
+#endif
+
+#include "timelapse.h"
+
+// The file is grown (sparse) in steps of this size, so that we don't need to remap it for every frame
+#define TIMELAPSE_GROW_SIZE (64 * 1024 * 1024)
+
+// Gaps of unchanged pixels shorter than this are stored as part of the surrounding run (as zero XOR), as starting a new
+// run costs 8 bytes
+#define MIN_SKIP 2
+
+static void copy_pixels_plain(uint32_t* dst, const uint32_t* src, size_t pixels) {
+    memcpy(dst, src, pixels * sizeof(uint32_t));
+}
+
+#ifdef RTE_ARCH_X86
+// The pixels start at a page boundary (see FB_PIXELS_ALIGN) and the snapshot buffer is cache line aligned.
+// MOVNTDQA is only non-temporal on write-combining memory, on the (write-back) shared memory it's a plain load. So the
+// source is read using prefetchnta, which keeps the lines out of most of the cache hierarchy, and the snapshot is
+// written using streaming stores, so that the snapshot buffer doesn't fill the cache.
+__attribute__((target("sse2")))
+static void copy_pixels_nt(uint32_t* dst, const uint32_t* src, size_t pixels) {
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        // Prefetching is not faulting, so we don't care about running over the end
+        _mm_prefetch((const char*)(src + i) + 1024, _MM_HINT_NTA);
+        __m128i a = _mm_load_si128((const __m128i*)(src + i));
+        __m128i b = _mm_load_si128((const __m128i*)(src + i + 4));
+        __m128i c = _mm_load_si128((const __m128i*)(src + i + 8));
+        __m128i d = _mm_load_si128((const __m128i*)(src + i + 12));
+        _mm_stream_si128((__m128i*)(dst + i), a);
+        _mm_stream_si128((__m128i*)(dst + i + 4), b);
+        _mm_stream_si128((__m128i*)(dst + i + 8), c);
+        _mm_stream_si128((__m128i*)(dst + i + 12), d);
+    }
+    // The streaming stores are weakly ordered, fence them before anything else touches the snapshot
+    _mm_sfence();
+    copy_pixels_plain(dst + i, src + i, pixels - i);
+}
+#endif
+
+static void (*copy_pixels)(uint32_t* dst, const uint32_t* src, size_t pixels) = copy_pixels_plain;
+
+static inline size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+// Upper bound of the bytes a frame can take. Every run holds at least one pixel and runs are at least MIN_SKIP pixels
+// apart, so there are at most pixels / (MIN_SKIP + 1) + 1 of them.
+static size_t max_frame_size(size_t pixels) {
+    return sizeof(struct timelapse_frame_header) + pixels * sizeof(uint32_t)
+        + (pixels / (MIN_SKIP + 1) + 1) * sizeof(struct timelapse_run);
+}
+
+static int grow(struct timelapse* timelapse, size_t size) {
+    if (size <= timelapse->mapped)
+        return 0;
+
+    size = align_up(size + TIMELAPSE_GROW_SIZE, sysconf(_SC_PAGESIZE));
+    if (ftruncate(timelapse->fd, size) == -1)
+        return errno;
+
+    char* map = mremap(timelapse->map, timelapse->mapped, size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED)
+        return errno;
+
+    timelapse->map = map;
+    timelapse->mapped = size;
+    timelapse->header = (struct timelapse_file_header*)map;
+    return 0;
+}
+
+int timelapse_open(struct timelapse** timelapse, const char* path, struct framebuffer* fb,
+        uint32_t keyframe_interval) {
+    uint16_t width = fb->width;
+    uint16_t height = fb->height;
+    int fd = open(path, O_CREAT | O_RDWR, 0666);
+    if (fd == -1) {
+        printf("Failed to open time-lapse at %s: %s\n", path, strerror(errno));
+        return errno;
+    }
+
+    struct stat file_stats;
+    if (fstat(fd, &file_stats) == -1) {
+        printf("Failed to fstat time-lapse at %s: %s\n", path, strerror(errno));
+        return errno;
+    }
+
+    bool fresh_file = file_stats.st_size == 0;
+    size_t mapped = file_stats.st_size;
+    if (fresh_file) {
+        mapped = TIMELAPSE_GROW_SIZE;
+        if (ftruncate(fd, mapped) == -1) {
+            printf("Failed to resize time-lapse at %s: %s\n", path, strerror(errno));
+            return errno;
+        }
+    } else if (mapped < sizeof(struct timelapse_file_header)) {
+        printf("Found existing file at %s, but it is too short to be a time-lapse\n", path);
+        return EINVAL;
+    }
+
+    char* map = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        printf("Failed to mmap time-lapse at %s: %s\n", path, strerror(errno));
+        return errno;
+    }
+
+    struct timelapse_file_header* header = (struct timelapse_file_header*)map;
+    if (fresh_file) {
+        header->version = TIMELAPSE_VERSION;
+        header->header_size = sizeof(struct timelapse_file_header);
+        header->width = width;
+        header->height = height;
+        header->screen_width = fb->screen_width;
+        header->screen_height = fb->screen_height;
+        header->region_x = fb->region_x;
+        header->region_y = fb->region_y;
+        header->length = sizeof(struct timelapse_file_header);
+        __atomic_store_n(&header->magic, TIMELAPSE_MAGIC, __ATOMIC_RELEASE);
+    } else if (header->magic != TIMELAPSE_MAGIC || header->version != TIMELAPSE_VERSION) {
+        printf("Found existing file at %s, but it is not a time-lapse of version %u\n", path, TIMELAPSE_VERSION);
+        return EINVAL;
+    } else if (header->width != width || header->height != height || header->screen_width != fb->screen_width
+            || header->screen_height != fb->screen_height || header->region_x != fb->region_x
+            || header->region_y != fb->region_y) {
+        printf("Found existing time-lapse at %s, but it has the region %ux%u+%u+%u of a (%u, %u) screen instead of "
+            "%ux%u+%u+%u of a (%u, %u) screen\n", path, header->width, header->height, header->region_x,
+            header->region_y, header->screen_width, header->screen_height, width, height, fb->region_x, fb->region_y,
+            fb->screen_width, fb->screen_height);
+        return EINVAL;
+    } else if (header->length > mapped) {
+        printf("Found existing time-lapse at %s, but it is truncated\n", path);
+        return EINVAL;
+    }
+
+    size_t buffer_size = align_up((size_t)width * height * sizeof(uint32_t), 64);
+    struct timelapse* tl = malloc(sizeof(struct timelapse));
+    tl->fd = fd;
+    tl->map = map;
+    tl->mapped = mapped;
+    tl->header = header;
+    tl->width = width;
+    tl->height = height;
+    tl->keyframe_interval = RTE_MAX(keyframe_interval, 1u);
+    // We don't know the last frame of an existing time-lapse, so we start with a keyframe
+    tl->frames_since_keyframe = tl->keyframe_interval;
+    tl->prev = aligned_alloc(64, buffer_size);
+    tl->snapshot = aligned_alloc(64, buffer_size);
+    if (tl->prev == NULL || tl->snapshot == NULL) {
+        printf("Failed to allocate the time-lapse snapshot buffers\n");
+        return ENOMEM;
+    }
+
+#ifdef RTE_ARCH_X86
+    if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_SSE2))
+        copy_pixels = copy_pixels_nt;
+#endif
+
+    printf("Recording time-lapse to %s, which already has %lu frames (%lu KiB)\n", path, header->frames,
+        header->length / 1024);
+
+    *timelapse = tl;
+    return 0;
+}
+
+void timelapse_snapshot(struct timelapse* timelapse, struct framebuffer* fb) {
+    copy_pixels(timelapse->snapshot, fb->pixels, (size_t)fb->width * fb->height);
+}
+
+// Writes the runs of XOR(cur, prev) to out, returns the number of bytes written
+static size_t encode_runs(const uint32_t* cur, const uint32_t* prev, size_t pixels, char* out, uint32_t* nb_runs) {
+    char* pos = out;
+    size_t run_end = 0;
+    size_t i = 0;
+    *nb_runs = 0;
+
+    while (true) {
+        while (i < pixels && cur[i] == prev[i])
+            i++;
+        if (i == pixels)
+            break;
+
+        // Extend the run until we find a big enough gap of unchanged pixels
+        size_t start = i;
+        size_t last_changed = i;
+        for (; i < pixels; i++) {
+            if (cur[i] != prev[i])
+                last_changed = i;
+            else if (i - last_changed >= MIN_SKIP)
+                break;
+        }
+
+        struct timelapse_run run = {
+            .skip = start - run_end,
+            .count = last_changed + 1 - start,
+        };
+        memcpy(pos, &run, sizeof(run));
+        pos += sizeof(run);
+
+        uint32_t* words = (uint32_t*)pos;
+        for (uint32_t j = 0; j < run.count; j++)
+            words[j] = cur[start + j] ^ prev[start + j];
+        pos += run.count * sizeof(uint32_t);
+
+        run_end = start + run.count;
+        i = run_end;
+        (*nb_runs)++;
+    }
+
+    return pos - out;
+}
+
+ssize_t timelapse_append(struct timelapse* timelapse, uint64_t timestamp_ns) {
+    size_t pixels = (size_t)timelapse->width * timelapse->height;
+    size_t offset = timelapse->header->length;
+    int ret = grow(timelapse, offset + max_frame_size(pixels));
+    if (ret != 0)
+        return -ret;
+
+    bool keyframe = timelapse->frames_since_keyframe >= timelapse->keyframe_interval;
+    if (keyframe) {
+        // Keyframes are deltas against a black frame, so that replaying can start at them
+        memset(timelapse->prev, 0, pixels * sizeof(uint32_t));
+        timelapse->frames_since_keyframe = 0;
+    }
+    timelapse->frames_since_keyframe++;
+
+    struct timelapse_frame_header* frame = (struct timelapse_frame_header*)(timelapse->map + offset);
+    frame->kind = keyframe ? TIMELAPSE_KEYFRAME : TIMELAPSE_DELTA;
+    frame->timestamp_ns = timestamp_ns;
+    frame->size = encode_runs(timelapse->snapshot, timelapse->prev, pixels, (char*)(frame + 1), &frame->runs);
+
+    uint32_t* tmp = timelapse->prev;
+    timelapse->prev = timelapse->snapshot;
+    timelapse->snapshot = tmp;
+
+    // Only now the frame becomes part of the file
+    size_t frame_size = sizeof(struct timelapse_frame_header) + frame->size;
+    timelapse->header->frames++;
+    __atomic_store_n(&timelapse->header->length, offset + frame_size, __ATOMIC_RELEASE);
+    return frame_size;
+}
+
+int timelapse_reader_open(struct timelapse_reader* reader, const char* path) {
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd == -1) {
+        printf("Failed to open time-lapse at %s: %s\n", path, strerror(errno));
+        return errno;
+    }
+
+    struct stat file_stats;
+    if (fstat(reader->fd, &file_stats) == -1) {
+        printf("Failed to fstat time-lapse at %s: %s\n", path, strerror(errno));
+        return errno;
+    }
+    if ((size_t)file_stats.st_size < sizeof(struct timelapse_file_header)) {
+        printf("%s is too short to be a time-lapse\n", path);
+        return EINVAL;
+    }
+
+    reader->map = mmap(NULL, file_stats.st_size, PROT_READ, MAP_SHARED, reader->fd, 0);
+    if (reader->map == MAP_FAILED) {
+        printf("Failed to mmap time-lapse at %s: %s\n", path, strerror(errno));
+        return errno;
+    }
+
+    reader->header = (const struct timelapse_file_header*)reader->map;
+    if (reader->header->magic != TIMELAPSE_MAGIC || reader->header->version != TIMELAPSE_VERSION) {
+        printf("%s is not a time-lapse of version %u\n", path, TIMELAPSE_VERSION);
+        return EINVAL;
+    }
+
+    reader->length = RTE_MIN((size_t)reader->header->length, (size_t)file_stats.st_size);
+    reader->offset = reader->header->header_size;
+    return 0;
+}
+
+void timelapse_reader_close(struct timelapse_reader* reader) {
+    munmap((void*)reader->map, reader->length);
+    close(reader->fd);
+}
+
+int timelapse_reader_next(struct timelapse_reader* reader, uint32_t* pixels, struct timelapse_frame_header* frame) {
+    if (reader->offset + sizeof(struct timelapse_frame_header) > reader->length)
+        return 0;
+
+    memcpy(frame, reader->map + reader->offset, sizeof(*frame));
+    size_t runs_offset = reader->offset + sizeof(struct timelapse_frame_header);
+    if (frame->size > reader->length - runs_offset)
+        return -EINVAL;
+    reader->offset = runs_offset + frame->size;
+
+    // Skipping a frame only needs its header
+    if (pixels == NULL)
+        return 1;
+
+    size_t nb_pixels = (size_t)reader->header->width * reader->header->height;
+    if (frame->kind == TIMELAPSE_KEYFRAME)
+        memset(pixels, 0, nb_pixels * sizeof(uint32_t));
+
+    const char* pos = reader->map + runs_offset;
+    const char* end = pos + frame->size;
+    size_t index = 0;
+    for (uint32_t i = 0; i < frame->runs; i++) {
+        struct timelapse_run run;
+        if (end - pos < (ptrdiff_t)sizeof(run))
+            return -EINVAL;
+        memcpy(&run, pos, sizeof(run));
+        pos += sizeof(run);
+
+        index += run.skip;
+        if (index + run.count > nb_pixels || (size_t)(end - pos) < run.count * sizeof(uint32_t))
+            return -EINVAL;
+
+        const uint32_t* words = (const uint32_t*)pos;
+        for (uint32_t j = 0; j < run.count; j++)
+            pixels[index + j] ^= words[j];
+        index += run.count;
+        pos += run.count * sizeof(uint32_t);
+    }
+
+    return 1;
+}
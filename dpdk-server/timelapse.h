@@ -0,0 +1,103 @@
+#ifndef _TIMELAPSE_H_
+#define _TIMELAPSE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "framebuffer.h"
+
+// A time-lapse is an append-only file of framebuffer snapshots. Every frame is stored as XOR against the previous one
+// (a keyframe against an all black frame), run-length encoded as runs of unchanged pixels to skip followed by the
+// changed ones. Replaying a file means XORing all frames onto a black framebuffer, starting at any keyframe.
+#define TIMELAPSE_MAGIC 0x4c544c50 // "PLTL" in little endian
+#define TIMELAPSE_VERSION 2
+
+struct timelapse_file_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    // Size of the recorded pixels, which is the region of the screen the server owns (see --region)
+    uint16_t width;
+    uint16_t height;
+    uint16_t screen_width;
+    uint16_t screen_height;
+    uint16_t region_x;
+    uint16_t region_y;
+    uint32_t reserved;
+    // Bytes of the file (including this header) holding complete frames. The file is grown in big steps, so it's
+    // usually longer. Written after the frame, so that a crash never leaves a half written frame behind.
+    uint64_t length;
+    uint64_t frames;
+};
+
+enum timelapse_frame_kind {
+    TIMELAPSE_KEYFRAME,
+    TIMELAPSE_DELTA,
+};
+
+// Followed by `size` bytes of runs
+struct timelapse_frame_header {
+    uint32_t kind;
+    uint32_t runs;
+    // CLOCK_REALTIME of the snapshot
+    uint64_t timestamp_ns;
+    uint64_t size;
+};
+
+// Followed by `count` XORed pixels, which start `skip` pixels after the end of the previous run
+struct timelapse_run {
+    uint32_t skip;
+    uint32_t count;
+};
+
+struct timelapse {
+    int fd;
+    char* map;
+    size_t mapped;
+    struct timelapse_file_header* header;
+
+    uint16_t width;
+    uint16_t height;
+    uint32_t keyframe_interval;
+    uint32_t frames_since_keyframe;
+
+    // The previous snapshot (which the next delta is based on) and the current one
+    uint32_t* prev;
+    uint32_t* snapshot;
+};
+
+// Opens the time-lapse of the framebuffer (and the region of the screen it holds) at path or creates it in case it
+// doesn't exist. New frames are appended to existing ones, starting with a keyframe. Every keyframe_interval frames a
+// keyframe is written, so that a replay doesn't need to start at the very first frame. Returns 0 or a positive errno,
+// same as create_fb().
+int timelapse_open(struct timelapse** timelapse, const char* path, struct framebuffer* fb,
+    uint32_t keyframe_interval);
+
+// Copies the framebuffer pixels into the private snapshot buffer. Where available the framebuffer is read using
+// non-temporal prefetches and the snapshot written using streaming stores, which limits how much of the cache the copy
+// takes away from the RX lcores. Call
+// timelapse_append() afterwards to encode the snapshot, which doesn't touch the framebuffer anymore.
+void timelapse_snapshot(struct timelapse* timelapse, struct framebuffer* fb);
+
+// Appends the last snapshot as frame, returns the number of bytes appended or a negative errno
+ssize_t timelapse_append(struct timelapse* timelapse, uint64_t timestamp_ns);
+
+struct timelapse_reader {
+    int fd;
+    const char* map;
+    size_t length;
+    const struct timelapse_file_header* header;
+    // Offset of the next frame
+    size_t offset;
+};
+
+// Maps the time-lapse at path read only. Returns 0 or a positive errno.
+int timelapse_reader_open(struct timelapse_reader* reader, const char* path);
+void timelapse_reader_close(struct timelapse_reader* reader);
+
+// Applies the next frame to pixels (width * height of the file) and fills in its header. Returns 1 in case a frame was
+// applied, 0 at the end of the file or -EINVAL in case the frame is corrupt.
+int timelapse_reader_next(struct timelapse_reader* reader, uint32_t* pixels, struct timelapse_frame_header* frame);
+
+#endif
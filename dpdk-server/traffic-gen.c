@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <argp.h>
+#include <arpa/inet.h>
+
+#include <rte_common.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_icmp.h>
+#include <rte_udp.h>
+
+#include "decoder.h"
+#include "framebuffer.h"
+
+// Generates the traffic for e2e-bench.sh as one pcap file per RX queue, which the server replays using the net_pcap
+// vdev (infinite_rx). Every pixel always gets the same color (see pixel_color()), so the framebuffer ends up the same
+// no matter in which order the queues are processed or how often the files are replayed. This allows checking the
+// framebuffer afterwards against the expected one, which is written next to the pcap files.
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_LINKTYPE_ETHERNET 1
+#define MAX_PACKET_SIZE 128
+// Size of the square of the hotspot pattern
+#define HOTSPOT_SIZE 64
+
+enum pattern {
+    PATTERN_UNIFORM,
+    PATTERN_RASTER,
+    PATTERN_HOTSPOT,
+    PATTERN_MIXED,
+    PATTERN_JUNK,
+    NUM_PATTERNS,
+};
+
+static const char* pattern_names[NUM_PATTERNS] = {
+    [PATTERN_UNIFORM] = "uniform",
+    [PATTERN_RASTER] = "raster",
+    [PATTERN_HOTSPOT] = "hotspot",
+    [PATTERN_MIXED] = "mixed",
+    [PATTERN_JUNK] = "junk",
+};
+
+static struct argp_option options[] = {
+    {"width",  'w', "pixels", 0,  "Width of the drawing surface in pixels (default 1920)" },
+    {"height", 'h', "pixels", 0,  "Height of the drawing surface in pixels (default 1080)"},
+    {"pattern", 'p', "pattern", 0, "Traffic pattern, one of uniform (random coordinates), raster (row by row sweep), hotspot (90% into a small square), mixed (pixelflut v6, pingxelflut v6 and v4 including size requests) or junk (out of bounds and unknown packets, which must not change anything) (default uniform)"},
+    {"packets", 'n', "count", 0, "Number of packets per queue. The server keeps them all in mbufs, so keep it well below its mbuf pool size (default 4096)"},
+    {"queues", 'q', "count", 0, "Number of RX queues, every queue gets its own pcap file (default 1)"},
+    {"output-dir", 'o', "path", 0, "Directory to write queue<n>.pcap and expected.bin to (default .)"},
+    {"verify", 'v', 0, 0, "Instead of generating the traffic, compare the shared memory against the expected.bin in --output-dir and write the result as JSON to verify.json next to it"},
+    {"shared-memory-name", 's', "name", 0, "Name of the shared memory to verify (default pixelflut)"},
+    {0}
+};
+
+struct arguments {
+    uint16_t width;
+    uint16_t height;
+    enum pattern pattern;
+    uint32_t packets;
+    uint16_t queues;
+    char* output_dir;
+    bool verify;
+    char* shared_memory_name;
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    // Get the input argument from argp_parse, which we know is a pointer to our arguments structure
+    struct arguments *arguments = state->input;
+
+    switch (key)
+    {
+        case 'w':
+            arguments->width = (uint16_t) strtol(arg, NULL, 10);
+            break;
+        case 'h':
+            arguments->height = (uint16_t) strtol(arg, NULL, 10);
+            break;
+        case 'p':
+            arguments->pattern = NUM_PATTERNS;
+            for (int pattern = 0; pattern < NUM_PATTERNS; pattern++) {
+                if (strcmp(arg, pattern_names[pattern]) == 0)
+                    arguments->pattern = pattern;
+            }
+            if (arguments->pattern == NUM_PATTERNS)
+                argp_error(state, "Unknown pattern '%s'", arg);
+            break;
+        case 'n':
+            arguments->packets = (uint32_t) strtol(arg, NULL, 10);
+            break;
+        case 'q':
+            arguments->queues = (uint16_t) strtol(arg, NULL, 10);
+            if (arguments->queues == 0)
+                argp_error(state, "There needs to be at least one queue");
+            break;
+        case 'o':
+            arguments->output_dir = arg;
+            break;
+        case 'v':
+            arguments->verify = true;
+            break;
+        case 's':
+            arguments->shared_memory_name = arg;
+            break;
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+const char *argp_program_version = "traffic-gen 0.1.0";
+static char doc[] = "Generates synthetic pixelflut traffic as pcap files for e2e-bench.sh and verifies the framebuffer afterwards";
+static char args_doc[] = "";
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+struct pcap_file_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_record_header {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+// Never black, so that we can tell set pixels from untouched ones
+static uint32_t pixel_color(uint16_t x, uint16_t y) {
+    uint32_t hash = ((uint32_t)x << 16 | y) * 0x9e3779b1;
+    return ((hash >> 8) & 0x00ffffff) | 0x80;
+}
+
+enum packet_kind {
+    PACKET_PIXELFLUT_V6,
+    PACKET_PINGXELFLUT_V6,
+    PACKET_PINGXELFLUT_V4,
+    PACKET_SIZE_REQUEST_V6,
+};
+
+// Same packets as the decoder-bench builds, see build_packet() there. Returns the packet size.
+static uint16_t build_packet(uint8_t* buf, enum packet_kind kind, uint16_t x, uint16_t y, uint32_t rgb) {
+    memset(buf, 0, MAX_PACKET_SIZE);
+    struct rte_ether_hdr* eth_hdr = (struct rte_ether_hdr*)buf;
+
+    if (kind == PACKET_PINGXELFLUT_V4) {
+        eth_hdr->ether_type = htons(RTE_ETHER_TYPE_IPV4);
+
+        struct rte_ipv4_hdr* ipv4_hdr = (struct rte_ipv4_hdr*)(eth_hdr + 1);
+        ipv4_hdr->version_ihl = 0x45;
+        ipv4_hdr->time_to_live = 0xff;
+        ipv4_hdr->next_proto_id = IPPROTO_ICMP;
+        ipv4_hdr->total_length = htons(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + 8);
+
+        struct rte_icmp_hdr* icmp_hdr = (struct rte_icmp_hdr*)(ipv4_hdr + 1);
+        icmp_hdr->icmp_type = RTE_IP_ICMP_ECHO_REQUEST;
+
+        uint8_t* payload = (uint8_t*)(icmp_hdr + 1);
+        payload[0] = MSG_SET_PIXEL;
+        *(uint16_t*)(payload + 1) = htons(x);
+        *(uint16_t*)(payload + 3) = htons(y);
+        memcpy(payload + 5, &rgb, 3);
+
+        // The decoder checks the exact payload length, so no padding here
+        return sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + 8;
+    }
+
+    eth_hdr->ether_type = htons(RTE_ETHER_TYPE_IPV6);
+    struct rte_ipv6_hdr* ipv6_hdr = (struct rte_ipv6_hdr*)(eth_hdr + 1);
+    ipv6_hdr->vtc_flow = htonl(6 << 28); // IP version 6
+    ipv6_hdr->hop_limits = 0xff;
+
+    if (kind == PACKET_PIXELFLUT_V6) {
+        ipv6_hdr->proto = 0x11; // UDP
+        ipv6_hdr->payload_len = htons(sizeof(struct rte_udp_hdr));
+        struct rte_udp_hdr* udp_hdr = (struct rte_udp_hdr*)(ipv6_hdr + 1);
+        udp_hdr->dgram_len = htons(sizeof(struct rte_udp_hdr));
+
+        ipv6_hdr->dst_addr[8] = x >> 8;
+        ipv6_hdr->dst_addr[9] = x;
+        ipv6_hdr->dst_addr[10] = y >> 8;
+        ipv6_hdr->dst_addr[11] = y;
+        ipv6_hdr->dst_addr[12] = rgb >> 0;
+        ipv6_hdr->dst_addr[13] = rgb >> 8;
+        ipv6_hdr->dst_addr[14] = rgb >> 16;
+
+        return RTE_MAX(RTE_ETHER_MIN_LEN,
+            sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_udp_hdr));
+    }
+
+    uint16_t payload_len = kind == PACKET_SIZE_REQUEST_V6 ? 1 : 8;
+    ipv6_hdr->proto = 58; // ICMPv6
+    ipv6_hdr->payload_len = htons(sizeof(struct rte_icmp_hdr) + payload_len);
+
+    struct rte_icmp_hdr* icmp_hdr = (struct rte_icmp_hdr*)(ipv6_hdr + 1);
+    icmp_hdr->icmp_type = 128; // ICMPv6 echo request, RTE_IP_ICMP_ECHO_REQUEST (8) is the ICMPv4 one
+
+    uint8_t* payload = (uint8_t*)(icmp_hdr + 1);
+    if (kind == PACKET_SIZE_REQUEST_V6) {
+        payload[0] = MSG_SIZE_REQUEST;
+    } else {
+        payload[0] = MSG_SET_PIXEL;
+        *(uint16_t*)(payload + 1) = htons(x);
+        *(uint16_t*)(payload + 3) = htons(y);
+        memcpy(payload + 5, &rgb, 3);
+    }
+
+    return sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_icmp_hdr) + payload_len;
+}
+
+// Packets the server must not draw anything for. Returns the packet size.
+static uint16_t build_junk_packet(uint8_t* buf, struct arguments* arguments, unsigned int* seed) {
+    uint16_t x = rand_r(seed) % arguments->width;
+    uint16_t y = rand_r(seed) % arguments->height;
+    uint16_t size;
+
+    switch (rand_r(seed) % 6) {
+        case 0:
+            // Right of the screen
+            return build_packet(buf, PACKET_PIXELFLUT_V6, arguments->width + x % (UINT16_MAX - arguments->width), y,
+                rand_r(seed));
+        case 1:
+            // Below the screen
+            return build_packet(buf, PACKET_PIXELFLUT_V6, x, arguments->height + y % (UINT16_MAX - arguments->height),
+                rand_r(seed));
+        case 2:
+            return build_packet(buf, PACKET_PINGXELFLUT_V4, arguments->width + x % (UINT16_MAX - arguments->width), y,
+                rand_r(seed));
+        case 3:
+            // pingxelflut with a payload that is neither RGB nor RGBA
+            size = build_packet(buf, PACKET_PINGXELFLUT_V6, x, y, rand_r(seed));
+            return size - 1;
+        case 4:
+            // ARP
+            memset(buf, 0, MAX_PACKET_SIZE);
+            ((struct rte_ether_hdr*)buf)->ether_type = htons(RTE_ETHER_TYPE_ARP);
+            return RTE_ETHER_MIN_LEN;
+        default:
+            // Ping with a payload that is no pingxelflut message
+            size = build_packet(buf, PACKET_PINGXELFLUT_V4, x, y, rand_r(seed));
+            buf[sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr)] = 0x42;
+            return size;
+    }
+}
+
+static void write_all(FILE* file, const void* data, size_t size, const char* path) {
+    if (fwrite(data, 1, size, file) != size) {
+        printf("Failed to write %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void generate(struct arguments* arguments) {
+    size_t nb_pixels = (size_t)arguments->width * arguments->height;
+    uint32_t* expected = calloc(nb_pixels, sizeof(uint32_t));
+    if (!expected) {
+        printf("Failed to allocate the expected framebuffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The raster sweep continues across the queues, so that they don't all draw the same rows
+    size_t raster_pos = 0;
+    uint16_t hotspot_x = arguments->width / 2 - RTE_MIN(arguments->width / 2, HOTSPOT_SIZE / 2);
+    uint16_t hotspot_y = arguments->height / 2 - RTE_MIN(arguments->height / 2, HOTSPOT_SIZE / 2);
+
+    for (uint16_t queue = 0; queue < arguments->queues; queue++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/queue%u.pcap", arguments->output_dir, queue);
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+            printf("Failed to open %s: %s\n", path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        struct pcap_file_header file_header = {
+            .magic = PCAP_MAGIC,
+            .version_major = 2,
+            .version_minor = 4,
+            .snaplen = MAX_PACKET_SIZE,
+            .linktype = PCAP_LINKTYPE_ETHERNET,
+        };
+        write_all(file, &file_header, sizeof(file_header), path);
+
+        unsigned int seed = queue + 1;
+        for (uint32_t i = 0; i < arguments->packets; i++) {
+            uint8_t buf[MAX_PACKET_SIZE];
+            uint16_t x = rand_r(&seed) % arguments->width;
+            uint16_t y = rand_r(&seed) % arguments->height;
+            enum packet_kind kind = PACKET_PIXELFLUT_V6;
+            uint16_t size;
+
+            switch (arguments->pattern) {
+                case PATTERN_RASTER:
+                    x = raster_pos % arguments->width;
+                    y = raster_pos / arguments->width % arguments->height;
+                    raster_pos++;
+                    break;
+                case PATTERN_HOTSPOT:
+                    if (rand_r(&seed) % 10 != 0) {
+                        x = hotspot_x + x % RTE_MIN(arguments->width, HOTSPOT_SIZE);
+                        y = hotspot_y + y % RTE_MIN(arguments->height, HOTSPOT_SIZE);
+                    }
+                    break;
+                case PATTERN_MIXED:
+                    kind = i % 16 == 15 ? PACKET_SIZE_REQUEST_V6 : i % 3;
+                    break;
+                default:
+                    break;
+            }
+
+            if (arguments->pattern == PATTERN_JUNK) {
+                size = build_junk_packet(buf, arguments, &seed);
+            } else {
+                size = build_packet(buf, kind, x, y, pixel_color(x, y));
+                if (kind != PACKET_SIZE_REQUEST_V6)
+                    expected[x + (size_t)y * arguments->width] = pixel_color(x, y);
+            }
+
+            struct pcap_record_header record_header = {
+                .ts_sec = i / 1000000,
+                .ts_usec = i % 1000000,
+                .incl_len = size,
+                .orig_len = size,
+            };
+            write_all(file, &record_header, sizeof(record_header), path);
+            write_all(file, buf, size, path);
+        }
+
+        if (fclose(file) != 0) {
+            printf("Failed to write %s: %s\n", path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/expected.bin", arguments->output_dir);
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("Failed to open %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    write_all(file, expected, nb_pixels * sizeof(uint32_t), path);
+    fclose(file);
+
+    size_t set_pixels = 0;
+    for (size_t i = 0; i < nb_pixels; i++)
+        set_pixels += expected[i] != 0;
+    printf("Generated %u %s packets for each of the %u queues, which set %zu distinct pixels\n", arguments->packets,
+        pattern_names[arguments->pattern], arguments->queues, set_pixels);
+    free(expected);
+}
+
+static int verify(struct arguments* arguments) {
+    size_t nb_pixels = (size_t)arguments->width * arguments->height;
+    uint32_t* expected = malloc(nb_pixels * sizeof(uint32_t));
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/expected.bin", arguments->output_dir);
+    FILE* file = fopen(path, "rb");
+    if (!expected || !file || fread(expected, sizeof(uint32_t), nb_pixels, file) != nb_pixels) {
+        printf("Failed to read %s with %zu pixels\n", path, nb_pixels);
+        return EXIT_FAILURE;
+    }
+    fclose(file);
+
+    struct framebuffer* fb;
+    if (create_fb(&fb, arguments->width, arguments->height, NULL, arguments->shared_memory_name, NULL, false) != 0)
+        return EXIT_FAILURE;
+
+    // Missing pixels should have been set, wrong ones have a different color and unexpected ones should not have been
+    // touched at all
+    uint64_t expected_pixels = 0, missing = 0, wrong = 0, unexpected = 0;
+    for (size_t i = 0; i < nb_pixels; i++) {
+        // The unused fourth byte doesn't matter
+        uint32_t pixel = fb->pixels[i] & 0x00ffffff;
+        expected_pixels += expected[i] != 0;
+        if (pixel == expected[i])
+            continue;
+        if (expected[i] == 0)
+            unexpected++;
+        else if (pixel == 0)
+            missing++;
+        else
+            wrong++;
+    }
+
+    bool ok = missing == 0 && wrong == 0 && unexpected == 0;
+    printf("Framebuffer %s: %lu of %lu pixels missing, %lu wrong, %lu unexpected\n", ok ? "correct" : "WRONG", missing,
+        expected_pixels, wrong, unexpected);
+
+    snprintf(path, sizeof(path), "%s/verify.json", arguments->output_dir);
+    file = fopen(path, "w");
+    if (!file) {
+        printf("Failed to open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fprintf(file, "{\"ok\": %s, \"expected_pixels\": %lu, \"missing\": %lu, \"wrong\": %lu, \"unexpected\": %lu}\n",
+        ok ? "true" : "false", expected_pixels, missing, wrong, unexpected);
+    fclose(file);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    struct arguments arguments = {0};
+    arguments.width = 1920;
+    arguments.height = 1080;
+    arguments.pattern = PATTERN_UNIFORM;
+    arguments.packets = 4096;
+    arguments.queues = 1;
+    arguments.output_dir = ".";
+    arguments.shared_memory_name = "/pixelflut";
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.verify)
+        return verify(&arguments);
+
+    generate(&arguments);
+    return EXIT_SUCCESS;
+}
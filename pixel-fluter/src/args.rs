@@ -2,18 +2,38 @@ use clap::{Parser, ValueEnum};
 
 #[derive(Debug, Parser)]
 pub struct Args {
-    #[clap(short = 's', long)]
-    pub pixelflut_sink: String,
+    #[clap(short = 's', long, required_unless_present = "benchmark")]
+    pub pixelflut_sink: Option<String>,
 
     #[clap(short = 'f', long, default_value = "30")]
     pub fps: u16,
 
+    /// Every n-th frame the whole shard is sent, regardless of which pixels changed. All other frames only send the
+    /// pixels the server marked as dirty. 1 sends every frame completely.
+    #[clap(long, default_value = "30")]
+    pub full_refresh_frames: u32,
+
+    /// Split the shard into this many bands of rows. Every band is drawn by its own task over its own connection to the
+    /// sink, so the bands are sent in parallel by the threads of the runtime. All bands draw the same frame.
+    #[clap(long, visible_alias = "connections", default_value = "1")]
+    pub drawing_threads: u16,
+
     #[clap(long, default_value = "pixelflut")]
     pub shared_memory_name: String,
 
+    /// In case the server was started with `--hugepage-dir`, the shared memory is not located in /dev/shm, but is a
+    /// file within the given hugetlbfs mount (e.g. /dev/hugepages).
+    #[clap(long)]
+    pub hugepage_dir: Option<String>,
+
     #[clap(long, default_value = "binary-sync")]
     pub transmit_mode: TransmitMode,
 
+    /// Send the PXMULTI commands using MSG_ZEROCOPY, so the kernel sends the pixels straight from the shared memory.
+    /// Only pays off for large frames and a NIC that supports scatter-gather, on loopback the kernel copies anyway.
+    #[clap(long)]
+    pub zerocopy: bool,
+
     /// Shard the x coordinates into the given number of slices.
     #[clap(long, default_value = "1")]
     pub x_shards: u16,
@@ -21,12 +41,18 @@ pub struct Args {
     /// Only draw the specified shard.
     #[clap(long, default_value = "1")]
     pub x_shard: u16,
+
+    /// Don't flut anything, but measure how many bytes/s of `PX` and `PB` commands a single core generates and exit.
+    #[clap(long)]
+    pub benchmark: bool,
 }
 
 #[derive(Clone, Debug, ValueEnum)]
 pub enum TransmitMode {
-    // Not implemented yet
-    // ASCII,
-    // BinaryPixel,
+    /// `PX x y rrggbb\n` text commands, supported by every Pixelflut server
+    Ascii,
+    /// Binary `PB` commands of 10 bytes per pixel, e.g. supported by breakwater
+    BinaryPixel,
+    /// Whole runs of pixels using the `PXMULTI` command of breakwater
     BinarySync,
 }
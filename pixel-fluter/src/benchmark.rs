@@ -0,0 +1,55 @@
+use std::{
+    hint::black_box,
+    time::{Duration, Instant},
+};
+
+use tracing::info;
+
+use crate::{args::TransmitMode, formatting::LineFormatter};
+
+const WIDTH: u16 = 3840;
+const HEIGHT: u16 = 2160;
+const DURATION_PER_MODE: Duration = Duration::from_secs(3);
+
+/// Measures how many bytes/s of commands a single core generates for the text and binary pixel transmit modes, by
+/// rendering a 4K frame of random colors over and over again (without sending it anywhere).
+pub fn run() {
+    // xorshift, so that the hex digits can not be predicted
+    let mut state = 0x2545_f491_4f6c_dd1d_u64;
+    let fb: Vec<u32> = (0..WIDTH as usize * HEIGHT as usize)
+        .map(|_| {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            (state >> 32) as u32 & 0x00ff_ffff
+        })
+        .collect();
+    let mut formatter = LineFormatter::new(WIDTH);
+
+    for mode in [TransmitMode::Ascii, TransmitMode::BinaryPixel] {
+        let start = Instant::now();
+        let (mut frames, mut bytes) = (0u64, 0u64);
+        while start.elapsed() < DURATION_PER_MODE {
+            for (y, line) in (0..).zip(fb.chunks_exact(WIDTH as usize)) {
+                let commands = match mode {
+                    TransmitMode::Ascii => formatter.ascii(0, y, line),
+                    TransmitMode::BinaryPixel => formatter.binary_pixels(0, y, line),
+                    TransmitMode::BinarySync => unreachable!("PXMULTI sends the framebuffer as-is"),
+                };
+                bytes += black_box(commands).len() as u64;
+            }
+            frames += 1;
+        }
+
+        let elapsed = start.elapsed().as_secs_f64();
+        info!(
+            ?mode,
+            frames,
+            bytes_per_pixel = bytes as f64 / (frames as f64 * WIDTH as f64 * HEIGHT as f64),
+            "Generated {:.2} GB/s ({:.0} Mpixel/s, {:.1} frames/s at {WIDTH}x{HEIGHT}) on a single core",
+            bytes as f64 / elapsed / 1e9,
+            frames as f64 * WIDTH as f64 * HEIGHT as f64 / elapsed / 1e6,
+            frames as f64 / elapsed,
+        );
+    }
+}
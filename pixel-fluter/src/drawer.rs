@@ -1,32 +1,120 @@
-use std::time::Duration;
+use std::{
+    io::IoSlice,
+    ops::Range,
+    sync::{
+        Arc,
+        atomic::{AtomicU64, Ordering},
+    },
+    time::Duration,
+};
 
 use anyhow::{Context, ensure};
-use tokio::{io::AsyncWriteExt, net::TcpStream, time::interval};
+use tokio::{io::AsyncWriteExt, net::TcpStream, sync::watch, time::interval};
+use tracing::{info, warn};
 
-use crate::args::{Args, TransmitMode};
+use crate::{
+    DIRTY_SPAN_PIXELS,
+    args::{Args, TransmitMode},
+    formatting::LineFormatter,
+    layout::FbHeader,
+    zerocopy::ZeroCopySender,
+};
 
+/// "PXMULTI", x (u16le), y (u16le) and the number of pixels (u32le)
+const PXMULTI_HEADER_LEN: usize = 15;
+
+/// Linux does not take more iovecs in a single writev or sendmsg call (IOV_MAX)
+const MAX_IOVECS: usize = 1024;
+
+/// A PXMULTI command of the current frame, its pixels are sent straight from the framebuffer.
+struct PxMultiRun {
+    header: [u8; PXMULTI_HEADER_LEN],
+    /// Byte range of the pixels within the framebuffer
+    pixels: Range<usize>,
+}
+
+/// Counters of a single connection to the sink, shared with the TUI and the Prometheus exporter.
+#[derive(Debug, Default)]
+pub struct ConnectionStats {
+    /// The rows of the band drawn over this connection.
+    pub rows: Range<u16>,
+    sent_bytes: AtomicU64,
+    drawn_frames: AtomicU64,
+    /// Frame ticks that passed while the previous frame was still being sent.
+    missed_frames: AtomicU64,
+}
+
+#[derive(Clone, Copy, Debug, Default)]
+pub struct ConnectionCounters {
+    pub sent_bytes: u64,
+    pub drawn_frames: u64,
+    pub missed_frames: u64,
+}
+
+impl ConnectionStats {
+    pub fn load(&self) -> ConnectionCounters {
+        ConnectionCounters {
+            sent_bytes: self.sent_bytes.load(Ordering::Relaxed),
+            drawn_frames: self.drawn_frames.load(Ordering::Relaxed),
+            missed_frames: self.missed_frames.load(Ordering::Relaxed),
+        }
+    }
+}
+
+impl ConnectionCounters {
+    pub fn saturating_sub(&self, other: &Self) -> Self {
+        Self {
+            sent_bytes: self.sent_bytes.saturating_sub(other.sent_bytes),
+            drawn_frames: self.drawn_frames.saturating_sub(other.drawn_frames),
+            missed_frames: self.missed_frames.saturating_sub(other.missed_frames),
+        }
+    }
+}
+
+/// Draws one band of rows of the shard over its own connection to the sink.
 pub struct Drawer<'a> {
-    fb_slice: &'a mut [u32],
+    fb_slice: &'a [u32],
+    /// One bit per [`DIRTY_SPAN_PIXELS`] pixels, set by the server when it writes a pixel and cleared by us once the
+    /// pixels are sent.
+    dirty: &'a [AtomicU64],
+    /// Scratch buffer holding the dirty bits of the current line, so we don't allocate for every line.
+    dirty_line: Vec<u64>,
     sink: TcpStream,
 
     width: u16,
-    height: u16,
+    /// The columns of our shard
+    start_x: u16,
+    end_x: u16,
+    /// Position of the framebuffer (the region of the screen the server owns) on the screen, added to the coordinates
+    /// of all commands.
+    region_x: u16,
+    region_y: u16,
 
-    fps: u16,
-    // threads: u16,
     transmit_mode: TransmitMode,
-    x_shard: u16,
-    x_shard_width: u16,
+    /// Renders the `PX` and `PB` commands of a line
+    formatter: LineFormatter,
+    /// The PXMULTI commands of the current frame, reused for every frame.
+    runs: Vec<PxMultiRun>,
+    zerocopy: Option<ZeroCopySender>,
+
+    full_refresh_frames: u32,
+    /// Receives the number of the frame to draw, see [`tick_frames`].
+    frame_tick: watch::Receiver<u32>,
+    stats: Arc<ConnectionStats>,
 }
 
 impl<'a> Drawer<'a> {
-    pub fn new(
-        fb_slice: &'a mut [u32],
-        sink: TcpStream,
-        width: u16,
-        height: u16,
+    /// Splits the shard into `--drawing-threads` bands of consecutive rows and connects a drawer for every band.
+    ///
+    /// The shards and bands are taken from the framebuffer, which only holds the region of the screen the server owns.
+    pub async fn connect_bands(
+        fb_slice: &'a [u32],
+        dirty: &'a [AtomicU64],
+        header: &FbHeader,
         args: &Args,
-    ) -> anyhow::Result<Self> {
+        frame_tick: watch::Receiver<u32>,
+    ) -> anyhow::Result<Vec<Self>> {
+        let (width, height) = (header.width, header.height);
         let (x_shard, x_shards) = (args.x_shard, args.x_shards);
         ensure!(
             x_shard <= x_shards,
@@ -36,83 +124,286 @@ impl<'a> Drawer<'a> {
             width % x_shards == 0,
             "The width {width} must be divisible by the number of X shards {x_shards}"
         );
+        ensure!(
+            !args.zerocopy || matches!(args.transmit_mode, TransmitMode::BinarySync),
+            "--zerocopy is only supported by the binary-sync transmit mode"
+        );
+        let bands = args.drawing_threads;
+        ensure!(
+            bands >= 1 && bands <= height,
+            "The number of drawing threads {bands} must be between 1 and the height {height}"
+        );
+
+        let x_shard_width = width / args.x_shards;
+        if width as usize % DIRTY_SPAN_PIXELS != 0
+            || x_shard_width as usize % DIRTY_SPAN_PIXELS != 0
+        {
+            warn!(
+                width,
+                x_shard_width,
+                "The width and the shard width should be a multiple of {DIRTY_SPAN_PIXELS}, otherwise dirty spans \
+                span multiple lines or shards and unchanged pixels are sent"
+            );
+        }
+        // shards start at 1, pixels start at 0.
+        let start_x = x_shard_width * (x_shard - 1);
+        let pixelflut_sink = args
+            .pixelflut_sink
+            .as_deref()
+            .context("No Pixelflut sink given")?;
+
+        let mut drawers = Vec::with_capacity(bands as usize);
+        for band in 0..bands as u32 {
+            let rows = (band * height as u32 / bands as u32) as u16
+                ..((band + 1) * height as u32 / bands as u32) as u16;
+            let sink = TcpStream::connect(pixelflut_sink).await.with_context(|| {
+                format!("Failed to connect to Pixelflut sink at {pixelflut_sink} for band {band}")
+            })?;
+            info!(band, ?rows, "Connected drawer to Pixelflut sink");
+            let zerocopy = if args.zerocopy {
+                Some(ZeroCopySender::enable(&sink)?)
+            } else {
+                None
+            };
 
-        Ok(Self {
-            fb_slice,
-            sink,
-            width,
-            height,
-            fps: args.fps,
-            // threads: args.drawing_threads,
-            transmit_mode: args.transmit_mode.clone(),
-            x_shard: args.x_shard,
-            x_shard_width: width / args.x_shards,
-        })
+            drawers.push(Self {
+                fb_slice,
+                dirty,
+                dirty_line: Vec::new(),
+                sink,
+                width,
+                start_x,
+                end_x: start_x + x_shard_width,
+                region_x: header.region_x,
+                region_y: header.region_y,
+                transmit_mode: args.transmit_mode.clone(),
+                formatter: LineFormatter::new(header.screen_width),
+                runs: Vec::new(),
+                zerocopy,
+                full_refresh_frames: args.full_refresh_frames,
+                frame_tick: frame_tick.clone(),
+                stats: Arc::new(ConnectionStats {
+                    rows,
+                    ..Default::default()
+                }),
+            });
+        }
+
+        Ok(drawers)
+    }
+
+    pub fn stats(&self) -> Arc<ConnectionStats> {
+        self.stats.clone()
     }
 
     pub async fn run(&mut self) -> anyhow::Result<()> {
-        let mut interval = interval(Duration::from_micros(1_000_000 / self.fps as u64));
+        let mut last_frame: Option<u32> = None;
 
         loop {
-            interval.tick().await;
-            self.draw().await?;
+            self.frame_tick
+                .changed()
+                .await
+                .context("The frame ticker stopped")?;
+            let frame = *self.frame_tick.borrow_and_update();
+
+            // In case we were too slow, we skip the ticks that passed in the meantime. Make sure we don't skip the
+            // full refresh this way, the other bands would do it without us.
+            let full_refresh = self.full_refresh_frames > 0
+                && last_frame.is_none_or(|last| {
+                    frame / self.full_refresh_frames != last / self.full_refresh_frames
+                });
+            if let Some(last) = last_frame {
+                self.stats.missed_frames.fetch_add(
+                    frame.wrapping_sub(last).saturating_sub(1) as u64,
+                    Ordering::Relaxed,
+                );
+            }
+            last_frame = Some(frame);
+
+            self.draw(full_refresh).await?;
+            self.stats.drawn_frames.fetch_add(1, Ordering::Relaxed);
         }
     }
 
-    /// Draws line by line
-    async fn draw(&mut self) -> anyhow::Result<()> {
-        // shards start at 1, pixels start at 0.
-        let start_x = self.x_shard_width * (self.x_shard - 1);
-        let end_x = start_x + self.x_shard_width;
+    /// Draws line by line, only sending the parts of the lines the server marked as dirty.
+    ///
+    /// The server checks the bit before setting it, so it can miss setting a bit we are clearing in the same moment.
+    /// That's why every `full_refresh_frames` frame we send the whole band anyway.
+    async fn draw(&mut self, full_refresh: bool) -> anyhow::Result<()> {
+        let (start_x, end_x) = (self.start_x, self.end_x);
+
+        // The kernel might still be sending the headers of the last frame
+        if let Some(zerocopy) = &mut self.zerocopy {
+            zerocopy.wait_for_completions(&self.sink).await?;
+        }
+        self.runs.clear();
 
-        for y in 0..self.height {
-            self.draw_line(y, start_x, end_x).await?;
+        for y in self.stats.rows.clone() {
+            let line_start = y as usize * self.width as usize;
+            let first_span = (line_start + start_x as usize) / DIRTY_SPAN_PIXELS;
+            let last_span = (line_start + end_x as usize - 1) / DIRTY_SPAN_PIXELS;
+            self.take_dirty_spans(first_span, last_span);
+
+            if full_refresh {
+                self.draw_line(y, start_x, end_x).await?;
+                continue;
+            }
+
+            // Send every run of consecutive dirty spans as a single PXMULTI
+            let mut span = first_span;
+            while span <= last_span {
+                if !self.is_dirty(span - first_span) {
+                    span += 1;
+                    continue;
+                }
+                let run_start = span;
+                while span <= last_span && self.is_dirty(span - first_span) {
+                    span += 1;
+                }
+
+                let sx = (run_start * DIRTY_SPAN_PIXELS).saturating_sub(line_start);
+                let ex = (span * DIRTY_SPAN_PIXELS - line_start).min(end_x as usize);
+                self.draw_line(y, (sx as u16).max(start_x), ex as u16)
+                    .await?;
+            }
         }
 
+        if !self.runs.is_empty() {
+            self.send_runs().await?;
+        }
         self.sink.flush().await.context("Failed to flush sink")?;
 
         Ok(())
     }
 
+    /// Sends all PXMULTI commands of the frame using as few syscalls as possible. The iovecs alternate between the
+    /// headers and the pixels, which are taken straight from the shared memory, so we never copy them.
+    async fn send_runs(&mut self) -> anyhow::Result<()> {
+        let fb = u32_to_u8(self.fb_slice);
+        let mut iovecs = [IoSlice::new(&[]); MAX_IOVECS];
+        let mut sent = 0;
+
+        for batch in self.runs.chunks(MAX_IOVECS / 2) {
+            for (run, iovecs) in batch.iter().zip(iovecs.chunks_exact_mut(2)) {
+                iovecs[0] = IoSlice::new(&run.header);
+                iovecs[1] = IoSlice::new(&fb[run.pixels.clone()]);
+            }
+
+            let mut remaining = &mut iovecs[..2 * batch.len()];
+            while !remaining.is_empty() {
+                let written = match &mut self.zerocopy {
+                    Some(zerocopy) => zerocopy.send(&self.sink, remaining).await?,
+                    None => self
+                        .sink
+                        .write_vectored(remaining)
+                        .await
+                        .context("Failed to write to Pixelflut sink")?,
+                };
+                ensure!(written > 0, "The Pixelflut sink closed the connection");
+                sent += written;
+                IoSlice::advance_slices(&mut remaining, written);
+            }
+        }
+        self.stats
+            .sent_bytes
+            .fetch_add(sent as u64, Ordering::Relaxed);
+
+        Ok(())
+    }
+
+    /// Clears the dirty bits of the spans `first_span..=last_span` and stores them in `dirty_line`, with bit 0 of
+    /// the first word being `first_span`.
+    fn take_dirty_spans(&mut self, first_span: usize, last_span: usize) {
+        let spans = last_span - first_span + 1;
+        self.dirty_line.clear();
+        self.dirty_line.resize(spans.div_ceil(64), 0);
+
+        for word in first_span / 64..=last_span / 64 {
+            // Only clear the bits of our shard, other shards might be drawn by other processes
+            let lo = first_span.max(word * 64);
+            let hi = last_span.min(word * 64 + 63);
+            let bits = hi - lo + 1;
+            let mask = if bits == 64 {
+                u64::MAX
+            } else {
+                ((1u64 << bits) - 1) << (lo % 64)
+            };
+
+            let taken = (self.dirty[word].fetch_and(!mask, Ordering::AcqRel) & mask) >> (lo % 64);
+            let offset = lo - first_span;
+            self.dirty_line[offset / 64] |= taken << (offset % 64);
+            if offset % 64 != 0 && offset / 64 + 1 < self.dirty_line.len() {
+                self.dirty_line[offset / 64 + 1] |= taken >> (64 - offset % 64);
+            }
+        }
+    }
+
+    fn is_dirty(&self, span: usize) -> bool {
+        self.dirty_line[span / 64] & (1 << (span % 64)) != 0
+    }
+
     async fn draw_line(&mut self, y: u16, start_x: u16, end_x: u16) -> anyhow::Result<()> {
-        match self.transmit_mode {
-            TransmitMode::BinarySync => {
-                let to_draw = &self.fb_slice[y as usize * self.width as usize + start_x as usize
-                    ..y as usize * self.width as usize + end_x as usize];
-                assert_eq!(to_draw.len(), end_x as usize - start_x as usize);
+        let fb_slice = self.fb_slice;
+        let to_draw = &fb_slice[y as usize * self.width as usize + start_x as usize
+            ..y as usize * self.width as usize + end_x as usize];
+        assert_eq!(to_draw.len(), end_x as usize - start_x as usize);
+        let (screen_x, screen_y) = (self.region_x + start_x, self.region_y + y);
 
+        let sent = match self.transmit_mode {
+            TransmitMode::Ascii | TransmitMode::BinaryPixel => {
+                let commands = if let TransmitMode::Ascii = self.transmit_mode {
+                    self.formatter.ascii(screen_x, screen_y, to_draw)
+                } else {
+                    self.formatter.binary_pixels(screen_x, screen_y, to_draw)
+                };
                 self.sink
-                    .write_all("PXMULTI".as_bytes())
-                    .await
-                    .context("Failed to write to Pixelflut sink")?;
-                self.sink
-                    .write_u16_le(start_x)
-                    .await
-                    .context("Failed to write to Pixelflut sink")?;
-                self.sink
-                    .write_u16_le(y)
-                    .await
-                    .context("Failed to write to Pixelflut sink")?;
-                self.sink
-                    .write_u32_le(
-                        to_draw
-                            .len()
-                            .try_into()
-                            .context("Pixels to draw did not fit in u32")?,
-                    )
-                    .await
-                    .context("Failed to write to Pixelflut sink")?;
-                self.sink
-                    .write_all(u32_to_u8(to_draw))
+                    .write_all(commands)
                     .await
                     .context("Failed to write to Pixelflut sink")?;
+
+                commands.len()
             }
-        }
+            TransmitMode::BinarySync => {
+                // Sent together with all other runs of the frame by send_runs()
+                let mut header = [0; PXMULTI_HEADER_LEN];
+                header[..7].copy_from_slice(b"PXMULTI");
+                header[7..9].copy_from_slice(&screen_x.to_le_bytes());
+                header[9..11].copy_from_slice(&screen_y.to_le_bytes());
+                let len: u32 = to_draw
+                    .len()
+                    .try_into()
+                    .context("Pixels to draw did not fit in u32")?;
+                header[11..].copy_from_slice(&len.to_le_bytes());
+
+                let first_pixel = y as usize * self.width as usize + start_x as usize;
+                self.runs.push(PxMultiRun {
+                    header,
+                    pixels: 4 * first_pixel..4 * (first_pixel + to_draw.len()),
+                });
+                return Ok(());
+            }
+        };
+        self.stats
+            .sent_bytes
+            .fetch_add(sent as u64, Ordering::Relaxed);
 
         Ok(())
     }
 }
 
+/// Drives all drawers with a single clock, so that every band draws the same frame and the full refreshes of all bands
+/// happen in the same frame.
+pub async fn tick_frames(frame_tick: watch::Sender<u32>, fps: u16) {
+    let mut interval = interval(Duration::from_micros(1_000_000 / fps as u64));
+    let mut frame: u32 = 0;
+
+    loop {
+        interval.tick().await;
+        frame_tick.send_replace(frame);
+        frame = frame.wrapping_add(1);
+    }
+}
+
 // Thanks to https://users.rust-lang.org/t/transmute-u32-to-u8/63937/2
 fn u32_to_u8(arr: &[u32]) -> &[u8] {
     let len = 4 * arr.len();
@@ -0,0 +1,109 @@
+use std::io::Write;
+
+/// Longest `PX x y rrggbb\n` command: "PX " + 5 digits + " " + 5 digits + " " + 6 hex digits + "\n".
+const MAX_PX_COMMAND_LEN: usize = 22;
+
+/// `PB`, x (u16le), y (u16le) and r, g, b, a.
+const PB_COMMAND_LEN: usize = 10;
+
+/// Commands are written using fixed-width stores of up to this many bytes (of which only the actual length is kept),
+/// so the buffer needs some slack after the last command.
+const STORE_SLACK: usize = 16;
+
+/// Renders lines of pixels into `PX` or `PB` commands.
+///
+/// All commands of a line are rendered into a buffer that is allocated once and reused for every line, nothing is
+/// allocated per pixel. The variable length decimal coordinates are pre-rendered once: every `PX x ` prefix is stored in
+/// a 16 byte slot and copied with a single store, of which we only keep the actual length. The hex color is computed
+/// for all six digits at once in a u64 (SWAR), so formatting a pixel takes three stores and no branches.
+pub struct LineFormatter {
+    /// `PX {x} ` of every column, padded to 16 bytes, and its length.
+    px_prefixes: Vec<([u8; 16], u8)>,
+    buffer: Vec<u8>,
+}
+
+impl LineFormatter {
+    pub fn new(width: u16) -> Self {
+        let px_prefixes = (0..width)
+            .map(|x| {
+                let prefix = format!("PX {x} ");
+                let mut slot = [0; 16];
+                slot[..prefix.len()].copy_from_slice(prefix.as_bytes());
+                (slot, prefix.len() as u8)
+            })
+            .collect();
+
+        Self {
+            px_prefixes,
+            buffer: Vec::new(),
+        }
+    }
+
+    /// Renders a `PX x y rrggbb\n` command for every pixel of line `y`, starting at column `start_x`.
+    pub fn ascii(&mut self, start_x: u16, y: u16, pixels: &[u32]) -> &[u8] {
+        let buffer = Self::reserve(&mut self.buffer, pixels.len() * MAX_PX_COMMAND_LEN);
+
+        // The y coordinate is the same for the whole line
+        let mut y_str = [0; 8];
+        let mut unused = &mut y_str[..];
+        write!(unused, "{y} ").expect("a u16 and a space fit into 8 bytes");
+        let y_len = 8 - unused.len();
+
+        let prefixes = &self.px_prefixes[start_x as usize..start_x as usize + pixels.len()];
+        let mut pos = 0;
+        for (&rgba, (prefix, prefix_len)) in pixels.iter().zip(prefixes) {
+            buffer[pos..pos + 16].copy_from_slice(prefix);
+            pos += *prefix_len as usize;
+            buffer[pos..pos + 8].copy_from_slice(&y_str);
+            pos += y_len;
+            // Six hex digits followed by the newline
+            buffer[pos..pos + 8]
+                .copy_from_slice(&(hex_rgb(rgba) | (b'\n' as u64) << 48).to_le_bytes());
+            pos += 7;
+        }
+
+        &buffer[..pos]
+    }
+
+    /// Renders a binary `PB` command for every pixel of line `y`, starting at column `start_x`.
+    pub fn binary_pixels(&mut self, start_x: u16, y: u16, pixels: &[u32]) -> &[u8] {
+        let buffer = Self::reserve(&mut self.buffer, pixels.len() * PB_COMMAND_LEN);
+
+        // "PB", x, y and r, g as one u64, followed by b and a
+        let head = u16::from_le_bytes(*b"PB") as u64 | (y as u64) << 32;
+        let mut pos = 0;
+        for (x, &rgba) in (start_x..).zip(pixels) {
+            let head = head | (x as u64) << 16 | ((rgba & 0xffff) as u64) << 48;
+            buffer[pos..pos + 8].copy_from_slice(&head.to_le_bytes());
+            // The server does not store the alpha channel, so all pixels are opaque
+            let tail = (rgba >> 16) as u16 | 0xff00;
+            buffer[pos + 8..pos + 10].copy_from_slice(&tail.to_le_bytes());
+            pos += PB_COMMAND_LEN;
+        }
+
+        &buffer[..pos]
+    }
+
+    /// Makes sure the buffer can take `len` bytes plus the slack of the fixed-width stores. The buffer only grows, its
+    /// contents are overwritten anyway.
+    fn reserve(buffer: &mut Vec<u8>, len: usize) -> &mut [u8] {
+        if buffer.len() < len + STORE_SLACK {
+            buffer.resize(len + STORE_SLACK, 0);
+        }
+        buffer
+    }
+}
+
+/// Returns the lowercase hex digits of the red, green and blue channel (the lowest three bytes of `rgba`) as the first
+/// six bytes of the little endian u64.
+#[inline(always)]
+fn hex_rgb(rgba: u32) -> u64 {
+    let rgb = rgba as u64;
+    // Move every channel into its own 16 bit lane, ...
+    let spread = (rgb & 0xff) | (rgb & 0xff00) << 8 | (rgb & 0xff_0000) << 16;
+    // ... the high nibble goes into the first byte of the lane, the low one into the second.
+    let nibbles = (spread >> 4 & 0x000f_000f_000f) | (spread & 0x000f_000f_000f) << 8;
+    // Adding 6 carries into bit 4 exactly for the nibbles 10-15, which need to become 'a'-'f' instead of ':'-'?'.
+    let letters = ((nibbles + 0x0606_0606_0606) >> 4) & 0x0101_0101_0101;
+    nibbles + 0x3030_3030_3030 + letters * (b'a' - b'0' - 10) as u64
+}
@@ -0,0 +1,180 @@
+use anyhow::{Context, Result, bail, ensure};
+
+use crate::{
+    DIRTY_SPAN_PIXELS, MAX_PORTS,
+    statistics::{MAX_QUEUE_STATS, PortStats, QueueStats, RTE_ETHDEV_QUEUE_STAT_CNTRS},
+};
+
+/// "PXFL" in little endian, needs to match `FB_MAGIC` of the server code.
+pub const FB_MAGIC: u32 = 0x4c46_5850;
+/// Needs to match `FB_LAYOUT_VERSION` of the server code.
+pub const FB_LAYOUT_VERSION: u16 = 3;
+/// One 32 bit word per pixel, the bytes in memory are r, g, b and an unused one.
+pub const FB_PIXEL_FORMAT_RGBX8888: u32 = 1;
+
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+pub struct Region {
+    pub offset: u64,
+    pub size: u64,
+}
+
+/// Header at the start of the shared memory describing where all regions are. Same memory layout as `struct fb_header`
+/// of the server code.
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+pub struct FbHeader {
+    pub magic: u32,
+    pub version: u16,
+    pub header_size: u16,
+    /// Size of the pixels in the shared memory, which is the size of the region of the screen the server owns.
+    pub width: u16,
+    pub height: u16,
+    pub pixel_format: u32,
+    /// Bytes between the start of two rows.
+    pub stride: u32,
+    pub dirty_span_pixels: u32,
+    pub max_ports: u32,
+    pub port_stats_size: u32,
+    pub max_queue_stats: u32,
+    pub queue_stats_size: u32,
+    pub eth_queue_stat_cntrs: u32,
+    /// The pixels only cover the region of the screen starting at (`region_x`, `region_y`), which is the whole screen
+    /// unless the server was started with `--region`.
+    pub screen_width: u16,
+    pub screen_height: u16,
+    pub region_x: u16,
+    pub region_y: u16,
+    pub reserved: u32,
+
+    pub pixels: Region,
+    pub port_stats: Region,
+    pub queue_stats: Region,
+    pub dirty: Region,
+}
+
+impl FbHeader {
+    /// Reads the header from the start of the shared memory of the given length.
+    ///
+    /// # Safety
+    ///
+    /// `ptr` needs to point to a mapping of at least `len` bytes.
+    pub unsafe fn read(ptr: *const u8, len: usize) -> Result<Self> {
+        ensure!(
+            len >= size_of::<Self>(),
+            "Invalid shared memory length. It needs to have at least a length of {} bytes for the header, but it \
+            only has {len} bytes.",
+            size_of::<Self>()
+        );
+        let header = unsafe { (ptr as *const Self).read_volatile() };
+
+        if header.magic != FB_MAGIC {
+            bail!(
+                "The shared memory does not start with the magic 0x{FB_MAGIC:08x} (found 0x{:08x}). Was it created \
+                by an older server?",
+                header.magic
+            );
+        }
+        if header.version != FB_LAYOUT_VERSION {
+            bail!(
+                "The shared memory has the layout version {}, but I only understand version {FB_LAYOUT_VERSION}",
+                header.version
+            );
+        }
+
+        header
+            .validate(len)
+            .context("Invalid shared memory header")?;
+        Ok(header)
+    }
+
+    fn validate(&self, len: usize) -> Result<()> {
+        ensure!(
+            self.width != 0 && self.height != 0,
+            "The size of the framebuffer was ({}, {}). Both values need to be non-null",
+            self.width,
+            self.height
+        );
+        ensure!(
+            self.region_x as u32 + self.width as u32 <= self.screen_width as u32
+                && self.region_y as u32 + self.height as u32 <= self.screen_height as u32,
+            "The region {}x{}+{}+{} does not fit into the screen of size ({}, {})",
+            self.width,
+            self.height,
+            self.region_x,
+            self.region_y,
+            self.screen_width,
+            self.screen_height
+        );
+        ensure!(
+            self.pixel_format == FB_PIXEL_FORMAT_RGBX8888,
+            "Unsupported pixel format {}",
+            self.pixel_format
+        );
+        // The dirty bitmap covers the pixels in memory order, so rows can't have padding for now
+        ensure!(
+            self.stride as usize == self.width as usize * 4,
+            "Unsupported stride of {} bytes for a width of {} pixels",
+            self.stride,
+            self.width
+        );
+        ensure!(
+            self.dirty_span_pixels as usize == DIRTY_SPAN_PIXELS,
+            "The server uses dirty spans of {} pixels, but I expected {DIRTY_SPAN_PIXELS}",
+            self.dirty_span_pixels
+        );
+
+        // The statistics are read as plain Rust structs, so they need to have exactly the same size
+        ensure!(
+            self.max_ports as usize == MAX_PORTS
+                && self.port_stats_size as usize == size_of::<PortStats>()
+                && self.eth_queue_stat_cntrs as usize == RTE_ETHDEV_QUEUE_STAT_CNTRS,
+            "The server has {} port stats of {} bytes with {} queue counters, but I expected {MAX_PORTS} of {} bytes \
+            with {RTE_ETHDEV_QUEUE_STAT_CNTRS} queue counters",
+            self.max_ports,
+            self.port_stats_size,
+            self.eth_queue_stat_cntrs,
+            size_of::<PortStats>()
+        );
+        ensure!(
+            self.max_queue_stats as usize == MAX_QUEUE_STATS
+                && self.queue_stats_size as usize == size_of::<QueueStats>(),
+            "The server has {} queue stats of {} bytes, but I expected {MAX_QUEUE_STATS} of {} bytes",
+            self.max_queue_stats,
+            self.queue_stats_size,
+            size_of::<QueueStats>()
+        );
+
+        let pixels = self.width as usize * self.height as usize;
+        let dirty_words = pixels.div_ceil(DIRTY_SPAN_PIXELS).div_ceil(64);
+        for (name, region, min_size, align) in [
+            ("pixels", self.pixels, pixels * 4, 4),
+            (
+                "port stats",
+                self.port_stats,
+                size_of::<[PortStats; MAX_PORTS]>(),
+                64,
+            ),
+            (
+                "queue stats",
+                self.queue_stats,
+                size_of::<[QueueStats; MAX_QUEUE_STATS]>(),
+                64,
+            ),
+            ("dirty bitmap", self.dirty, dirty_words * 8, 64),
+        ] {
+            let end = region.offset.checked_add(region.size);
+            ensure!(
+                region.size as usize >= min_size
+                    && region.offset as usize % align == 0
+                    && end.is_some_and(|end| end as usize <= len),
+                "The {name} region at offset {} with {} bytes is invalid, it needs to have at least {min_size} bytes, \
+                be aligned to {align} bytes and fit into the shared memory of {len} bytes",
+                region.offset,
+                region.size
+            );
+        }
+
+        Ok(())
+    }
+}
@@ -1,105 +1,173 @@
-use std::slice;
+use std::{fs::OpenOptions, slice, sync::atomic::AtomicU64};
 
-use anyhow::{Context, Result, bail};
+use anyhow::{Context, Result};
 use args::Args;
 use clap::Parser;
-use drawer::Drawer;
+use drawer::{Drawer, tick_frames};
+use memmap2::{MmapMut, MmapOptions};
 use prometheus_exporter::PrometheusExporter;
-use shared_memory::ShmemConf;
-use tokio::net::TcpStream;
+use shared_memory::{Shmem, ShmemConf};
+use tokio::sync::watch;
 use tracing::{debug, info, warn};
 
-use crate::{statistics::Statistics, tui::Tui};
+use crate::{
+    layout::FbHeader,
+    statistics::{MAX_QUEUE_STATS, QueueStats, Statistics},
+    tui::Tui,
+};
 
 mod args;
+mod benchmark;
 mod drawer;
+mod formatting;
+mod layout;
 mod prometheus_exporter;
 mod statistics;
 mod tui;
+mod zerocopy;
 
-// Width and height, both of type u16.
-const HEADER_SIZE: usize = 2 * std::mem::size_of::<u16>();
-
-/// This needs to align with the `MAX_PORTS` constant in the server code, so that we end up with the same memory layout
-/// for the shared memory!
+/// Number of port statistics slots, checked against the shared memory header. [`Statistics`] needs a fixed size.
 pub const MAX_PORTS: usize = 32;
 
+/// Every bit of the dirty bitmap covers this many consecutive pixels. Needs to match `DIRTY_SPAN_PIXELS` in the server
+/// code.
+pub const DIRTY_SPAN_PIXELS: usize = 64;
+
+/// The framebuffer is either backed by a POSIX shared memory (/dev/shm) or by a file on a hugetlbfs.
+enum SharedMemory {
+    Shm(Shmem),
+    Hugetlbfs(MmapMut),
+}
+
+impl SharedMemory {
+    fn open(args: &Args) -> anyhow::Result<Self> {
+        if let Some(hugepage_dir) = &args.hugepage_dir {
+            let path = format!(
+                "{hugepage_dir}/{}",
+                args.shared_memory_name.trim_start_matches('/')
+            );
+            let file = OpenOptions::new()
+                .read(true)
+                .write(true)
+                .open(&path)
+                .with_context(|| {
+                    format!("Failed to open shared memory at {path}. Is the backend running? Are you missing permissions (try sudo)?")
+                })?;
+            let mmap = unsafe { MmapOptions::new().map_mut(&file) }
+                .with_context(|| format!("Failed to mmap shared memory at {path}"))?;
+
+            return Ok(Self::Hugetlbfs(mmap));
+        }
+
+        let shmem = ShmemConf::new()
+            .os_id(&args.shared_memory_name)
+            .open()
+            .with_context(|| {
+                format!(
+                    "Failed to open shared memory with the OS id \"{}\" (probably at location /dev/shm/{}). Is the backend running? Are you missing permissions (try sudo)?",
+                    args.shared_memory_name, args.shared_memory_name
+                )
+            })?;
+
+        Ok(Self::Shm(shmem))
+    }
+
+    fn as_ptr(&self) -> *mut u8 {
+        match self {
+            Self::Shm(shmem) => shmem.as_ptr(),
+            Self::Hugetlbfs(mmap) => mmap.as_ptr() as *mut u8,
+        }
+    }
+
+    fn len(&self) -> usize {
+        match self {
+            Self::Shm(shmem) => shmem.len(),
+            Self::Hugetlbfs(mmap) => mmap.len(),
+        }
+    }
+}
+
 #[tokio::main]
 async fn main() -> Result<(), anyhow::Error> {
     let args = Args::parse();
 
     tracing_subscriber::fmt().init();
 
-    let shared_memory = ShmemConf::new()
-        .os_id(&args.shared_memory_name)
-        .open()
-        .with_context(|| {
-            format!(
-                "Failed to open shared memory with the OS id \"{}\" (probably at location /dev/shm/{}). Is the backend running? Are you missing permissions (try sudo)?",
-                args.shared_memory_name, args.shared_memory_name
-            )
-        })?;
-
-    debug!(size = shared_memory.len(), "Loaded shared memory");
-    if shared_memory.len() < HEADER_SIZE {
-        bail!(
-            "Invalid shared memory length. It needs to have at least a length of {HEADER_SIZE} bytes for the header,
-                but it only has {} bytes.",
-                shared_memory.len());
+    if args.benchmark {
+        benchmark::run();
+        return Ok(());
     }
-    let size_ptr = shared_memory.as_ptr() as *const u16;
-    let width = unsafe { *size_ptr };
-    let height = unsafe { *size_ptr.add(1) };
-
-    if width == 0 || height == 0 {
-        bail!(
-            "The size of the framebuffer was ({width}, {height}). Both values need to be non-null"
-        );
-    }
-    info!(width, height, "Found existing framebuffer");
 
-    warn!(
+    let shared_memory = SharedMemory::open(&args)?;
+
+    debug!(size = shared_memory.len(), "Loaded shared memory");
+    // All regions are located using the header, it also checks that they fit into the shared memory
+    let header = unsafe { FbHeader::read(shared_memory.as_ptr(), shared_memory.len()) }?;
+    let (width, height) = (header.width, header.height);
+    info!(
         width,
         height,
+        region_x = header.region_x,
+        region_y = header.region_y,
+        ?header,
+        "Found existing framebuffer"
+    );
+
+    warn!(
+        screen_width = header.screen_width,
+        screen_height = header.screen_height,
         "I should ask the server what resolution it is using (using the SIZE command) and check if they are the same, \
         but I'm lazy. Until this is implemented, it is your responsibility to make sure the resolutions match"
     );
 
-    let fb: &mut [u32] = unsafe {
-        slice::from_raw_parts_mut(
-            shared_memory.as_ptr().add(4) as _,
-            width as usize * height as usize,
+    let pixels = width as usize * height as usize;
+    let fb: &[u32] = unsafe {
+        slice::from_raw_parts(
+            shared_memory.as_ptr().add(header.pixels.offset as usize) as _,
+            pixels,
         )
     };
 
     let current_statistics: &Statistics = unsafe {
         (shared_memory
             .as_ptr()
-            .add(4 /* header */)
-            .add(width as usize * height as usize * 4 /* pixels */) as *const Statistics)
+            .add(header.port_stats.offset as usize) as *const Statistics)
             .as_ref()
             .unwrap()
     };
+    let queue_stats: &[QueueStats] = unsafe {
+        slice::from_raw_parts(
+            shared_memory
+                .as_ptr()
+                .add(header.queue_stats.offset as usize) as *const QueueStats,
+            MAX_QUEUE_STATS,
+        )
+    };
+    let dirty: &[AtomicU64] = unsafe {
+        slice::from_raw_parts(
+            shared_memory.as_ptr().add(header.dirty.offset as usize) as *const AtomicU64,
+            pixels.div_ceil(DIRTY_SPAN_PIXELS).div_ceil(64),
+        )
+    };
 
-    let sink = TcpStream::connect(&args.pixelflut_sink)
+    let (frame_tick, frame_tick_receiver) = watch::channel(0);
+    let drawers = Drawer::connect_bands(fb, dirty, &header, &args, frame_tick_receiver)
         .await
-        .with_context(|| {
-            format!(
-                "Failed to connect to Pixelflut sink at {}",
-                &args.pixelflut_sink
-            )
-        })?;
-    let mut drawer =
-        Drawer::new(fb, sink, width, height, &args).context("Failed to created drawer")?;
-    tokio::spawn(async move {
-        drawer.run().await.expect("failed to run drawer");
-    });
-
-    let prometheus_exporter = PrometheusExporter::new(current_statistics)
-        .context("Failed tio start Prometheus exporter")?;
+        .context("Failed to created drawers")?;
+    let connection_stats: Vec<_> = drawers.iter().map(Drawer::stats).collect();
+    for mut drawer in drawers {
+        tokio::spawn(async move {
+            drawer.run().await.expect("failed to run drawer");
+        });
+    }
+    tokio::spawn(tick_frames(frame_tick, args.fps));
+
+    let prometheus_exporter =
+        PrometheusExporter::new(current_statistics, queue_stats, connection_stats.clone())
+            .context("Failed tio start Prometheus exporter")?;
     tokio::spawn(async move { prometheus_exporter.run().await });
 
-    let mut tui = Tui::new(current_statistics);
+    let mut tui = Tui::new(current_statistics, &connection_stats);
     tui.run().context("Failed to start TUI")?;
 
     Ok(())
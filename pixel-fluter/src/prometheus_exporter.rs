@@ -1,13 +1,18 @@
-use std::time::Duration;
+use std::{sync::Arc, time::Duration};
 
 use anyhow::Context;
 use prometheus_exporter::prometheus::{IntGaugeVec, register_int_gauge_vec};
 use tokio::time::interval;
 
-use crate::statistics::Statistics;
+use crate::{
+    drawer::ConnectionStats,
+    statistics::{BURST_HISTOGRAM_BUCKETS, QueueStats, Statistics},
+};
 
 pub struct PrometheusExporter<'a> {
     current_statistics: &'a Statistics,
+    queue_stats: &'a [QueueStats],
+    connection_stats: Vec<Arc<ConnectionStats>>,
 
     metric_received_packets: IntGaugeVec,
     metric_transmitted_packets: IntGaugeVec,
@@ -26,12 +31,37 @@ pub struct PrometheusExporter<'a> {
 
     metric_received_bytes_per_queue: IntGaugeVec,
     metric_transmitted_bytes_per_queue: IntGaugeVec,
+
+    // Stats counted by the lcores polling the queues
+    metric_decoded_packets: IntGaugeVec,
+    metric_out_of_bounds_packets: IntGaugeVec,
+    metric_unknown_packets: IntGaugeVec,
+    metric_extra_pixels: IntGaugeVec,
+    metric_polled_packets: IntGaugeVec,
+    metric_empty_polls: IntGaugeVec,
+    metric_burst_size_bucket: IntGaugeVec,
+    metric_burst_size_count: IntGaugeVec,
+    metric_tx_dropped_replies: IntGaugeVec,
+    metric_ring_dropped_packets: IntGaugeVec,
+    metric_busy_cycles: IntGaugeVec,
+    metric_idle_cycles: IntGaugeVec,
+
+    // Stats of our own connections to the Pixelflut sink
+    metric_sink_sent_bytes: IntGaugeVec,
+    metric_sink_drawn_frames: IntGaugeVec,
+    metric_sink_missed_frames: IntGaugeVec,
 }
 
 impl<'a> PrometheusExporter<'a> {
-    pub fn new(current_statistics: &'a Statistics) -> anyhow::Result<Self> {
+    pub fn new(
+        current_statistics: &'a Statistics,
+        queue_stats: &'a [QueueStats],
+        connection_stats: Vec<Arc<ConnectionStats>>,
+    ) -> anyhow::Result<Self> {
         Ok(Self {
             current_statistics,
+            queue_stats,
+            connection_stats,
 
             // Descriptions copied from the struct `PortStats` (which in turn copies from DPDK)
 
@@ -108,6 +138,84 @@ impl<'a> PrometheusExporter<'a> {
                 "Total number of successfully transmitted queue bytes",
                 &["mac", "queue"],
             )?,
+
+            // lcore level stats
+            metric_decoded_packets: register_int_gauge_vec!(
+                "pixelflut_v6_decoded_packets",
+                "Total number of decoded packets per protocol",
+                &["mac", "port", "queue", "lcore", "role", "protocol"],
+            )?,
+            metric_out_of_bounds_packets: register_int_gauge_vec!(
+                "pixelflut_v6_out_of_bounds_packets",
+                "Total number of decoded packets setting a pixel outside of the framebuffer (or the region of the server)",
+                &["mac", "port", "queue", "lcore", "role"],
+            )?,
+            metric_unknown_packets: register_int_gauge_vec!(
+                "pixelflut_v6_unknown_packets",
+                "Total number of packets that are neither pixelflut v6 nor pingxelflut",
+                &["mac", "port", "queue", "lcore", "role"],
+            )?,
+            metric_extra_pixels: register_int_gauge_vec!(
+                "pixelflut_v6_extra_pixels",
+                "Total number of additional pixels of multi-pixel packets, either accepted or rejected (outside of the framebuffer or shard)",
+                &["mac", "port", "queue", "lcore", "role", "result"],
+            )?,
+            metric_polled_packets: register_int_gauge_vec!(
+                "pixelflut_v6_polled_packets",
+                "Total number of packets the lcore got from polling the queue",
+                &["mac", "port", "queue", "lcore", "role"],
+            )?,
+            metric_empty_polls: register_int_gauge_vec!(
+                "pixelflut_v6_empty_polls",
+                "Total number of polls of the queue that did not return any packets",
+                &["mac", "port", "queue", "lcore", "role"],
+            )?,
+            metric_burst_size_bucket: register_int_gauge_vec!(
+                "pixelflut_v6_burst_size_bucket",
+                "Number of non-empty polls of the queue that returned at most `le` packets",
+                &["mac", "port", "queue", "lcore", "role", "le"],
+            )?,
+            metric_burst_size_count: register_int_gauge_vec!(
+                "pixelflut_v6_burst_size_count",
+                "Total number of non-empty polls of the queue",
+                &["mac", "port", "queue", "lcore", "role"],
+            )?,
+            metric_tx_dropped_replies: register_int_gauge_vec!(
+                "pixelflut_v6_tx_dropped_replies",
+                "Total number of replies (such as pingxelflut size responses) that could not be sent",
+                &["mac", "port", "queue", "lcore", "role"],
+            )?,
+            metric_ring_dropped_packets: register_int_gauge_vec!(
+                "pixelflut_v6_ring_dropped_packets",
+                "Total number of packets a distributor dropped, as the ring to the worker was full",
+                &["mac", "port", "queue", "lcore", "role"],
+            )?,
+            metric_busy_cycles: register_int_gauge_vec!(
+                "pixelflut_v6_busy_cycles",
+                "Total number of TSC cycles the lcore spent on polls of the queue that returned packets. The utilization of an lcore is its busy cycles divided by its busy and idle cycles",
+                &["mac", "port", "queue", "lcore", "role"],
+            )?,
+            metric_idle_cycles: register_int_gauge_vec!(
+                "pixelflut_v6_idle_cycles",
+                "Total number of TSC cycles the lcore spent on polls of the queue that did not return any packets, including the idle backoff",
+                &["mac", "port", "queue", "lcore", "role"],
+            )?,
+
+            metric_sink_sent_bytes: register_int_gauge_vec!(
+                "pixel_fluter_sink_sent_bytes",
+                "Total number of bytes sent to the Pixelflut sink over the connection",
+                &["connection", "rows"],
+            )?,
+            metric_sink_drawn_frames: register_int_gauge_vec!(
+                "pixel_fluter_sink_drawn_frames",
+                "Total number of frames drawn over the connection",
+                &["connection", "rows"],
+            )?,
+            metric_sink_missed_frames: register_int_gauge_vec!(
+                "pixel_fluter_sink_missed_frames",
+                "Total number of frames skipped, because the connection was still busy sending the previous frame",
+                &["connection", "rows"],
+            )?,
         })
     }
 
@@ -200,6 +308,151 @@ impl<'a> PrometheusExporter<'a> {
                         );
                 }
             }
+
+            for queue_stats in self.queue_stats {
+                if queue_stats.in_use == 0 {
+                    continue;
+                }
+                self.export_queue_stats(stats, queue_stats);
+            }
+
+            for (connection, connection_stats) in self.connection_stats.iter().enumerate() {
+                let connection = connection.to_string();
+                let rows = format!(
+                    "{}-{}",
+                    connection_stats.rows.start, connection_stats.rows.end
+                );
+                let labels = [connection.as_str(), rows.as_str()];
+                let counters = connection_stats.load();
+                self.metric_sink_sent_bytes.with_label_values(&labels).set(
+                    counters
+                        .sent_bytes
+                        .try_into()
+                        .expect("convert sent_bytes to i64"),
+                );
+                self.metric_sink_drawn_frames
+                    .with_label_values(&labels)
+                    .set(
+                        counters
+                            .drawn_frames
+                            .try_into()
+                            .expect("convert drawn_frames to i64"),
+                    );
+                self.metric_sink_missed_frames
+                    .with_label_values(&labels)
+                    .set(
+                        counters
+                            .missed_frames
+                            .try_into()
+                            .expect("convert missed_frames to i64"),
+                    );
+            }
+        }
+    }
+
+    fn export_queue_stats(&self, stats: &Statistics, queue_stats: &QueueStats) {
+        let Some(port_stats) = stats.port_stats.get(queue_stats.port_slot as usize) else {
+            return;
+        };
+        let mac = port_stats.mac_addr.to_string();
+        let port = queue_stats.port.to_string();
+        let queue = queue_stats.queue.to_string();
+        let lcore = queue_stats.lcore.to_string();
+        let role = queue_stats.role_name();
+        let labels = [
+            mac.as_str(),
+            port.as_str(),
+            queue.as_str(),
+            lcore.as_str(),
+            role,
+        ];
+
+        let decoder = &queue_stats.decoder;
+        for (protocol, packets) in [
+            ("pixelflut-v6", decoder.pixelflut_v6),
+            ("pingxelflut-v6", decoder.pingxelflut_v6),
+            ("pingxelflut-v4", decoder.pingxelflut_v4),
+        ] {
+            self.metric_decoded_packets
+                .with_label_values(&[&mac, &port, &queue, &lcore, role, protocol])
+                .set(packets.try_into().expect("convert decoded packets to i64"));
+        }
+        self.metric_out_of_bounds_packets
+            .with_label_values(&labels)
+            .set(
+                decoder
+                    .out_of_bounds
+                    .try_into()
+                    .expect("convert out_of_bounds to i64"),
+            );
+        self.metric_unknown_packets
+            .with_label_values(&labels)
+            .set(decoder.unknown.try_into().expect("convert unknown to i64"));
+        for (result, pixels) in [
+            ("accepted", decoder.extra_pixels),
+            ("rejected", decoder.extra_pixels_rejected),
+        ] {
+            self.metric_extra_pixels
+                .with_label_values(&[&mac, &port, &queue, &lcore, role, result])
+                .set(pixels.try_into().expect("convert extra pixels to i64"));
+        }
+        self.metric_polled_packets.with_label_values(&labels).set(
+            queue_stats
+                .rx_packets
+                .try_into()
+                .expect("convert rx_packets to i64"),
+        );
+        self.metric_empty_polls.with_label_values(&labels).set(
+            queue_stats
+                .empty_polls
+                .try_into()
+                .expect("convert empty_polls to i64"),
+        );
+
+        // Export it the same way a Prometheus histogram is, so that e.g. histogram_quantile() works.
+        // Bucket i contains the bursts with [2^i, 2^(i+1)) packets, so its upper bound is 2^(i+1) - 1.
+        let mut cumulative: u64 = 0;
+        for (bucket, bursts) in queue_stats.burst_sizes.iter().enumerate() {
+            cumulative += bursts;
+            let le = if bucket == BURST_HISTOGRAM_BUCKETS - 1 {
+                "+Inf".to_owned()
+            } else {
+                ((2u64 << bucket) - 1).to_string()
+            };
+            self.metric_burst_size_bucket
+                .with_label_values(&[&mac, &port, &queue, &lcore, role, &le])
+                .set(cumulative.try_into().expect("convert burst sizes to i64"));
         }
+        self.metric_burst_size_count
+            .with_label_values(&labels)
+            .set(cumulative.try_into().expect("convert burst sizes to i64"));
+        self.metric_tx_dropped_replies
+            .with_label_values(&labels)
+            .set(
+                queue_stats
+                    .tx_dropped
+                    .try_into()
+                    .expect("convert tx_dropped to i64"),
+            );
+        self.metric_ring_dropped_packets
+            .with_label_values(&labels)
+            .set(
+                queue_stats
+                    .ring_dropped
+                    .try_into()
+                    .expect("convert ring_dropped to i64"),
+            );
+        self.metric_busy_cycles.with_label_values(&labels).set(
+            queue_stats
+                .busy_cycles
+                .try_into()
+                .expect("convert busy_cycles to i64"),
+        );
+        self.metric_idle_cycles.with_label_values(&labels).set(
+            queue_stats
+                .idle_cycles
+                .try_into()
+                .expect("convert idle_cycles to i64"),
+        );
     }
 }
@@ -4,8 +4,21 @@ use macaddr::MacAddr6;
 
 use crate::MAX_PORTS;
 
-/// Reverse-engineered, IDK where this constant is defined
-const RTE_ETHDEV_QUEUE_STAT_CNTRS: usize = 16;
+/// Length of the per queue counters of `rte_eth_stats` (a DPDK build option), checked against the shared memory header
+pub const RTE_ETHDEV_QUEUE_STAT_CNTRS: usize = 16;
+
+/// Needs to match the server code
+pub const MAX_QUEUE_STATS: usize = 512;
+/// Needs to match the server code
+pub const BURST_HISTOGRAM_BUCKETS: usize = 6;
+
+/// Roles of the lcore writing a [`QueueStats`], needs to match `enum queue_stats_role` of the server code.
+/// The lcore polls the RX queue and decodes the packets.
+pub const QUEUE_ROLE_RX: u16 = 0;
+/// The lcore polls the RX queue and hands the packets to its workers.
+pub const QUEUE_ROLE_DISTRIBUTOR: u16 = 1;
+/// The lcore decodes the packets a distributor polled from the RX queue.
+pub const QUEUE_ROLE_WORKER: u16 = 2;
 
 #[repr(C)]
 #[derive(Clone, Default)]
@@ -219,3 +232,63 @@ impl PortStats {
         }
     }
 }
+
+/// Statistics of a single RX queue, written by the lcore polling it. Same memory layout as `struct queue_stats` in the
+/// server code.
+#[repr(C, align(64))]
+#[derive(Clone, Default, Debug)]
+pub struct QueueStats {
+    /// Zero in case the slot is free.
+    pub in_use: u16,
+    /// Index into [`Statistics::port_stats`].
+    pub port_slot: u16,
+    pub port: u16,
+    pub queue: u16,
+    pub lcore: u32,
+    /// One of the `QUEUE_ROLE_*` constants.
+    pub role: u16,
+    _reserved: u16,
+
+    pub decoder: DecoderStats,
+    /// Total number of packets received on this queue. For workers the packets received from their distributor.
+    pub rx_packets: u64,
+    /// Number of polls that did not return any packet.
+    pub empty_polls: u64,
+    /// Bucket i counts the bursts with [2^i, 2^(i+1)) packets.
+    pub burst_sizes: [u64; BURST_HISTOGRAM_BUCKETS],
+    /// Replies (e.g. pingxelflut SIZE_RESPONSE) that could not be sent.
+    pub tx_dropped: u64,
+    /// Packets the distributor could not hand to a worker, as the ring of the worker was full.
+    pub ring_dropped: u64,
+    /// TSC cycles spent on polls that returned packets, including decoding them.
+    pub busy_cycles: u64,
+    /// TSC cycles spent on empty polls, including the idle backoff.
+    pub idle_cycles: u64,
+}
+
+impl QueueStats {
+    pub fn role_name(&self) -> &'static str {
+        match self.role {
+            QUEUE_ROLE_RX => "rx",
+            QUEUE_ROLE_DISTRIBUTOR => "distributor",
+            QUEUE_ROLE_WORKER => "worker",
+            _ => "unknown",
+        }
+    }
+}
+
+#[repr(C)]
+#[derive(Clone, Default, Debug)]
+pub struct DecoderStats {
+    pub pixelflut_v6: u64,
+    pub pingxelflut_v6: u64,
+    pub pingxelflut_v4: u64,
+    /// Packets of any protocol trying to set a pixel outside of the framebuffer.
+    pub out_of_bounds: u64,
+    /// Packets that are neither pixelflut v6 nor pingxelflut.
+    pub unknown: u64,
+    /// Additional pixels of multi-pixel pixelflut v6 packets, which are not counted as packets.
+    pub extra_pixels: u64,
+    /// Additional pixels outside of the framebuffer or the shard of the server.
+    pub extra_pixels_rejected: u64,
+}
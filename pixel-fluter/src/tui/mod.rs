@@ -1,11 +1,17 @@
-use std::time::{Duration, Instant};
+use std::{
+    sync::Arc,
+    time::{Duration, Instant},
+};
 
 use anyhow::Context;
 use input_handling::handle_event;
 use rendering::render;
 use state::{Message, Model, RunningState, update};
 
-use crate::statistics::{PortStats, Statistics};
+use crate::{
+    drawer::{ConnectionCounters, ConnectionStats},
+    statistics::{PortStats, Statistics},
+};
 
 mod input_handling;
 mod rendering;
@@ -15,15 +21,22 @@ pub struct Tui<'a> {
     current_statistics: &'a Statistics,
     prev_statistics: Statistics,
     diff: Statistics,
+    connection_stats: &'a [Arc<ConnectionStats>],
+    prev_connection_counters: Vec<ConnectionCounters>,
     last_tick: Instant,
 }
 
 impl<'a> Tui<'a> {
-    pub fn new(current_statistics: &'a Statistics) -> Self {
+    pub fn new(
+        current_statistics: &'a Statistics,
+        connection_stats: &'a [Arc<ConnectionStats>],
+    ) -> Self {
         Self {
             current_statistics,
             prev_statistics: current_statistics.clone(),
             diff: Statistics::default(),
+            connection_stats,
+            prev_connection_counters: connection_stats.iter().map(|stats| stats.load()).collect(),
             last_tick: Instant::now(),
         }
     }
@@ -85,6 +98,19 @@ impl<'a> Tui<'a> {
                     )
                     .collect();
                 update(&mut model, Message::StatsUpdate { stats });
+
+                let connections = self
+                    .connection_stats
+                    .iter()
+                    .zip(self.prev_connection_counters.iter_mut())
+                    .map(|(stats, prev)| {
+                        let current = stats.load();
+                        let diff = current.saturating_sub(prev);
+                        *prev = current;
+                        (stats.rows.clone(), current, diff)
+                    })
+                    .collect();
+                update(&mut model, Message::ConnectionsUpdate { connections });
             }
 
             // Render the current view
@@ -13,11 +13,18 @@ use crate::statistics::PortStats;
 use super::state::Model;
 
 pub fn render(model: &mut Model, frame: &mut Frame) {
-    let [ports_area, queues_area] =
-        Layout::vertical([Constraint::Fill(1), Constraint::Fill(2)]).areas(frame.area());
+    // Border, header and its margin, one line per connection and the total (including its margin)
+    let connections_height = model.connections.len() as u16 + 5;
+    let [ports_area, queues_area, connections_area] = Layout::vertical([
+        Constraint::Fill(1),
+        Constraint::Fill(2),
+        Constraint::Length(connections_height),
+    ])
+    .areas(frame.area());
 
     render_ports(model, ports_area, frame.buffer_mut());
     render_queues(model, queues_area, frame.buffer_mut());
+    render_connections(model, connections_area, frame.buffer_mut());
 }
 
 pub fn render_ports(model: &mut Model, area: Rect, buffer: &mut Buffer) {
@@ -176,6 +183,71 @@ fn get_queue_rows<'a>(current_port_stats: &PortStats, diff: &PortStats) -> Vec<R
     rows
 }
 
+pub fn render_connections(model: &Model, area: Rect, buffer: &mut Buffer) {
+    let mut rows = Vec::new();
+    let (mut total_bytes, mut total_bytes_per_s) = (0, 0);
+
+    for (connection, (band, current, diff)) in model.connections.iter().enumerate() {
+        total_bytes += current.sent_bytes;
+        total_bytes_per_s += diff.sent_bytes;
+        rows.push(Row::new(vec![
+            connection.to_string(),
+            format!("{}-{}", band.start, band.end),
+            format_bytes_per_s(diff.sent_bytes as f64),
+            diff.drawn_frames.to_string(),
+            diff.missed_frames.to_string(),
+            format_bytes(current.sent_bytes as f64),
+            current.missed_frames.to_string(),
+        ]));
+    }
+    rows.push(
+        Row::new(vec![
+            "Total".to_owned(),
+            String::new(),
+            format_bytes_per_s(total_bytes_per_s as f64),
+            String::new(),
+            String::new(),
+            format_bytes(total_bytes as f64),
+            String::new(),
+        ])
+        .top_margin(1)
+        .yellow(),
+    );
+
+    let widths = [
+        Constraint::Length(10),
+        Constraint::Length(11),
+        Constraint::Length(13),
+        Constraint::Length(13),
+        Constraint::Length(13),
+        Constraint::Length(13),
+        Constraint::Length(13),
+    ];
+    let table = Table::new(rows, widths)
+        .column_spacing(1)
+        .style(Style::new())
+        .header(
+            Row::new(vec![
+                "Connection",
+                "Rows",
+                "Bit/s",
+                "Frames/s",
+                "Missed fr/s",
+                "Bytes",
+                "Missed frames",
+            ])
+            .style(Style::new().bold())
+            .bottom_margin(1),
+        )
+        .block(
+            Block::new()
+                .title("Pixelflut sink connections")
+                .borders(Borders::TOP),
+        );
+
+    Widget::render(table, area, buffer);
+}
+
 fn format_bytes(bytes: f64) -> String {
     match NumberPrefix::decimal(bytes) {
         NumberPrefix::Standalone(bytes) => {
@@ -1,8 +1,8 @@
-use std::cmp::min;
+use std::{cmp::min, ops::Range};
 
 use ratatui::widgets::TableState;
 
-use crate::statistics::PortStats;
+use crate::{drawer::ConnectionCounters, statistics::PortStats};
 
 #[derive(Default)]
 pub struct Model {
@@ -12,8 +12,13 @@ pub struct Model {
     /// First tuple element is total number of packets, the second element is the ones received in
     /// the last second
     pub stats: Vec<(PortStats, PortStats)>,
+
+    /// The rows, total counters and counters of the last second of every connection to the Pixelflut sink
+    pub connections: Vec<ConnectionRow>,
 }
 
+pub type ConnectionRow = (Range<u16>, ConnectionCounters, ConnectionCounters);
+
 #[derive(Debug, Default, PartialEq)]
 pub enum RunningState {
     #[default]
@@ -27,6 +32,7 @@ pub enum Message {
     PortListUp { steps: usize },
     PortListDown { steps: usize },
     StatsUpdate { stats: Vec<(PortStats, PortStats)> },
+    ConnectionsUpdate { connections: Vec<ConnectionRow> },
 }
 
 pub fn update(model: &mut Model, message: Message) -> Option<Message> {
@@ -59,6 +65,7 @@ pub fn update(model: &mut Model, message: Message) -> Option<Message> {
             model.ports_table_state.select(Some(new_selected));
         }
         Message::StatsUpdate { stats } => model.stats = stats,
+        Message::ConnectionsUpdate { connections } => model.connections = connections,
     }
 
     None
@@ -0,0 +1,169 @@
+use std::{
+    io::{self, IoSlice},
+    mem,
+    os::fd::{AsRawFd, RawFd},
+};
+
+use anyhow::Context;
+use tokio::{io::Interest, net::TcpStream};
+use tracing::warn;
+
+// Not (yet) part of the libc crate, see linux/errqueue.h
+const SO_EE_ORIGIN_ZEROCOPY: u8 = 5;
+const SO_EE_CODE_ZEROCOPY_COPIED: u8 = 1;
+
+/// Sends using `MSG_ZEROCOPY`, so the kernel transmits straight from our pages instead of copying them into the socket
+/// buffer.
+///
+/// The buffers must not change until the kernel reports (on the error queue of the socket) that it is done with them,
+/// which happens once the sink acknowledged the data. For the pixels that does not matter, as they are sent from the
+/// shared memory, which the server keeps updating anyway. The PXMULTI headers however must stay untouched, so call
+/// [`ZeroCopySender::wait_for_completions`] before building the headers of the next frame.
+pub struct ZeroCopySender {
+    /// Number of `sendmsg` calls, which the kernel uses as sequence numbers of the completions.
+    sent: u32,
+    completed: u32,
+    warned_copied: bool,
+}
+
+impl ZeroCopySender {
+    pub fn enable(sink: &TcpStream) -> anyhow::Result<Self> {
+        let one: libc::c_int = 1;
+        let ret = unsafe {
+            libc::setsockopt(
+                sink.as_raw_fd(),
+                libc::SOL_SOCKET,
+                libc::SO_ZEROCOPY,
+                &one as *const _ as *const libc::c_void,
+                mem::size_of_val(&one) as libc::socklen_t,
+            )
+        };
+        if ret != 0 {
+            return Err(io::Error::last_os_error())
+                .context("Failed to enable SO_ZEROCOPY on the Pixelflut sink connection");
+        }
+
+        Ok(Self {
+            sent: 0,
+            completed: 0,
+            warned_copied: false,
+        })
+    }
+
+    /// Like `write_vectored`, returns the number of bytes the kernel took.
+    pub async fn send(
+        &mut self,
+        sink: &TcpStream,
+        iovecs: &[IoSlice<'_>],
+    ) -> anyhow::Result<usize> {
+        loop {
+            sink.writable()
+                .await
+                .context("Failed to wait for Pixelflut sink")?;
+            match sink.try_io(Interest::WRITABLE, || {
+                sendmsg_zerocopy(sink.as_raw_fd(), iovecs)
+            }) {
+                Ok(written) => {
+                    self.sent = self.sent.wrapping_add(1);
+                    return Ok(written);
+                }
+                Err(err) if err.kind() == io::ErrorKind::WouldBlock => continue,
+                // The kernel limits the memory pinned by outstanding sends
+                Err(err)
+                    if err.raw_os_error() == Some(libc::ENOBUFS) && self.completed != self.sent =>
+                {
+                    self.wait_for_completions(sink).await?;
+                }
+                Err(err) => return Err(err).context("Failed to send to Pixelflut sink"),
+            }
+        }
+    }
+
+    /// Waits until the kernel is done with the buffers of all previous sends.
+    pub async fn wait_for_completions(&mut self, sink: &TcpStream) -> anyhow::Result<()> {
+        while self.completed != self.sent {
+            sink.ready(Interest::ERROR)
+                .await
+                .context("Failed to wait for MSG_ZEROCOPY completions")?;
+            let (first, last, copied) =
+                match sink.try_io(Interest::ERROR, || recv_completion(sink.as_raw_fd())) {
+                    Ok(completion) => completion,
+                    Err(err) if err.kind() == io::ErrorKind::WouldBlock => continue,
+                    Err(err) => {
+                        return Err(err).context("Failed to receive MSG_ZEROCOPY completions");
+                    }
+                };
+
+            // Completions of consecutive sends are merged into a single range
+            self.completed = self
+                .completed
+                .wrapping_add(last.wrapping_sub(first).wrapping_add(1));
+            if copied && !self.warned_copied {
+                self.warned_copied = true;
+                warn!(
+                    "The kernel copied the data despite MSG_ZEROCOPY (e.g. because the sink is on loopback or the NIC \
+                    does not support scatter-gather), so --zerocopy only adds overhead"
+                );
+            }
+        }
+
+        Ok(())
+    }
+}
+
+fn sendmsg_zerocopy(fd: RawFd, iovecs: &[IoSlice<'_>]) -> io::Result<usize> {
+    let mut msg: libc::msghdr = unsafe { mem::zeroed() };
+    // IoSlice is guaranteed to be ABI compatible with iovec
+    msg.msg_iov = iovecs.as_ptr() as *mut libc::iovec;
+    msg.msg_iovlen = iovecs.len() as _;
+
+    let ret = unsafe { libc::sendmsg(fd, &msg, libc::MSG_ZEROCOPY | libc::MSG_NOSIGNAL) };
+    if ret < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(ret as usize)
+}
+
+/// Reads one completion from the error queue and returns the range of sends it covers and whether the kernel had to
+/// copy the data after all.
+fn recv_completion(fd: RawFd) -> io::Result<(u32, u32, bool)> {
+    // u64, so that the control messages are aligned
+    let mut control = [0u64; 16];
+    let mut msg: libc::msghdr = unsafe { mem::zeroed() };
+    msg.msg_control = control.as_mut_ptr() as *mut libc::c_void;
+    msg.msg_controllen = mem::size_of_val(&control) as _;
+
+    let ret = unsafe { libc::recvmsg(fd, &mut msg, libc::MSG_ERRQUEUE | libc::MSG_DONTWAIT) };
+    if ret < 0 {
+        return Err(io::Error::last_os_error());
+    }
+
+    let cmsg = unsafe { libc::CMSG_FIRSTHDR(&msg) };
+    if cmsg.is_null() {
+        return Err(io::Error::other(
+            "Error queue message without control message",
+        ));
+    }
+    let (level, kind) = unsafe { ((*cmsg).cmsg_level, (*cmsg).cmsg_type) };
+    if !(level == libc::SOL_IP && kind == libc::IP_RECVERR
+        || level == libc::SOL_IPV6 && kind == libc::IPV6_RECVERR)
+    {
+        return Err(io::Error::other(format!(
+            "Unexpected control message (level {level}, type {kind}) on the error queue"
+        )));
+    }
+
+    let err = unsafe { (libc::CMSG_DATA(cmsg) as *const libc::sock_extended_err).read_unaligned() };
+    if err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY {
+        return Err(io::Error::other(format!(
+            "Unexpected error (errno {}, origin {}) on the error queue",
+            err.ee_errno, err.ee_origin
+        )));
+    }
+
+    Ok((
+        err.ee_info,
+        err.ee_data,
+        err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED != 0,
+    ))
+}